@@ -0,0 +1,59 @@
+@echo off
+rem Компиляция всех вариантов шейдеров в байткод (x64 Developer Command Prompt).
+rem Результат — shaders\compiled\*.h + all.h с таблицей для capture_bridge.cpp:
+rem запустить до cl, тогда рендерер не грузит d3dcompiler_47.dll на старте.
+rem Без all.h шейдеры компилируются при запуске из shaders\*.hlsl (режим
+rem разработчика) и складываются в shader_cache.bin.
+rem Defines передаются в кавычках: "=" в аргументах call — разделитель.
+
+setlocal
+cd /d "%~dp0"
+if not exist shaders\compiled mkdir shaders\compiled
+set FXC=fxc /nologo /O3 /Qstrip_reflect /Qstrip_debug /E main
+
+call :compile fullscreen_vs  vs_5_0 fullscreen_vs.hlsl                                 || goto :fail
+call :compile overlay_vs     vs_5_0 overlay_vs.hlsl                                    || goto :fail
+call :compile overlay_ps     ps_5_0 overlay_ps.hlsl                                    || goto :fail
+call :compile overlay_ps_pq  ps_5_0 overlay_ps.hlsl "/DOUT_PQ=1"                       || goto :fail
+call :compile video_ps_bgr   ps_5_0 video_ps.hlsl                                      || goto :fail
+call :compile scale_ps_bilinear  ps_5_0 scale_ps.hlsl "/DSCALE_BILINEAR=1"             || goto :fail
+call :compile scale_ps_bicubic_x ps_5_0 scale_ps.hlsl "/DSCALE_BICUBIC=1"              || goto :fail
+call :compile scale_ps_bicubic_y ps_5_0 scale_ps.hlsl "/DSCALE_BICUBIC=1" "/DAXIS_Y=1" || goto :fail
+call :compile scale_ps_lanczos_x ps_5_0 scale_ps.hlsl "/DSCALE_LANCZOS=1"              || goto :fail
+call :compile scale_ps_lanczos_y ps_5_0 scale_ps.hlsl "/DSCALE_LANCZOS=1" "/DAXIS_Y=1" || goto :fail
+call :compile video_ps_yuy2  ps_5_0 video_ps.hlsl "/DFMT_YUY2=1"                       || goto :fail
+call :compile video_ps_nv12  ps_5_0 video_ps.hlsl "/DFMT_NV12=1"                       || goto :fail
+call :compile video_ps_p010  ps_5_0 video_ps.hlsl "/DFMT_NV12=1" "/DFMT_P010=1"        || goto :fail
+
+rem all.h пишется последним: частично собранный набор не подхватывается.
+set OUT=shaders\compiled\all.h
+> %OUT%.tmp echo // Сгенерировано build_shaders.cmd — не редактировать.
+>>%OUT%.tmp echo #pragma once
+for %%f in (shaders\compiled\*.h) do if /i not "%%~nf"=="all" >>%OUT%.tmp echo #include "%%~nxf"
+>>%OUT%.tmp echo static const EmbeddedShader s_embeddedShaders[] = {
+for %%f in (shaders\compiled\*.h) do if /i not "%%~nf"=="all" >>%OUT%.tmp echo     { "%%~nf", g_%%~nf, sizeof(g_%%~nf) },
+>>%OUT%.tmp echo     { nullptr, nullptr, 0 }
+>>%OUT%.tmp echo };
+move /y %OUT%.tmp %OUT% > nul
+echo [OK] %OUT%
+exit /b 0
+
+:compile
+set NAME=%1
+set TARGET=%2
+set SRC=%3
+shift & shift & shift
+set DEFS=
+:defs
+if "%~1"=="" goto :run
+set DEFS=%DEFS% %1
+shift
+goto :defs
+:run
+%FXC% /T %TARGET% %DEFS% /Vn g_%NAME% /Fh shaders\compiled\%NAME%.h shaders\%SRC% > nul
+exit /b %ERRORLEVEL%
+
+:fail
+echo [ERROR] Shader compilation failed
+if exist shaders\compiled\all.h del shaders\compiled\all.h
+exit /b 1
@@ -2,24 +2,72 @@
  * External Display Bridge v3.0 — C++ / DirectX 11
  *
  * Ключевые оптимизации:
- *   - Нет cv::cvtColor: сырые BGR данные идут напрямую в GPU
+ *   - Нет cv::cvtColor: BGR→BGRA расширение SSSE3/AVX2 ядром прямо в mapped.pData
  *   - GPU Swizzling: BGR→RGB перестановка в HLSL пиксельном шейдере
- *   - Zero-Copy Upload: D3D11_MAP_WRITE_DISCARD, только добавляем alpha=255
+ *   - YUY2 Passthrough: сырой 4:2:2 уходит в GPU, YUV→RGB в шейдере
+ *   - Цвет на GPU тем же проходом: BT.601/709/2020, limited/full, PQ/HLG →
+ *     SDR тон-маппинг или HDR10 swap chain (R10G10B10A2, PQ BT.2020)
+ *   - Выбор режима по цене: NV12 < YUY2 < P010 < MJPG (--mode, --format)
+ *   - MJPG: декодер MF (DXVA) сразу в NV12 текстуру, Y + UV view в шейдере
+ *   - Media Foundation бэкенд (--backend mf): асинхронный IMFSourceReader,
+ *     D3D11 device manager, сэмплы без промежуточных копий
+ *   - Upload ring: N staging текстур + CopyResource в DEFAULT, Map без ожидания
+ *     (--upload dynamic — прежний D3D11_MAP_WRITE_DISCARD)
+ *   - MF / synthetic: поток захвата пишет кадр прямо в замапленный staging слот
+ *     рендера, сэмпл сразу возвращается в пул MF
  *   - Triple Buffering: атомарный свап без мьютексов
+ *   - Несколько устройств (--devices): свой поток и TripleBuffer у каждого,
+ *     сетка или картинка в картинке (--layout) одним Present
+ *   - OpenCV: пул кадров один раз на сессию, large pages или VirtualLock
+ *   - --dirty: хеши тайлов 64x64, загрузка только изменившихся, без Present
+ *     для кадров без изменений
+ *   - Waitable swap chain: SetMaximumFrameLatency(1), рендер ждёт очередь present
+ *   - Per-monitor DPI aware (v2), монитор на выбор (--monitor): окно и back
+ *     buffer в его физическом разрешении, устройство — на его адаптере
+ *   - Проверка пути кадра (independent flip / overlay или композиция DWM)
+ *     раз в секунду; --scanout — масштаб плоскостью overlay (SetSourceSize)
+ *   - Темп Present: off / vsync / VRR по темпу захвата / перед vblank
+ *     (WaitForVBlank на отдельном потоке)
  *   - Адаптивный рендерер: автопересоздание текстуры при смене разрешения
- *   - FPS оверлей без .clone(): рисуем прямо в буфер
+ *   - Восстановление: потерянный захват переоткрывается в фоне, TDR —
+ *     пересоздание рендера без перезапуска и стартовых вопросов
+ *   - Масштабирование на GPU: nearest / integer / bilinear / bicubic / Lanczos
+ *     (--scale, клавиша), время проходов по GPU timestamp запросам
+ *   - Метки QPC по этапам кадра, p50/p99/max в оверлее и --latency-log
+ *   - Калибровка задержки по мигающему маркеру: --sender / --calibrate
+ *   - Запись (--record): аппаратный H.264 / HEVC кодер MF прямо из текстуры,
+ *     свой поток, кадры записи пропускаются раньше, чем ждёт показ
+ *   - --bench: синтетический источник + JSON отчёт, без устройства и консоли
+ *   - FPS оверлей на GPU: glyph atlas (GDI) + квады, кадр захвата не трогается
+ *   - Шейдеры вшиты байткодом (build_shaders.cmd): без D3DCompile на старте
  *   - MMCSS "Pro Audio" / "Games", REALTIME_PRIORITY_CLASS
- *   - Интерактивный выбор устройства при запуске
- *   - Настраиваемые клавиши управления (сохранение в keybindings.bin)
+ *   - CPU sets: захват (каждый источник) и рендер — на своих P-ядрах,
+ *     помощники — на E-ядрах (--cpu-sets)
+ *   - Интерактивный выбор устройства при запуске: режимы устройств
+ *     пробуются параллельно в фоне и кэшируются (device_cache.bin),
+ *     список отсортирован по лучшему режиму; --quick — без вопросов
+ *     по профилю прошлой сессии (session.bin); захват открывается
+ *     параллельно с созданием swap chain и шейдеров
+ *   - Настраиваемые клавиши управления (сохранение в keybindings.bin),
+ *     события Raw Input (WM_INPUT) вместо опроса GetAsyncKeyState
  *
  * Сборка (x64 Developer Command Prompt):
  *
  *   cd C:\Users\Кирилл\Downloads
+ *   build_shaders.cmd
  *   cl /O2 /EHsc /std:c++17 capture_bridge.cpp ^
  *      /I"C:\Users\Кирилл\Downloads\opencv\build\include" ^
  *      /link /LIBPATH:"C:\Users\Кирилл\Downloads\opencv\build\x64\vc16\lib" ^
  *      opencv_world4120.lib d3d11.lib dxgi.lib d3dcompiler.lib avrt.lib ^
- *      user32.lib kernel32.lib ole32.lib oleaut32.lib strmiids.lib
+ *      user32.lib kernel32.lib ole32.lib oleaut32.lib strmiids.lib ^
+ *      mfplat.lib mfreadwrite.lib mf.lib mfuuid.lib synchronization.lib ^
+ *      gdi32.lib advapi32.lib delayimp.lib /DELAYLOAD:opencv_world4120.dll ^
+ *      /DELAYLOAD:d3dcompiler_47.dll
+ *
+ * /DELAYLOAD: с --backend mf OpenCV не вызывается на старте, и 70 MB DLL
+ * не грузится вообще: все cv:: вызовы — только в OpenCV бэкенде.
+ * d3dcompiler_47.dll нужна только без build_shaders.cmd (компиляция
+ * shaders\*.hlsl при запуске, см. ShaderLibrary).
  */
 
 #ifndef WIN32_LEAN_AND_MEAN
@@ -30,12 +78,22 @@
 
 #include <windows.h>
 #include <dshow.h>
+#include <dvdmedia.h>
 #include <comdef.h>
 #include <avrt.h>
 #include <d3d11.h>
+#include <d3d11_4.h>
 #include <dxgi1_2.h>
+#include <dxgi1_3.h>
 #include <dxgi1_5.h>
+#include <dxgi1_6.h>
 #include <d3dcompiler.h>
+#include <mfapi.h>
+#include <mfidl.h>
+#include <mfreadwrite.h>
+#include <mferror.h>
+#include <intrin.h>
+#include <immintrin.h>
 
 #include <atomic>
 #include <array>
@@ -47,15 +105,442 @@
 #include <vector>
 #include <fstream>
 #include <cstring>
+#include <cmath>
+#include <climits>
+#include <cstdlib>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <list>
+#include <iterator>
+#include <map>
 
-#include <opencv2/imgproc.hpp>
 #include <opencv2/videoio.hpp>
+#include <opencv2/imgcodecs.hpp>
 
 // ─── Глобальные флаги ────────────────────────────────────────────────────────
 
 static std::atomic<bool> g_running { true  };
 static std::atomic<bool> g_showFPS  { false };
-static std::atomic<bool> g_vsync    { false };
+static std::atomic<bool> g_deviceChanged { false };   // WM_DEVICECHANGE, см. Reconnector
+
+// Темп Present (см. PresentPacer), клавиша VSync перебирает режимы по кругу.
+enum class PresentPacing { Off, VSync, Vrr, Scheduled };
+static const int PRESENT_PACING_COUNT = 4;
+static std::atomic<PresentPacing> g_pacing { PresentPacing::Off };
+
+// ─── Параметры командной строки ──────────────────────────────────────────────
+
+enum class ColorMatrix    { Auto, BT601, BT709, BT2020 };
+enum class ColorRange     { Auto, Limited, Full };
+enum class TransferFn     { SDR, PQ, HLG };
+enum class OutputMode     { Auto, SDR, HDR10 };
+enum class CaptureBackend { Auto, OpenCV, MediaFoundation };
+enum class UploadMode     { Dynamic, Ring };
+enum class ScaleMode      { Nearest, Integer, Bilinear, Bicubic, Lanczos };
+enum class LayoutMode     { Grid, Pip };
+
+static const int SCALE_MODE_COUNT = 5;
+
+// --devices: каждый источник — свой поток захвата и TripleBuffer, кадры
+// рисуются в ячейки одного окна. Больше сетки 3 x 3 ячейки слишком мелкие.
+static const size_t MAX_SOURCES = 9;
+
+static const char* scaleModeName(ScaleMode m)
+{
+    static const char* names[] = { "nearest", "integer", "bilinear", "bicubic", "lanczos" };
+    return names[static_cast<int>(m)];
+}
+
+static const char* colorMatrixName(ColorMatrix m)
+{
+    static const char* names[] = { "auto", "BT.601", "BT.709", "BT.2020" };
+    return names[static_cast<int>(m)];
+}
+
+static const char* transferName(TransferFn t)
+{
+    static const char* names[] = { "SDR", "PQ", "HLG" };
+    return names[static_cast<int>(t)];
+}
+
+static const char* pacingName(PresentPacing p)
+{
+    static const char* names[] = { "off", "vsync", "vrr", "scheduled" };
+    return names[static_cast<int>(p)];
+}
+
+// Для оверлея и отчётов.
+static const char* pacingLabel(PresentPacing p)
+{
+    static const char* labels[] = { "VSync OFF", "VSync ON", "VRR paced", "VSync scheduled" };
+    return labels[static_cast<int>(p)];
+}
+
+// FOURCC как в MEDIASUBTYPE_* / MFVideoFormat_* (Data1) и cv::VideoWriter::fourcc.
+static constexpr uint32_t fourccOf(const char (&s)[5])
+{
+    return static_cast<uint32_t>(static_cast<uint8_t>(s[0]))       |
+           static_cast<uint32_t>(static_cast<uint8_t>(s[1])) << 8  |
+           static_cast<uint32_t>(static_cast<uint8_t>(s[2])) << 16 |
+           static_cast<uint32_t>(static_cast<uint8_t>(s[3])) << 24;
+}
+
+struct Options {
+    bool           raw     = true;                   // --bgr отключает YUY2/NV12 passthrough
+    ColorMatrix    matrix  = ColorMatrix::Auto;      // --matrix 601|709|2020
+    ColorRange     range     = ColorRange::Auto;     // --range auto|limited|full
+    TransferFn     transfer  = TransferFn::SDR;      // --transfer sdr|pq|hlg
+    OutputMode     output    = OutputMode::Auto;     // --output auto|sdr|hdr10
+    float          peakNits  = 1000.0f;              // --peak-nits N
+    float          whiteNits = 203.0f;               // --sdr-white N
+    CaptureBackend backend = CaptureBackend::Auto;   // --backend auto|opencv|mf
+    int            modeW = 1920, modeH = 1080;       // --mode WxH[@FPS]
+    double         modeFps   = 60.0;
+    uint32_t       formatFcc = 0;                    // --format, 0 = auto (по цене)
+    int            buffers    = 2;                   // --buffers 2..8
+    int            maxLatency = 1;                   // --max-latency 0..16, 0 = DXGI default
+    int            simd       = -1;                  // --simd: -1 авто, 0 scalar, 1 ssse3, 2 avx2
+    int            uploadThreads = -1;               // --upload-threads: -1 авто, 0 выкл
+    int            stripeMpix    = 200;              // --stripe-mpix: порог, Мпикс/с
+    UploadMode     upload        = UploadMode::Ring; // --upload dynamic|ring
+    int            staging       = 3;                // --staging 2..8
+    ScaleMode      scale         = ScaleMode::Bilinear; // --scale, переключается клавишей
+    bool           dirty         = false;            // --dirty: только изменившиеся тайлы
+    PresentPacing  pacing        = PresentPacing::Off; // --pacing, переключается клавишей
+    bool           scanout       = false;            // --scanout: масштаб плоскостью overlay
+    int            monitor       = -1;               // --monitor N, -1 — основной
+    bool           listMonitors  = false;            // --monitor list
+    std::vector<int> devices;                        // --devices 0,2: первый — основной
+    LayoutMode     layout        = LayoutMode::Grid; // --layout grid|pip
+    std::string    record;                           // --record FILE (.mp4)
+    bool           recordHevc   = false;             // --record-codec h264|hevc
+    int            recordMbps   = 20;                // --record-mbps N
+    std::string    latencyLog;                       // --latency-log FILE (CSV)
+    bool           calibrate    = false;             // --calibrate: замер по маркеру
+    bool           sender       = false;             // --sender: показать маркер
+    bool           quick        = false;             // --quick: профиль прошлой сессии
+    bool           cpuSets      = true;              // --cpu-sets off: без закрепления
+    int            cpuCapture   = -1, cpuRender = -1; // --cpu-sets C,R; -1 — авто
+    bool           benchConvert = false;             // --bench-convert [WxH]
+    int            benchW = 1920, benchH = 1080;     // --bench-size WxH
+    int            benchSeconds = 0;                 // --bench [N]: синтетический прогон
+    double         benchFps     = 60.0;              // --bench-fps N, 0 = без ограничения
+    std::string    benchFormat  = "yuy2";            // --bench-format yuy2|nv12|p010|bgr|mjpg
+    bool           benchStatic  = false;             // --bench-static: кадры не меняются
+    std::string    benchOut;                         // --bench-out FILE, иначе stdout
+};
+
+static void printUsage()
+{
+    std::cout << "Usage: capture_bridge.exe [options]\n"
+              << "  --bgr                 Let OpenCV convert YUY2/NV12 to BGR on the CPU\n"
+              << "  --matrix 601|709|2020 YUV color matrix (default: auto by height,\n"
+              << "                        2020 for PQ/HLG sources)\n"
+              << "  --range auto|limited|full\n"
+              << "                        Source range (default: auto = limited YUV,\n"
+              << "                        full RGB)\n"
+              << "  --transfer sdr|pq|hlg Source transfer function (default: sdr)\n"
+              << "  --output auto|sdr|hdr10\n"
+              << "                        Display output; hdr10 = 10-bit PQ BT.2020 swap\n"
+              << "                        chain (default: auto = hdr10 for PQ/HLG\n"
+              << "                        sources when Windows HDR is on)\n"
+              << "  --peak-nits N         PQ/HLG content peak for tone mapping,\n"
+              << "                        100-10000 (default: 1000)\n"
+              << "  --sdr-white N         SDR white level in nits, 80-500 (default: 203)\n"
+              << "  --backend auto|opencv|mf\n"
+              << "                        Capture backend (default: auto = opencv,\n"
+              << "                        mf when the device only delivers MJPG)\n"
+              << "  --mode WxH[@FPS]      Requested capture mode (default: 1920x1080@60)\n"
+              << "  --format auto|nv12|yuy2|p010|mjpg\n"
+              << "                        Capture format (default: auto = cheapest\n"
+              << "                        format of the closest mode)\n"
+              << "  --buffers N           Swap chain buffer count, 2-8 (default: 2)\n"
+              << "  --max-latency N       Queued presents, 1-16; 0 = DXGI default,\n"
+              << "                        no latency waitable (default: 1)\n"
+              << "  --simd auto|scalar|ssse3|avx2\n"
+              << "                        BGR->BGRA kernel (default: auto by CPUID)\n"
+              << "  --upload ring|dynamic Staging ring + GPU copy, or one DYNAMIC texture\n"
+              << "                        with MAP_WRITE_DISCARD (default: ring)\n"
+              << "  --staging N           Staging textures in the ring, 2-8 (default: 3)\n"
+              << "  --scale nearest|integer|bilinear|bicubic|lanczos\n"
+              << "                        GPU scaling filter (default: bilinear)\n"
+              << "  --pacing off|vsync|vrr|scheduled\n"
+              << "                        Present pacing (default: off = tearing)\n"
+              << "  --monitor N|list      Show the video on monitor N (default: primary);\n"
+              << "                        list prints the monitors and exits\n"
+              << "  --scanout             Draw the source 1:1 and let the display's overlay\n"
+              << "                        plane upscale it (falls back to GPU scaling\n"
+              << "                        when DWM composes)\n"
+              << "  --devices N[,N...]    Capture several devices at once, the first is\n"
+              << "                        primary (default: ask for one)\n"
+              << "  --layout grid|pip     Arrangement of several devices (default: grid)\n"
+              << "  --dirty               Upload only changed 64x64 tiles, skip Present\n"
+              << "                        when nothing changed (ring upload only)\n"
+              << "  --upload-threads N    Striped upload workers (default: auto, 0 = off)\n"
+              << "  --stripe-mpix N       Use striped upload from N Mpixel/s (default: 200)\n"
+              << "  --record FILE         Record the primary source with the hardware\n"
+              << "                        encoder (MP4); frames drop before display waits\n"
+              << "  --record-codec h264|hevc\n"
+              << "                        Recording codec (default: h264)\n"
+              << "  --record-mbps N       Recording bitrate, 1-200 Mbit/s (default: 20)\n"
+              << "  --latency-log FILE    Write per-second stage latency (CSV)\n"
+              << "  --calibrate           Measure latency from the flashing marker of\n"
+              << "                        --sender, print a histogram on exit\n"
+              << "  --sender              Show the flashing calibration marker full screen\n"
+              << "  --cpu-sets auto|off|C,R\n"
+              << "                        Pin capture and render to their own P-cores,\n"
+              << "                        helpers to E-cores; C,R = logical CPUs\n"
+              << "                        (default: auto)\n"
+              << "  --quick               Start with the device, mode and settings of the\n"
+              << "                        last session, no prompts (other options override)\n"
+              << "  --bench-convert [WxH] Benchmark BGR->BGRA kernels and exit\n"
+              << "  --bench [N]           Run N seconds (default 10) on a synthetic\n"
+              << "                        source, print a JSON report and exit\n"
+              << "  --bench-size WxH      Synthetic frame size (default: 1920x1080)\n"
+              << "  --bench-fps N         Synthetic frame rate, 0 = unthrottled (default: 60)\n"
+              << "  --bench-format yuy2|nv12|p010|bgr|mjpg\n"
+              << "                        Synthetic pixel format (default: yuy2); mjpg\n"
+              << "                        decodes JPEG on the CPU like the OpenCV path\n"
+              << "  --bench-static        Synthetic source repeats one still frame\n"
+              << "  --bench-out FILE      Write the JSON report to FILE instead of stdout\n"
+              << "  --help                Show this help\n";
+}
+
+static bool parseOptions(int argc, char** argv, Options& opt)
+{
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--bgr") {
+            opt.raw = false;
+        } else if (a == "--matrix" && i + 1 < argc) {
+            std::string m = argv[++i];
+            if      (m == "601") opt.matrix = ColorMatrix::BT601;
+            else if (m == "709") opt.matrix = ColorMatrix::BT709;
+            else if (m == "2020") opt.matrix = ColorMatrix::BT2020;
+            else { std::cerr << "[ERROR] Unknown matrix: " << m << "\n"; return false; }
+        } else if (a == "--range" && i + 1 < argc) {
+            std::string r = argv[++i];
+            if      (r == "auto")    opt.range = ColorRange::Auto;
+            else if (r == "limited") opt.range = ColorRange::Limited;
+            else if (r == "full")    opt.range = ColorRange::Full;
+            else { std::cerr << "[ERROR] Unknown range: " << r << "\n"; return false; }
+        } else if (a == "--transfer" && i + 1 < argc) {
+            std::string t = argv[++i];
+            if      (t == "sdr") opt.transfer = TransferFn::SDR;
+            else if (t == "pq")  opt.transfer = TransferFn::PQ;
+            else if (t == "hlg") opt.transfer = TransferFn::HLG;
+            else { std::cerr << "[ERROR] Unknown transfer function: " << t << "\n"; return false; }
+        } else if (a == "--output" && i + 1 < argc) {
+            std::string o = argv[++i];
+            if      (o == "auto")  opt.output = OutputMode::Auto;
+            else if (o == "sdr")   opt.output = OutputMode::SDR;
+            else if (o == "hdr10") opt.output = OutputMode::HDR10;
+            else { std::cerr << "[ERROR] Unknown output mode: " << o << "\n"; return false; }
+        } else if (a == "--peak-nits" && i + 1 < argc) {
+            opt.peakNits = static_cast<float>(std::atof(argv[++i]));
+            if (opt.peakNits < 100.0f || opt.peakNits > 10000.0f) {
+                std::cerr << "[ERROR] --peak-nits must be 100-10000\n"; return false;
+            }
+        } else if (a == "--sdr-white" && i + 1 < argc) {
+            opt.whiteNits = static_cast<float>(std::atof(argv[++i]));
+            if (opt.whiteNits < 80.0f || opt.whiteNits > 500.0f) {
+                std::cerr << "[ERROR] --sdr-white must be 80-500\n"; return false;
+            }
+        } else if (a == "--backend" && i + 1 < argc) {
+            std::string b = argv[++i];
+            if      (b == "auto")   opt.backend = CaptureBackend::Auto;
+            else if (b == "opencv") opt.backend = CaptureBackend::OpenCV;
+            else if (b == "mf")     opt.backend = CaptureBackend::MediaFoundation;
+            else { std::cerr << "[ERROR] Unknown backend: " << b << "\n"; return false; }
+        } else if (a == "--mode" && i + 1 < argc) {
+            int w = 0, h = 0;
+            double fps = opt.modeFps;
+            int n = sscanf(argv[++i], "%dx%d@%lf", &w, &h, &fps);
+            if (n < 2 || w <= 0 || h <= 0 || fps <= 0.0) {
+                std::cerr << "[ERROR] --mode expects WxH or WxH@FPS\n"; return false;
+            }
+            opt.modeW = w; opt.modeH = h; opt.modeFps = fps;
+        } else if (a == "--format" && i + 1 < argc) {
+            std::string f = argv[++i];
+            if      (f == "auto") opt.formatFcc = 0;
+            else if (f == "nv12") opt.formatFcc = fourccOf("NV12");
+            else if (f == "yuy2") opt.formatFcc = fourccOf("YUY2");
+            else if (f == "p010") opt.formatFcc = fourccOf("P010");
+            else if (f == "mjpg") opt.formatFcc = fourccOf("MJPG");
+            else { std::cerr << "[ERROR] Unknown format: " << f << "\n"; return false; }
+        } else if (a == "--buffers" && i + 1 < argc) {
+            opt.buffers = std::atoi(argv[++i]);
+            if (opt.buffers < 2 || opt.buffers > 8) {
+                std::cerr << "[ERROR] --buffers must be 2-8\n"; return false;
+            }
+        } else if (a == "--max-latency" && i + 1 < argc) {
+            opt.maxLatency = std::atoi(argv[++i]);
+            if (opt.maxLatency < 0 || opt.maxLatency > 16) {
+                std::cerr << "[ERROR] --max-latency must be 0-16\n"; return false;
+            }
+        } else if (a == "--simd" && i + 1 < argc) {
+            std::string k = argv[++i];
+            if      (k == "auto")   opt.simd = -1;
+            else if (k == "scalar") opt.simd = 0;
+            else if (k == "ssse3")  opt.simd = 1;
+            else if (k == "avx2")   opt.simd = 2;
+            else { std::cerr << "[ERROR] Unknown SIMD kernel: " << k << "\n"; return false; }
+        } else if (a == "--upload" && i + 1 < argc) {
+            std::string u = argv[++i];
+            if      (u == "ring")    opt.upload = UploadMode::Ring;
+            else if (u == "dynamic") opt.upload = UploadMode::Dynamic;
+            else { std::cerr << "[ERROR] Unknown upload mode: " << u << "\n"; return false; }
+        } else if (a == "--staging" && i + 1 < argc) {
+            opt.staging = std::atoi(argv[++i]);
+            if (opt.staging < 2 || opt.staging > 8) {
+                std::cerr << "[ERROR] --staging must be 2-8\n"; return false;
+            }
+        } else if (a == "--scale" && i + 1 < argc) {
+            std::string m = argv[++i];
+            int k = 0;
+            while (k < SCALE_MODE_COUNT && m != scaleModeName(static_cast<ScaleMode>(k))) ++k;
+            if (k == SCALE_MODE_COUNT) {
+                std::cerr << "[ERROR] Unknown scale mode: " << m << "\n"; return false;
+            }
+            opt.scale = static_cast<ScaleMode>(k);
+        } else if (a == "--pacing" && i + 1 < argc) {
+            std::string m = argv[++i];
+            int k = 0;
+            while (k < PRESENT_PACING_COUNT && m != pacingName(static_cast<PresentPacing>(k))) ++k;
+            if (k == PRESENT_PACING_COUNT) {
+                std::cerr << "[ERROR] Unknown pacing mode: " << m << "\n"; return false;
+            }
+            opt.pacing = static_cast<PresentPacing>(k);
+        } else if (a == "--monitor" && i + 1 < argc) {
+            const char* m   = argv[++i];
+            char*       end = nullptr;
+            const long  k   = std::strtol(m, &end, 10);
+            if (!strcmp(m, "list")) {
+                opt.listMonitors = true;
+            } else if (end == m || *end || k < 0 || k > 63) {
+                std::cerr << "[ERROR] --monitor expects an index or list\n"; return false;
+            } else {
+                opt.monitor = static_cast<int>(k);
+            }
+        } else if (a == "--scanout") {
+            opt.scanout = true;
+        } else if (a == "--devices" && i + 1 < argc) {
+            opt.devices.clear();
+            const char* p = argv[++i];
+            for (;;) {
+                char* end = nullptr;
+                const long k = std::strtol(p, &end, 10);
+                if (end == p || k < 0 || k > 63 || (*end && *end != ',') ||
+                    std::count(opt.devices.begin(), opt.devices.end(), (int)k)) {
+                    std::cerr << "[ERROR] --devices expects distinct indices, e.g. 0,2\n";
+                    return false;
+                }
+                opt.devices.push_back(static_cast<int>(k));
+                if (!*end) break;
+                p = end + 1;
+            }
+            if (opt.devices.empty() || opt.devices.size() > MAX_SOURCES) {
+                std::cerr << "[ERROR] --devices takes 1-" << MAX_SOURCES << " indices\n";
+                return false;
+            }
+        } else if (a == "--layout" && i + 1 < argc) {
+            std::string l = argv[++i];
+            if      (l == "grid") opt.layout = LayoutMode::Grid;
+            else if (l == "pip")  opt.layout = LayoutMode::Pip;
+            else { std::cerr << "[ERROR] Unknown layout: " << l << "\n"; return false; }
+        } else if (a == "--dirty") {
+            opt.dirty = true;
+        } else if (a == "--upload-threads" && i + 1 < argc) {
+            opt.uploadThreads = std::atoi(argv[++i]);
+            if (opt.uploadThreads < 0 || opt.uploadThreads > 16) {
+                std::cerr << "[ERROR] --upload-threads must be 0-16\n"; return false;
+            }
+        } else if (a == "--stripe-mpix" && i + 1 < argc) {
+            opt.stripeMpix = std::atoi(argv[++i]);
+            if (opt.stripeMpix <= 0) {
+                std::cerr << "[ERROR] --stripe-mpix must be positive\n"; return false;
+            }
+        } else if (a == "--record" && i + 1 < argc) {
+            opt.record = argv[++i];
+        } else if (a == "--record-codec" && i + 1 < argc) {
+            std::string c = argv[++i];
+            if      (c == "h264") opt.recordHevc = false;
+            else if (c == "hevc") opt.recordHevc = true;
+            else { std::cerr << "[ERROR] Unknown recording codec: " << c << "\n"; return false; }
+        } else if (a == "--record-mbps" && i + 1 < argc) {
+            opt.recordMbps = std::atoi(argv[++i]);
+            if (opt.recordMbps < 1 || opt.recordMbps > 200) {
+                std::cerr << "[ERROR] --record-mbps must be 1-200\n"; return false;
+            }
+        } else if (a == "--latency-log" && i + 1 < argc) {
+            opt.latencyLog = argv[++i];
+        } else if (a == "--calibrate") {
+            opt.calibrate = true;
+        } else if (a == "--sender") {
+            opt.sender = true;
+        } else if (a == "--quick") {
+            opt.quick = true;
+        } else if (a == "--cpu-sets" && i + 1 < argc) {
+            std::string c = argv[++i];
+            int capCpu = -1, renCpu = -1;
+            if (c == "auto") {
+                opt.cpuSets = true; opt.cpuCapture = opt.cpuRender = -1;
+            } else if (c == "off") {
+                opt.cpuSets = false;
+            } else if (sscanf(c.c_str(), "%d,%d", &capCpu, &renCpu) == 2 &&
+                       capCpu >= 0 && renCpu >= 0 && capCpu < 64 && renCpu < 64 &&
+                       capCpu != renCpu) {
+                opt.cpuSets = true; opt.cpuCapture = capCpu; opt.cpuRender = renCpu;
+            } else {
+                std::cerr << "[ERROR] --cpu-sets expects auto, off or two different CPUs C,R\n";
+                return false;
+            }
+        } else if (a == "--bench-convert") {
+            opt.benchConvert = true;
+            int w = 0, h = 0;
+            if (i + 1 < argc && sscanf(argv[i + 1], "%dx%d", &w, &h) == 2 && w > 0 && h > 0) {
+                opt.benchW = w; opt.benchH = h; ++i;
+            }
+        } else if (a == "--bench") {
+            opt.benchSeconds = 10;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                opt.benchSeconds = std::atoi(argv[++i]);
+                if (opt.benchSeconds <= 0) {
+                    std::cerr << "[ERROR] --bench seconds must be positive\n"; return false;
+                }
+            }
+        } else if (a == "--bench-size" && i + 1 < argc) {
+            int w = 0, h = 0;
+            if (sscanf(argv[++i], "%dx%d", &w, &h) != 2 || w < 2 || h < 1) {
+                std::cerr << "[ERROR] --bench-size expects WxH\n"; return false;
+            }
+            opt.benchW = w; opt.benchH = h;
+        } else if (a == "--bench-fps" && i + 1 < argc) {
+            opt.benchFps = std::atof(argv[++i]);
+            if (opt.benchFps < 0.0 || opt.benchFps > 1000.0) {
+                std::cerr << "[ERROR] --bench-fps must be 0-1000\n"; return false;
+            }
+        } else if (a == "--bench-format" && i + 1 < argc) {
+            std::string f = argv[++i];
+            if (f == "yuy2" || f == "nv12" || f == "p010" || f == "bgr" || f == "mjpg")
+                opt.benchFormat = f;
+            else { std::cerr << "[ERROR] Unsupported bench format: " << f << "\n"; return false; }
+        } else if (a == "--bench-static") {
+            opt.benchStatic = true;
+        } else if (a == "--bench-out" && i + 1 < argc) {
+            opt.benchOut = argv[++i];
+        } else if (a == "--help" || a == "-h" || a == "/?") {
+            printUsage();
+            return false;
+        } else {
+            std::cerr << "[ERROR] Unknown option: " << a << "\n";
+            printUsage();
+            return false;
+        }
+    }
+    return true;
+}
 
 // ─── UI helpers ──────────────────────────────────────────────────────────────
 // Все блоки шириной 50 символов внутри (52 с рамкой), отступ 2 пробела слева.
@@ -146,13 +631,15 @@ static void printBanner()
 // ─── Настройки клавиш ────────────────────────────────────────────────────────
 
 static const char*     KEYBIND_FILE    = "keybindings.bin";
-static const DWORD     KB_MAGIC        = 0x4B425633; // "KBV3"
+static const DWORD     KB_MAGIC        = 0x4B425634; // "KBV4"
+static const DWORD     KB_MAGIC_V3     = 0x4B425633; // "KBV3": без vkScale
 
 struct KeyBindings {
     DWORD magic   = KB_MAGIC;
     int   vkFPS   = 'F';
     int   vkVSync = 'V';
     int   vkExit  = VK_ESCAPE;
+    int   vkScale = 'S';
 };
 
 static bool saveKeyBindings(const KeyBindings& kb)
@@ -170,8 +657,14 @@ static KeyBindings loadKeyBindings()
     if (!f) return kb;
     KeyBindings tmp;
     f.read(reinterpret_cast<char*>(&tmp), sizeof(tmp));
-    if (f.gcount() == sizeof(tmp) && tmp.magic == KB_MAGIC)
+    if (f.gcount() == sizeof(tmp) && tmp.magic == KB_MAGIC) {
         kb = tmp;
+    } else if (f.gcount() == static_cast<std::streamsize>(offsetof(KeyBindings, vkScale)) && tmp.magic == KB_MAGIC_V3) {
+        // Файл v3: свои клавиши сохраняем, новой — первую свободную.
+        kb.vkFPS = tmp.vkFPS; kb.vkVSync = tmp.vkVSync; kb.vkExit = tmp.vkExit;
+        for (int vk : { 'S', 'G', VK_F9 })
+            if (vk != kb.vkFPS && vk != kb.vkVSync && vk != kb.vkExit) { kb.vkScale = vk; break; }
+    }
     return kb;
 }
 
@@ -276,54 +769,183 @@ static std::string vkToString(int vk)
     return hex;
 }
 
-// ─── Захват любой клавиши/кнопки мыши ───────────────────────────────────────
+// ─── Raw Input: клавиатура и мышь ────────────────────────────────────────────
 //
-// GetAsyncKeyState — единственный надёжный способ поймать VK_XBUTTON1/2.
-// ReadConsoleInput не передаёт XButton-события (ограничение Win32 Console API).
+// Клавиши приходят событиями WM_INPUT в WndProc: опрашивать каждый кадр
+// ~200 VK кодов через GetAsyncKeyState не нужно, пустая очередь в горячем
+// цикле — одна атомарная загрузка. RIDEV_INPUTSINK — события идут и без
+// фокуса (консоль при настройке клавиш, окно под другим приложением), как
+// раньше с GetAsyncKeyState. Получатель — message-only окно на весь процесс:
+// оно есть уже на консольном этапе, до полноэкранного окна.
 //
-// Алгоритм:
-//   1. Sleep(200) — даём «хвосту» предыдущего Enter гарантированно уйти.
-//   2. Сначала мышь (5 кнопок), потом клавиатура 0x08-0xDE,
-//      пропуская зарезервированные диапазоны Microsoft.
-//   3. Sleep(100) после срабатывания — дебаунс, исключает двойную регистрацию.
-//   4. Sleep(10) между итерациями — CPU < 0.1%, на видео не влияет.
+// Мышь (XBUTTON1/2 и остальные кнопки) регистрируется только когда нужна:
+// каждое движение мыши — тоже WM_INPUT и пробуждение главного цикла.
 
-static int captureAnyKey()
-{
-    Sleep(200); // ждём пока отпустится предыдущая клавиша (Enter / Y)
+// Одна очередь производитель (WndProc) — один потребитель. Переполнение
+// теряет событие, а не блокирует поток окна.
+struct InputQueue {
+    static constexpr uint32_t SIZE = 64;
+    std::array<int, SIZE>     vk {};
+    std::atomic<uint32_t>     head { 0 }, tail { 0 };
 
-    while (true) {
-        // Мышь — проверяем первой, включая боковые кнопки X1/X2
-        for (int vk : { VK_LBUTTON, VK_RBUTTON, VK_MBUTTON, VK_XBUTTON1, VK_XBUTTON2 }) {
-            if (GetAsyncKeyState(vk) & 0x8000) {
-                Sleep(100); // дебаунс
-                return vk;
-            }
-        }
+    void push(int v)
+    {
+        const uint32_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) >= SIZE) return;
+        vk[h % SIZE] = v;
+        head.store(h + 1, std::memory_order_release);
+    }
+    bool pop(int& v)
+    {
+        const uint32_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) return false;
+        v = vk[t % SIZE];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+    void clear() { tail.store(head.load(std::memory_order_acquire), std::memory_order_release); }
+};
 
-        // Клавиатура: диапазон 0x08-0xDE, зарезервированные диапазоны пропускаем
-        for (int vk = 0x08; vk <= 0xDE; ++vk) {
-            // Зарезервировано / undefined по таблице Microsoft Virtual-Key Codes
-            if (vk == 0x0A || vk == 0x0B || vk == 0x0E || vk == 0x0F) continue;
-            if (vk >= 0x3A && vk <= 0x40) continue; // undefined
-            if (vk >= 0x5B && vk <= 0x5F) continue; // Win keys + reserved
-            if (vk >= 0x88 && vk <= 0x8F) continue; // unassigned
-            if (vk >= 0x97 && vk <= 0x9F) continue; // unassigned
-            if (vk >= 0xB8 && vk <= 0xB9) continue; // reserved
-            if (vk >= 0xC1 && vk <= 0xC2) continue; // reserved
-            // В диапазоне 0xC3-0xDA оставляем только F1-F12, остальное — OEM/reserved
-            if (vk >= 0xC3 && vk <= 0xDA &&
-                vk != VK_F1  && vk != VK_F2  && vk != VK_F3  && vk != VK_F4  &&
-                vk != VK_F5  && vk != VK_F6  && vk != VK_F7  && vk != VK_F8  &&
-                vk != VK_F9  && vk != VK_F10 && vk != VK_F11 && vk != VK_F12) continue;
+static InputQueue g_keyEvents;              // передние фронты нажатий, VK коды
+static bool       g_keyDown[256] = {};      // только поток окна
+static bool       g_swapButtons  = false;   // SM_SWAPBUTTON на момент регистрации
+static bool       g_mouseInput   = false;   // мышь сейчас зарегистрирована
+static HWND       g_inputWnd     = nullptr;
 
-            if (GetAsyncKeyState(vk) & 0x8000) {
-                Sleep(100); // дебаунс
-                return vk;
-            }
+static LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp);
+
+// WM_INPUT → фронт нажатия в g_keyEvents. Автоповтор клавиатуры повторяет
+// down — его отсекает g_keyDown.
+static void onRawInput(HRAWINPUT h)
+{
+    RAWINPUT ri;
+    UINT     size = sizeof(ri);
+    if (GetRawInputData(h, RID_INPUT, &ri, &size, sizeof(RAWINPUTHEADER)) == static_cast<UINT>(-1))
+        return;
+    auto edge = [](int vk, bool down) {
+        if (down && !g_keyDown[vk]) g_keyEvents.push(vk);
+        g_keyDown[vk] = down;
+    };
+    if (ri.header.dwType == RIM_TYPEKEYBOARD) {
+        const RAWKEYBOARD& k = ri.data.keyboard;
+        if (k.VKey > 0 && k.VKey < 0xFF) edge(k.VKey, !(k.Flags & RI_KEY_BREAK));
+    } else if (ri.header.dwType == RIM_TYPEMOUSE) {
+        const USHORT f = ri.data.mouse.usButtonFlags;
+        if (!f) return;                                     // движение
+        // Raw Input сообщает физические кнопки, VK — логические.
+        const int left  = g_swapButtons ? VK_RBUTTON : VK_LBUTTON;
+        const int right = g_swapButtons ? VK_LBUTTON : VK_RBUTTON;
+        const struct { USHORT down, up; int vk; } buttons[] = {
+            { RI_MOUSE_LEFT_BUTTON_DOWN,   RI_MOUSE_LEFT_BUTTON_UP,   left        },
+            { RI_MOUSE_RIGHT_BUTTON_DOWN,  RI_MOUSE_RIGHT_BUTTON_UP,  right       },
+            { RI_MOUSE_MIDDLE_BUTTON_DOWN, RI_MOUSE_MIDDLE_BUTTON_UP, VK_MBUTTON  },
+            { RI_MOUSE_BUTTON_4_DOWN,      RI_MOUSE_BUTTON_4_UP,      VK_XBUTTON1 },
+            { RI_MOUSE_BUTTON_5_DOWN,      RI_MOUSE_BUTTON_5_UP,      VK_XBUTTON2 },
+        };
+        for (const auto& b : buttons) {
+            if (f & b.down) edge(b.vk, true);
+            if (f & b.up)   edge(b.vk, false);
         }
+    }
+}
+
+// Клавиатура всегда, мышь — по флагу; повторный вызов снимает или
+// добавляет мышь. Первый вызов создаёт окно-получатель.
+static bool registerRawInput(bool mouse)
+{
+    if (!g_inputWnd) {
+        WNDCLASSEXW wc = {};
+        wc.cbSize        = sizeof(wc);
+        wc.lpfnWndProc   = WndProc;
+        wc.hInstance     = GetModuleHandleW(nullptr);
+        wc.lpszClassName = L"BridgeInput";
+        RegisterClassExW(&wc);
+        g_inputWnd = CreateWindowExW(0, L"BridgeInput", L"", 0, 0, 0, 0, 0,
+                                     HWND_MESSAGE, nullptr, GetModuleHandleW(nullptr), nullptr);
+        if (!g_inputWnd) return false;
+    }
+    g_swapButtons = GetSystemMetrics(SM_SWAPBUTTON) != 0;
+    RAWINPUTDEVICE rid[2] = {
+        { 0x01, 0x06, RIDEV_INPUTSINK, g_inputWnd },                      // keyboard
+        { 0x01, 0x02, mouse ? RIDEV_INPUTSINK : RIDEV_REMOVE,
+                      mouse ? g_inputWnd : nullptr },                     // mouse
+    };
+    // RIDEV_REMOVE незарегистрированного устройства — ошибка всего вызова.
+    const UINT n = (mouse || g_mouseInput) ? 2 : 1;
+    if (!RegisterRawInputDevices(rid, n, sizeof(RAWINPUTDEVICE))) {
+        std::cerr << "[WARN] RegisterRawInputDevices failed, hotkeys disabled\n";
+        return false;
+    }
+    g_mouseInput = mouse;
+    return true;
+}
+
+static void pumpMessages()
+{
+    MSG msg;
+    while (PeekMessageW(&msg, nullptr, 0, 0, PM_REMOVE)) {
+        TranslateMessage(&msg);
+        DispatchMessageW(&msg);
+    }
+}
+
+// Забывает накопившиеся фронты: нажатия в консольных вопросах (цифра
+// устройства, Y/N) не должны стать hotkey.
+static void discardInput()
+{
+    pumpMessages();
+    g_keyEvents.clear();
+}
+
+static bool bindsMouse(int vk)
+{
+    return vk == VK_LBUTTON || vk == VK_RBUTTON || vk == VK_MBUTTON ||
+           vk == VK_XBUTTON1 || vk == VK_XBUTTON2;
+}
+
+// ─── Захват любой клавиши/кнопки мыши ───────────────────────────────────────
+//
+// Тот же путь WM_INPUT, что и горячие клавиши: ReadConsoleInput не передаёт
+// XButton-события (ограничение Win32 Console API), Raw Input — передаёт.
+//
+// Алгоритм:
+//   1. Мышь регистрируется на время захвата, старые фронты (Enter / Y)
+//      выбрасываются.
+//   2. Поток спит в MsgWaitForMultipleObjects до WM_INPUT — без опроса.
+//   3. Первый фронт допустимого VK — результат; зарезервированные диапазоны
+//      Microsoft пропускаются. Дребезга нет: автоповтор не даёт фронтов.
+
+static bool bindableVk(int vk)
+{
+    if (bindsMouse(vk)) return true;
+    if (vk < 0x08 || vk > 0xDE) return false;
+    // Зарезервировано / undefined по таблице Microsoft Virtual-Key Codes
+    if (vk == 0x0A || vk == 0x0B || vk == 0x0E || vk == 0x0F) return false;
+    if (vk >= 0x3A && vk <= 0x40) return false; // undefined
+    if (vk >= 0x5B && vk <= 0x5F) return false; // Win keys + reserved
+    if (vk >= 0x88 && vk <= 0x8F) return false; // unassigned
+    if (vk >= 0x97 && vk <= 0x9F) return false; // unassigned
+    if (vk >= 0xB8 && vk <= 0xB9) return false; // reserved
+    if (vk >= 0xC1 && vk <= 0xC2) return false; // reserved
+    // В диапазоне 0xC3-0xDA оставляем только F1-F12, остальное — OEM/reserved
+    if (vk >= 0xC3 && vk <= 0xDA &&
+        vk != VK_F1  && vk != VK_F2  && vk != VK_F3  && vk != VK_F4  &&
+        vk != VK_F5  && vk != VK_F6  && vk != VK_F7  && vk != VK_F8  &&
+        vk != VK_F9  && vk != VK_F10 && vk != VK_F11 && vk != VK_F12) return false;
+    return true;
+}
 
-        Sleep(10);
+static int captureAnyKey()
+{
+    registerRawInput(true);
+    discardInput();
+
+    for (;;) {
+        int vk = 0;
+        while (g_keyEvents.pop(vk))
+            if (bindableVk(vk)) return vk;
+        MsgWaitForMultipleObjects(0, nullptr, FALSE, INFINITE, QS_RAWINPUT);
+        pumpMessages();
     }
 }
 
@@ -345,10 +967,11 @@ static KeyBindings configureKeys(KeyBindings current)
 
     Action actions[] = {
         { "Toggle FPS overlay",     &current.vkFPS   },
-        { "Toggle VSync on/off",    &current.vkVSync },
+        { "Cycle VSync / pacing",   &current.vkVSync },
+        { "Cycle scaling filter",   &current.vkScale },
         { "Exit the program",       &current.vkExit  },
     };
-    const int N = 3;
+    const int N = 4;
 
     for (int i = 0; i < N; ++i) {
         // Показываем текущую привязку
@@ -401,7 +1024,8 @@ static KeyBindings startupKeySetup()
     uiCenter("Key Bindings");
     std::cout << UI_SEP << "\n";
     uiLine("FPS overlay  :  " + vkToString(kb.vkFPS));
-    uiLine("VSync        :  " + vkToString(kb.vkVSync));
+    uiLine("VSync/pacing :  " + vkToString(kb.vkVSync));
+    uiLine("Scaling      :  " + vkToString(kb.vkScale));
     uiLine("Exit         :  " + vkToString(kb.vkExit));
     std::cout << UI_SEP << "\n";
     uiLine("To reset defaults — delete \"keybindings.bin\"");
@@ -428,7 +1052,8 @@ static KeyBindings startupKeySetup()
     uiCenter("Active Key Bindings");
     std::cout << UI_SEP << "\n";
     uiLine("FPS overlay  :  " + vkToString(kb.vkFPS));
-    uiLine("VSync        :  " + vkToString(kb.vkVSync));
+    uiLine("VSync/pacing :  " + vkToString(kb.vkVSync));
+    uiLine("Scaling      :  " + vkToString(kb.vkScale));
     uiLine("Exit         :  " + vkToString(kb.vkExit));
     std::cout << UI_BOT << "\n\n";
 
@@ -458,11 +1083,218 @@ static HANDLE registerMMCSS(const wchar_t* task)
     return h;
 }
 
+static int logicalCpuCount()
+{
+    DWORD_PTR proc = 0, sys = 0;
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &proc, &sys)) return 1;
+    int count = 0;
+    for (DWORD_PTR bit = 1; bit; bit <<= 1)
+        if (proc & bit) ++count;
+    return count;
+}
+
+// ─── Топология CPU: P/E ядра и CPU sets ──────────────────────────────────────
+//
+// GetSystemCpuSetInformation даёт для каждого логического процессора
+// его физическое ядро (CoreIndex) и класс эффективности; у гибридных
+// Intel старший класс — P-ядра. Захват и рендер получают по своему
+// физическому P-ядру, старшему: CPU 0 обычно забирают прерывания.
+// Остальные источники --devices — следующие P-ядра, пока хоть одно ядро
+// остаётся свободным; кому не хватило, тот в наборе по умолчанию.
+// Набор процесса по умолчанию — незанятые ядра, поэтому потоки без
+// своего набора (драйвер, MF, OpenCV) на выбранные ядра не садятся.
+// Источник MF кадры отдаёт на общем пуле очередей MF, не на своём
+// потоке: его ядро после открытия возвращается в набор по умолчанию
+// (releaseCaptureCpu). Помощники (кодер записи, переоткрытие, проба
+// устройств) идут на E-ядра, воркеры полосовой загрузки — на оставшиеся
+// P-ядра. Если свободных ядер не остаётся (2 CPU), ничего не
+// резервируется.
+
+enum class ThreadRole { Capture, Render, Upload, Helper };
+
+struct CpuTopology {
+    struct Cpu { ULONG id; int lp; int core; int eff; };
+    std::vector<Cpu>   cpus;                       // доступные процессу, группа 0
+    std::vector<std::vector<ULONG>> capture;       // по источнику, [0] — основной
+    std::vector<ULONG> render, upload, helper, rest;            // id CPU sets
+    std::vector<int>   captureLp;                  // CPU источника, -1 — отдан (MF)
+    int                renderLp = -1;
+    bool               hybrid = false;
+    std::string        summary = "off";            // для стартового отчёта
+};
+
+static CpuTopology g_cpu;                          // заполняется до первых потоков
+
+// captureLp / renderLp — из --cpu-sets C,R, -1 — выбрать самим; sources —
+// число источников захвата.
+static void initCpuTopology(bool enable, int captureLp, int renderLp, size_t sources)
+{
+    CpuTopology t;
+    if (!enable) { g_cpu = t; return; }
+
+    HANDLE proc = GetCurrentProcess();
+    ULONG  len  = 0;
+    GetSystemCpuSetInformation(nullptr, 0, &len, proc, 0);
+    std::vector<uint8_t> buf(len);
+    if (!len || !GetSystemCpuSetInformation(
+                    reinterpret_cast<PSYSTEM_CPU_SET_INFORMATION>(buf.data()), len, &len, proc, 0)) {
+        t.summary = "unavailable";
+        g_cpu = t;
+        return;
+    }
+    DWORD_PTR procMask = 0, sysMask = 0;
+    GetProcessAffinityMask(proc, &procMask, &sysMask);
+    int maxEff = 0, minEff = 255;
+    for (ULONG off = 0; off < len; ) {
+        const auto* e = reinterpret_cast<const SYSTEM_CPU_SET_INFORMATION*>(buf.data() + off);
+        off += e->Size;
+        if (!e->Size) break;
+        if (e->Type != CpuSetInformation) continue;
+        const auto& c = e->CpuSet;
+        if (c.Group != 0 || c.LogicalProcessorIndex >= 8 * sizeof(DWORD_PTR) ||
+            !(procMask & (static_cast<DWORD_PTR>(1) << c.LogicalProcessorIndex)))
+            continue;
+        if (c.Allocated && !c.AllocatedToTargetProcess) continue;   // чужой эксклюзив
+        t.cpus.push_back({ c.Id, c.LogicalProcessorIndex, c.CoreIndex, c.EfficiencyClass });
+        maxEff = (std::max)(maxEff, static_cast<int>(c.EfficiencyClass));
+        minEff = (std::min)(minEff, static_cast<int>(c.EfficiencyClass));
+    }
+    t.hybrid = !t.cpus.empty() && maxEff != minEff;
+
+    auto coreOf = [&](int lp) {
+        for (const auto& c : t.cpus) if (c.lp == lp) return c.core;
+        return -1;
+    };
+    auto firstLp = [&](int core) {
+        int lp = INT_MAX;
+        for (const auto& c : t.cpus) if (c.core == core) lp = (std::min)(lp, c.lp);
+        return lp;
+    };
+
+    // Физические ядра; P-ядра — от старшего к младшему.
+    std::vector<int> cores, pCores;
+    for (const auto& c : t.cpus) {
+        if (std::find(cores.begin(), cores.end(), c.core) == cores.end())
+            cores.push_back(c.core);
+        if (c.eff == maxEff && std::find(pCores.begin(), pCores.end(), c.core) == pCores.end())
+            pCores.push_back(c.core);
+    }
+    std::sort(pCores.rbegin(), pCores.rend());
+
+    std::vector<int> capCores;                     // по источнику
+    int renCore = -1;
+    if (captureLp >= 0) {
+        const int capCore = coreOf(captureLp);
+        renCore = coreOf(renderLp);
+        if (capCore < 0 || renCore < 0 || captureLp == renderLp) {
+            std::cerr << "[WARN] --cpu-sets: CPU " << captureLp << " or " << renderLp
+                      << " is not available to the process, choosing automatically\n";
+            renCore = -1;
+        } else {
+            capCores.push_back(capCore);
+            t.captureLp.push_back(captureLp);
+            t.renderLp = renderLp;
+        }
+    }
+    if (capCores.empty() && pCores.size() >= 2) {
+        capCores.push_back(pCores[0]);
+        renCore = pCores[1];
+        t.captureLp.push_back(firstLp(pCores[0]));
+        t.renderLp = firstLp(renCore);
+    }
+
+    auto taken = [&](int core) {
+        return core == renCore || std::find(capCores.begin(), capCores.end(), core) != capCores.end();
+    };
+    if (!capCores.empty()) {
+        // Остальным источникам — свободные P-ядра по порядку, но одно ядро
+        // всегда остаётся набору по умолчанию.
+        size_t freeCores = 0;
+        for (int core : cores) freeCores += !taken(core);
+        for (size_t i = 0; i < pCores.size() && capCores.size() < sources && freeCores > 1; ++i) {
+            if (taken(pCores[i])) continue;
+            capCores.push_back(pCores[i]);
+            t.captureLp.push_back(firstLp(pCores[i]));
+            --freeCores;
+        }
+        // Сначала — без выбранных ядер целиком; не хватает — хотя бы без
+        // выбранных логических процессоров (SMT соседи свободны).
+        for (const auto& c : t.cpus)
+            if (!taken(c.core)) t.rest.push_back(c.id);
+        if (t.rest.empty())
+            for (const auto& c : t.cpus)
+                if (c.lp != t.captureLp[0] && c.lp != t.renderLp) t.rest.push_back(c.id);
+    }
+    if (t.rest.empty()) {
+        t.captureLp.clear();
+        t.renderLp = -1;
+        t.summary   = "not reserved (" + std::to_string(t.cpus.size()) + " CPUs)";
+        g_cpu = t;
+        return;
+    }
+
+    t.capture.resize(t.captureLp.size());
+    for (const auto& c : t.cpus) {
+        for (size_t i = 0; i < t.captureLp.size(); ++i)
+            if (c.lp == t.captureLp[i]) t.capture[i].push_back(c.id);
+        if (c.lp == t.renderLp) t.render.push_back(c.id);
+        const bool free = std::find(t.rest.begin(), t.rest.end(), c.id) != t.rest.end();
+        if (free && c.eff == maxEff)              t.upload.push_back(c.id);
+        if (free && (!t.hybrid || c.eff < maxEff)) t.helper.push_back(c.id);
+    }
+    if (t.upload.empty()) t.upload = t.rest;
+    if (t.helper.empty()) t.helper = t.rest;
+    SetProcessDefaultCpuSets(proc, t.rest.data(), static_cast<ULONG>(t.rest.size()));
+
+    t.summary = "capture CPU " + std::to_string(t.captureLp[0]) + ", render CPU " +
+                std::to_string(t.renderLp);
+    g_cpu = t;
+}
+
+// Текущий поток — на ядра своей роли; source — номер источника захвата. Без
+// топологии или без своего ядра у источника — ничего.
+static void pinThread(ThreadRole role, size_t source = 0)
+{
+    static const std::vector<ULONG> none;
+    const std::vector<ULONG>& ids = role == ThreadRole::Capture
+                                      ? (source < g_cpu.capture.size() ? g_cpu.capture[source] : none)
+                                  : role == ThreadRole::Render  ? g_cpu.render
+                                  : role == ThreadRole::Upload  ? g_cpu.upload
+                                                                : g_cpu.helper;
+    if (!ids.empty())
+        SetThreadSelectedCpuSets(GetCurrentThread(), ids.data(), static_cast<ULONG>(ids.size()));
+}
+
+// Источнику без своего потока захвата (MF) ядро не нужно: его логические
+// процессоры — обратно в набор по умолчанию. Зовут потоки открытия.
+static void releaseCaptureCpu(size_t source)
+{
+    static std::mutex lock;
+    std::lock_guard<std::mutex> guard(lock);
+    if (source >= g_cpu.captureLp.size() || g_cpu.captureLp[source] < 0) return;
+    int core = -1;
+    for (const auto& c : g_cpu.cpus)
+        if (c.lp == g_cpu.captureLp[source]) core = c.core;
+    for (const auto& c : g_cpu.cpus)
+        if (c.core == core && c.lp != g_cpu.renderLp &&
+            std::find(g_cpu.rest.begin(), g_cpu.rest.end(), c.id) == g_cpu.rest.end())
+            g_cpu.rest.push_back(c.id);
+    g_cpu.capture[source].clear();
+    g_cpu.captureLp[source] = -1;
+    SetProcessDefaultCpuSets(GetCurrentProcess(), g_cpu.rest.data(),
+                             static_cast<ULONG>(g_cpu.rest.size()));
+    if (source == 0)
+        g_cpu.summary = "MF capture, render CPU " + std::to_string(g_cpu.renderLp);
+}
+
 // ─── Перечисление и выбор устройства ─────────────────────────────────────────
 
 struct DeviceInfo {
-    int         index;
-    std::string name;
+    int          index;
+    std::string  name;
+    std::wstring link = {};         // symbolic link MF: открыть без перечисления
+    std::wstring path = {};         // DevicePath DirectShow: ключ кэша режимов
+    std::string  caps = {};         // лучший режим для списка устройств
 };
 
 static std::vector<DeviceInfo> enumerateDevices()
@@ -497,8 +1329,14 @@ static std::vector<DeviceInfo> enumerateDevices()
                 WideCharToMultiByte(CP_UTF8, 0, var.bstrVal, -1,
                                     &name[0], len, nullptr, nullptr);
                 if (!name.empty()) name.pop_back();
-                result.push_back({ index, name });
                 VariantClear(&var);
+                // У виртуальных камер DevicePath может не быть — тогда без кэша.
+                std::wstring path;
+                if (SUCCEEDED(propBag->Read(L"DevicePath", &var, nullptr))) {
+                    if (var.vt == VT_BSTR && var.bstrVal) path = var.bstrVal;
+                    VariantClear(&var);
+                }
+                result.push_back({ index, name, {}, path });
             }
             propBag->Release();
         }
@@ -509,13 +1347,14 @@ static std::vector<DeviceInfo> enumerateDevices()
     return result;
 }
 
-static int selectDevice()
+// Возвращает DeviceInfo с index = -1, если устройств нет.
+// Имя нужно MF-бэкенду: порядок MFEnumDeviceSources не обязан совпадать с DirectShow.
+// devices — в порядке показа (DeviceProber::finish сортирует по лучшему режиму).
+static DeviceInfo selectDevice(const std::vector<DeviceInfo>& devices)
 {
-    auto devices = enumerateDevices();
-
     if (devices.empty()) {
         std::cerr << "[ERROR] No video devices found.\n";
-        return -1;
+        return { -1, "" };
     }
 
     std::cout << "\n" << UI_TOP << "\n";
@@ -524,13 +1363,14 @@ static int selectDevice()
     for (auto& d : devices) {
         std::string entry = "[" + std::to_string(d.index) + "]  " + d.name;
         uiLine(entry);
+        if (!d.caps.empty()) uiLine("     " + d.caps);
     }
     std::cout << UI_BOT << "\n";
 
     if (devices.size() == 1) {
         std::cout << "\n  [AUTO] Only one device — selecting: "
                   << devices[0].name << "\n\n";
-        return devices[0].index;
+        return devices[0];
     }
 
     std::cout << "\n  Select device [0-" << (devices.size()-1) << "]: ";
@@ -549,148 +1389,4100 @@ static int selectDevice()
     for (auto& d : devices)
         if (d.index == choice) {
             std::cout << "  [OK] Selected: " << d.name << "\n\n";
-            return d.index;
+            return d;
         }
 
-    std::cout << "  [WARN] Invalid index, defaulting to 0\n\n";
-    return devices[0].index;
+    std::cout << "  [WARN] Invalid index, defaulting to " << devices[0].index << "\n\n";
+    return devices[0];
 }
 
-// ─── Triple Buffer ────────────────────────────────────────────────────────────
+// --devices: индексы из списка устройств, без вопросов в консоли. Пустой
+// результат — какого-то индекса нет.
+static std::vector<DeviceInfo> devicesByIndex(const std::vector<int>& indices)
+{
+    const auto all = enumerateDevices();
+    std::vector<DeviceInfo> result;
+    for (int k : indices) {
+        auto it = std::find_if(all.begin(), all.end(),
+                               [k](const DeviceInfo& d) { return d.index == k; });
+        if (it == all.end()) {
+            std::cerr << "[ERROR] No video device with index " << k << "\n";
+            return {};
+        }
+        result.push_back(*it);
+    }
+    return result;
+}
 
-struct TripleBuffer {
-    std::array<cv::Mat, 3> bufs;
-    std::atomic<int> latest  { -1 };
-    std::atomic<int> writing {  0 };
+// ─── Профиль сессии (--quick) ────────────────────────────────────────────────
+//
+// После каждого успешного старта: устройство, режим, который оно реально
+// отдало, и настройки рендера. --quick берёт их отсюда и не спрашивает, не
+// пробует режимы; устройство ищет по DevicePath в списке DirectShow — индекс
+// меняется, когда карты подключают в другом порядке. Новые поля — новый
+// magic, как у keybindings.bin: старый файл просто не читается.
+
+static const char*  PROFILE_FILE  = "session.bin";
+static const DWORD  PROFILE_MAGIC = 0x53455332; // "SES2"
+
+struct SessionProfile {
+    DWORD    magic       = PROFILE_MAGIC;
+    int      deviceIndex = -1;
+    char     deviceName[256] = {};       // UTF-8, для MF и сообщений
+    wchar_t  deviceLink[512] = {};       // symbolic link MF, у OpenCV пусто
+    wchar_t  devicePath[512] = {};       // DevicePath DirectShow: поиск при загрузке
+    int      backend     = 0;            // CaptureBackend, которым открылось
+    uint32_t fourcc      = 0;            // режим на проводе
+    int      width       = 0;
+    int      height      = 0;
+    double   fps         = 0.0;
+    int      raw         = 1;
+    int      matrix      = 0;            // ColorMatrix, Auto — по высоте
+    int      upload      = 0;            // UploadMode
+    int      staging     = 3;
+    int      scale       = 0;            // ScaleMode
+    int      pacing      = 0;            // PresentPacing
+    int      buffers     = 2;
+    int      maxLatency  = 1;
+    int      dirty       = 0;
+    int      range       = 0;            // ColorRange
+    int      transfer    = 0;            // TransferFn
+    int      output      = 0;            // OutputMode
+    float    peakNits    = 1000.0f;
+    float    whiteNits   = 203.0f;
+    int      scanout     = 0;
+    int      monitor     = -1;           // индекс DXGI выхода, -1 — основной
+    int      cpuSets     = 1;
+    int      cpuCapture  = -1, cpuRender = -1;
+};
 
-    void commitWrite()
-    {
-        int w = writing.load(std::memory_order_relaxed);
-        latest.store(w, std::memory_order_release);
-        writing.store((w + 1) % 3, std::memory_order_relaxed);
+static bool saveSessionProfile(const SessionProfile& p)
+{
+    std::ofstream f(PROFILE_FILE, std::ios::binary);
+    if (!f) return false;
+    f.write(reinterpret_cast<const char*>(&p), sizeof(p));
+    return f.good();
+}
+
+static bool loadSessionProfile(SessionProfile& p)
+{
+    std::ifstream f(PROFILE_FILE, std::ios::binary);
+    if (!f) return false;
+    SessionProfile tmp;
+    f.read(reinterpret_cast<char*>(&tmp), sizeof(tmp));
+    if (f.gcount() != sizeof(tmp) || tmp.magic != PROFILE_MAGIC || tmp.width <= 0) return false;
+    tmp.deviceName[sizeof(tmp.deviceName) - 1] = '\0';
+    tmp.deviceLink[(sizeof(tmp.deviceLink) / sizeof(wchar_t)) - 1] = L'\0';
+    tmp.devicePath[(sizeof(tmp.devicePath) / sizeof(wchar_t)) - 1] = L'\0';
+    p = tmp;
+    return true;
+}
+
+// Профиль — основа Options, флаги командной строки разбираются поверх.
+static void applySessionProfile(const SessionProfile& p, Options& opt)
+{
+    opt.backend    = static_cast<CaptureBackend>(p.backend);
+    opt.modeW      = p.width;
+    opt.modeH      = p.height;
+    opt.modeFps    = p.fps;
+    opt.formatFcc  = p.fourcc;
+    opt.raw        = p.raw != 0;
+    opt.matrix     = static_cast<ColorMatrix>(p.matrix);
+    opt.upload     = static_cast<UploadMode>(p.upload);
+    opt.staging    = p.staging;
+    opt.scale      = static_cast<ScaleMode>(p.scale);
+    opt.pacing     = static_cast<PresentPacing>(p.pacing);
+    opt.buffers    = p.buffers;
+    opt.maxLatency = p.maxLatency;
+    opt.dirty      = p.dirty != 0;
+    opt.range      = static_cast<ColorRange>(p.range);
+    opt.transfer   = static_cast<TransferFn>(p.transfer);
+    opt.output     = static_cast<OutputMode>(p.output);
+    opt.peakNits   = p.peakNits;
+    opt.whiteNits  = p.whiteNits;
+    opt.scanout    = p.scanout != 0;
+    opt.monitor    = p.monitor;
+    opt.cpuSets    = p.cpuSets != 0;
+    opt.cpuCapture = p.cpuCapture;
+    opt.cpuRender  = p.cpuRender;
+}
+
+// Устройство профиля в нынешнем списке DirectShow: по DevicePath, без него —
+// тот же индекс с тем же именем. Не нашлось — index -1 (карту вынули).
+static DeviceInfo sessionDevice(const SessionProfile& p)
+{
+    DeviceInfo dev { -1, p.deviceName, p.deviceLink, p.devicePath };
+    for (const auto& d : enumerateDevices()) {
+        const bool same = dev.path.empty() ? d.index == p.deviceIndex && d.name == dev.name
+                                           : d.path == dev.path;
+        if (!same) continue;
+        dev.index = d.index;
+        dev.name  = d.name;
+        break;
     }
+    return dev;
+}
+
+// Режим и бэкенд дописывает main: они известны только после open.
+static SessionProfile makeSessionProfile(const DeviceInfo& dev, const std::wstring& link,
+                                         const Options& opt)
+{
+    SessionProfile p;
+    p.deviceIndex = dev.index;
+    strncpy(p.deviceName, dev.name.c_str(), sizeof(p.deviceName) - 1);
+    wcsncpy(p.deviceLink, link.c_str(), (sizeof(p.deviceLink) / sizeof(wchar_t)) - 1);
+    wcsncpy(p.devicePath, dev.path.c_str(), (sizeof(p.devicePath) / sizeof(wchar_t)) - 1);
+    p.raw        = opt.raw ? 1 : 0;
+    p.matrix     = static_cast<int>(opt.matrix);
+    p.upload     = static_cast<int>(opt.upload);
+    p.staging    = opt.staging;
+    p.scale      = static_cast<int>(opt.scale);
+    p.pacing     = static_cast<int>(opt.pacing);
+    p.buffers    = opt.buffers;
+    p.maxLatency = opt.maxLatency;
+    p.dirty      = opt.dirty ? 1 : 0;
+    p.range      = static_cast<int>(opt.range);
+    p.transfer   = static_cast<int>(opt.transfer);
+    p.output     = static_cast<int>(opt.output);
+    p.peakNits   = opt.peakNits;
+    p.whiteNits  = opt.whiteNits;
+    p.scanout    = opt.scanout ? 1 : 0;
+    p.monitor    = opt.monitor;
+    p.cpuSets    = opt.cpuSets ? 1 : 0;
+    p.cpuCapture = opt.cpuCapture;
+    p.cpuRender  = opt.cpuRender;
+    return p;
+}
+
+// ─── Время (QPC) ─────────────────────────────────────────────────────────────
+//
+// Все метки этапов — QueryPerformanceCounter: тот же источник, что у
+// DXGI_FRAME_STATISTICS::SyncQPCTime и у системного времени MF (100 нс).
+
+static int64_t qpcNow()
+{
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    return t.QuadPart;
+}
+
+static int64_t qpcFrequency()
+{
+    static const int64_t freq = [] {
+        LARGE_INTEGER f;
+        QueryPerformanceFrequency(&f);
+        return f.QuadPart;
+    }();
+    return freq;
+}
 
-    cv::Mat* tryRead()
+static double qpcToMs(int64_t ticks) { return ticks * 1000.0 / qpcFrequency(); }
+
+// Системное время MF (MFSampleExtension_DeviceReferenceSystemTime) → QPC.
+static int64_t hnsToQpc(uint64_t hns)
+{
+    const int64_t f = qpcFrequency();
+    return static_cast<int64_t>(hns / 10000000ULL) * f +
+           static_cast<int64_t>(hns % 10000000ULL) * f / 10000000LL;
+}
+
+// ─── Кадр ────────────────────────────────────────────────────────────────────
+//
+// BGR24 — OpenCV сам конвертирует YUY2 в BGR на CPU (старый путь, --bgr).
+// YUY2  — сырой 4:2:2 буфер драйвера (CAP_PROP_CONVERT_RGB = 0), 2 байта
+//         на пиксель: Y0 U Y1 V. Декодируется в пиксельном шейдере.
+// NV12  — 4:2:0 в двух плоскостях: Y (base/stride) и чередующиеся UV
+//         половинного разрешения (uv/uvStride). Выход MJPG декодера MF.
+// P010  — то же, что NV12, но 16 бит на отсчёт (10 значащих в старших битах).
+//
+// Пиксели лежат либо в cv::Mat (OpenCV), либо в удерживаемом IMFSample (MF):
+// залоченный системный буфер (base/stride) или текстура того же D3D11 устройства.
+
+enum class PixelFormat { BGR24, YUY2, NV12, P010 };
+
+static bool isPlanar(PixelFormat f) { return f == PixelFormat::NV12 || f == PixelFormat::P010; }
+
+struct Frame {
+    cv::Mat          data;                  // хранилище OpenCV-бэкенда
+    uint64_t         seq    = 0;            // номер коммита в TripleBuffer
+    const uint8_t*   base   = nullptr;      // первая строка
+    PixelFormat      format = PixelFormat::BGR24;
+    int              width  = 0;
+    int              height = 0;
+    int              stride = 0;            // байт на строку
+    const uint8_t*   uv       = nullptr;    // NV12: плоскость UV
+    int              uvStride = 0;
+
+    IMFSample*       sample   = nullptr;    // MF: держим, пока слот не переиспользуют
+    IMFMediaBuffer*  buffer   = nullptr;
+    IMF2DBuffer*     buffer2d = nullptr;    // залочен через Lock2D
+    ID3D11Texture2D* gpuTex   = nullptr;    // MF: кадр уже в видеопамяти
+    UINT             gpuSub   = 0;
+    int              uploadSlot = -1;       // кадр уже в staging слоте (UploadSlots)
+
+    // Метки этапов, QPC тики (0 — этап неизвестен для бэкенда).
+    int64_t          tDevice  = 0;          // время сэмпла по часам устройства/драйвера
+    int64_t          tReceive = 0;          // поток захвата получил кадр
+    int64_t          tCommit  = 0;          // commitWrite в TripleBuffer
+
+    bool empty() const
     {
-        int idx = latest.load(std::memory_order_acquire);
-        return (idx >= 0) ? &bufs[idx] : nullptr;
+        return (!base && !gpuTex && uploadSlot < 0) || width <= 0 || height <= 0;
     }
-};
+    const uint8_t* row(int y) const { return base + static_cast<ptrdiff_t>(y) * stride; }
+    const uint8_t* uvRow(int y) const { return uv + static_cast<ptrdiff_t>(y) * uvStride; }
 
-// ─── Поток захвата ────────────────────────────────────────────────────────────
+    // Байт пикселей в системной памяти (для GB/s в --bench).
+    size_t bytes() const
+    {
+        size_t n = static_cast<size_t>(std::abs(stride)) * height;
+        if (isPlanar(format)) n += static_cast<size_t>(uvStride) * (height / 2);
+        return n;
+    }
 
-class VideoStream {
-public:
-    explicit VideoStream(int deviceId, TripleBuffer& tb)
-        : tb_(tb), running_(true), width_(0), height_(0)
+    void releaseSample()
     {
-        cap_.open(deviceId, cv::CAP_DSHOW);
+        if (buffer2d)            { buffer2d->Unlock2D(); buffer2d->Release(); }
+        else if (buffer && base) { buffer->Unlock(); }
+        if (buffer) buffer->Release();
+        if (gpuTex) gpuTex->Release();
+        if (sample) sample->Release();
+        buffer2d = nullptr; buffer = nullptr; gpuTex = nullptr; sample = nullptr;
+        base = nullptr; uv = nullptr; gpuSub = 0;
+    }
+};
 
-        cap_.set(cv::CAP_PROP_FOURCC,     cv::VideoWriter::fourcc('Y','U','Y','2'));
-        cap_.set(cv::CAP_PROP_FPS,        60);
-        cap_.set(cv::CAP_PROP_BUFFERSIZE, 1);
-        cap_.set(cv::CAP_PROP_FRAME_WIDTH,  1920);
-        cap_.set(cv::CAP_PROP_FRAME_HEIGHT, 1080);
+// ─── Triple Buffer ────────────────────────────────────────────────────────────
+//
+// Три слота с фиксированными ролями: back принадлежит захвату, front — рендеру,
+// middle — точка обмена. Роли меняются одним atomic exchange, поэтому:
+//   - писатель никогда не ждёт и не пишет в слот, который читает рендер;
+//   - читатель никогда не видит недописанный кадр;
+//   - бит FRESH в middle говорит, что там кадр, которого рендер ещё не забрал.
+// Если рендер не успел забрать кадр, следующий commitWrite просто затирает его
+// (в Frame::seq остаётся дырка — это счётчик пропущенных кадров).
+// frameEvent (auto-reset) будит рендер на каждый commitWrite — без опроса.
 
-        width_  = static_cast<int>(cap_.get(cv::CAP_PROP_FRAME_WIDTH));
-        height_ = static_cast<int>(cap_.get(cv::CAP_PROP_FRAME_HEIGHT));
+struct TripleBuffer {
+    static constexpr int SLOT_MASK = 0x3;
+    static constexpr int FRESH     = 0x4;
 
-        captureThread_ = std::thread(&VideoStream::captureLoop, this);
-    }
+    std::array<Frame, 3> bufs;
+    std::atomic<int>     middle { 1 };      // индекс слота | FRESH
+    int                  back   = 0;        // только поток захвата
+    int                  front  = 2;        // только поток рендера
+    uint64_t             nextSeq = 1;       // только поток захвата
+    HANDLE               frameEvent = nullptr;
 
-    ~VideoStream() { stop(); }
+    TripleBuffer()  { frameEvent = CreateEventW(nullptr, FALSE, FALSE, nullptr); }
+    ~TripleBuffer() { if (frameEvent) CloseHandle(frameEvent); }
+    TripleBuffer(const TripleBuffer&)            = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
 
-    double get(int p)  const { return cap_.get(p); }
-    int    width()     const { return width_;  }
-    int    height()    const { return height_; }
+    Frame& writeSlot() { return bufs[back]; }
 
-    void stop()
+    void commitWrite()
     {
-        running_ = false;
-        if (captureThread_.joinable()) captureThread_.join();
-        cap_.release();
+        bufs[back].seq     = nextSeq++;
+        bufs[back].tCommit = qpcNow();
+        int prev = middle.exchange(back | FRESH, std::memory_order_acq_rel);
+        back = prev & SLOT_MASK;
+        SetEvent(frameEvent);
     }
 
-private:
-    void captureLoop()
+    // Забирает самый свежий кадр. fresh = false — с прошлого вызова ничего не
+    // пришло, возвращается тот же front (можно пропустить upload/present).
+    Frame* tryRead(bool* fresh = nullptr)
     {
-        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
-        HANDLE mmh = registerMMCSS(L"Pro Audio");
-
-        while (running_) {
-            int w = tb_.writing.load(std::memory_order_relaxed);
-            bool ok = cap_.read(tb_.bufs[w]);
-            if (ok && !tb_.bufs[w].empty())
-                tb_.commitWrite();
+        bool isNew = (middle.load(std::memory_order_relaxed) & FRESH) != 0;
+        if (isNew) {
+            int prev = middle.exchange(front, std::memory_order_acq_rel);
+            front = prev & SLOT_MASK;
         }
-        if (mmh) AvRevertMmThreadCharacteristics(mmh);
+        if (fresh) *fresh = isNew;
+        Frame& f = bufs[front];
+        return f.empty() ? nullptr : &f;
     }
-
-    cv::VideoCapture  cap_;
-    TripleBuffer&     tb_;
-    std::atomic<bool> running_;
-    std::thread       captureThread_;
-    int               width_, height_;
 };
 
-// ─── HLSL шейдеры ────────────────────────────────────────────────────────────
+// ─── Слоты загрузки из потока захвата ────────────────────────────────────────
+//
+// Обычно кадр MF живёт в слоте TripleBuffer залоченным сэмплом, а рендер
+// копирует его в staging текстуру. С UploadSlots поток рендера заранее держит
+// несколько staging текстур замапленными; поток захвата пишет кадр прямо в
+// mapped память (единственный проход по памяти за кадр, и тот вне потока
+// рендера), сразу отдаёт сэмпл обратно в пул MF и коммитит номер слота через
+// TripleBuffer. Рендеру остаются Unmap + CopyResource.
+//
+// Состояния слота (atomic, переходы только CAS):
+//   Unmapped → Ready    рендер: Map(DO_NOT_WAIT) удался — GPU копию закончил
+//   Ready    → Writing  захват: взял слот под кадр
+//   Writing  → Filled   захват: кадр записан, номер ушёл в Frame::uploadSlot
+//   Filled   → Unmapped рендер: кадр забран (Unmap + CopyResource)
+//   Filled   → Ready    захват: кадр так и не забрали (затёрт в TripleBuffer),
+//                       слот по-прежнему замаплен — берём его снова
+
+struct UploadSlots {
+    enum State : int { Unmapped, Ready, Writing, Filled };
+    static constexpr int MAX = 8;
+
+    struct Slot {
+        ID3D11Texture2D* tex   = nullptr;
+        std::atomic<int> state { Unmapped };
+        uint8_t*         data  = nullptr;     // пишет рендер до Ready, читает захват
+        UINT             pitch = 0;
+    };
 
-static const char* s_vsCode = R"(
-struct VS_OUT { float4 pos : SV_POSITION; float2 uv : TEXCOORD; };
-VS_OUT main(uint id : SV_VertexID) {
-    float2 uv  = float2((id & 1) ? 2.0f : 0.0f, (id & 2) ? 2.0f : 0.0f);
-    VS_OUT o;
-    o.pos = float4(uv.x * 2.0f - 1.0f, 1.0f - uv.y * 2.0f, 0.0f, 1.0f);
-    o.uv  = uv;
-    return o;
-}
-)";
+    Slot        slots[MAX];
+    int         count  = 0;
+    int         width  = 0, height = 0;
+    PixelFormat format = PixelFormat::YUY2;
+    std::atomic<uint64_t> stored { 0 }, misses { 0 };   // кадры через слоты / мимо
 
-static const char* s_psCode = R"(
-Texture2D    tex : register(t0);
-SamplerState sam : register(s0);
-struct VS_OUT { float4 pos : SV_POSITION; float2 uv : TEXCOORD; };
-float4 main(VS_OUT i) : SV_TARGET {
-    float4 c = tex.Sample(sam, i.uv);
-    return float4(c.b, c.g, c.r, 1.0f);
-}
-)";
+    // ── Поток рендера ──
 
-// ─── DirectX 11 Renderer ─────────────────────────────────────────────────────
+    // Текстуры того же вида, что staging ring рендера: YUY2 — RGBA
+    // половинной ширины, NV12 / P010 — родные двухплоскостные.
+    bool create(ID3D11Device* device, ID3D11DeviceContext* ctx,
+                int w, int h, PixelFormat fmt, int n)
+    {
+        D3D11_TEXTURE2D_DESC td = {};
+        td.Width          = (fmt == PixelFormat::YUY2) ? w / 2 : w;
+        td.Height         = h;
+        td.MipLevels      = 1; td.ArraySize = 1;
+        td.Format         = (fmt == PixelFormat::NV12) ? DXGI_FORMAT_NV12
+                          : (fmt == PixelFormat::P010) ? DXGI_FORMAT_P010
+                                                       : DXGI_FORMAT_R8G8B8A8_UNORM;
+        td.SampleDesc     = { 1, 0 };
+        td.Usage          = D3D11_USAGE_STAGING;
+        td.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+        count = (std::min)(n, MAX);
+        for (int k = 0; k < count; ++k)
+            if (FAILED(device->CreateTexture2D(&td, nullptr, &slots[k].tex))) {
+                std::cerr << "[DX11] CreateTexture2D (upload slot) failed\n";
+                release(ctx);
+                return false;
+            }
+        width = w; height = h; format = fmt;
+        pump(ctx);
+        return true;
+    }
 
-struct DX11Renderer {
-    ID3D11Device*             device    = nullptr;
-    ID3D11DeviceContext*      ctx       = nullptr;
-    IDXGISwapChain1*          swapChain = nullptr;
-    ID3D11RenderTargetView*   rtv       = nullptr;
-    ID3D11VertexShader*       vs        = nullptr;
-    ID3D11PixelShader*        ps        = nullptr;
-    ID3D11Texture2D*          dynTex    = nullptr;
-    ID3D11ShaderResourceView* srv       = nullptr;
-    ID3D11SamplerState*       sampler   = nullptr;
+    // Заново мапит слоты, которые GPU уже скопировал. Без ожидания: занятый
+    // слот просто останется Unmapped до следующего вызова.
+    void pump(ID3D11DeviceContext* ctx)
+    {
+        for (int k = 0; k < count; ++k) {
+            Slot& s = slots[k];
+            if (s.state.load(std::memory_order_acquire) != Unmapped) continue;
+            D3D11_MAPPED_SUBRESOURCE m = {};
+            if (FAILED(ctx->Map(s.tex, 0, D3D11_MAP_WRITE, D3D11_MAP_FLAG_DO_NOT_WAIT, &m)))
+                continue;
+            s.data  = static_cast<uint8_t*>(m.pData);
+            s.pitch = m.RowPitch;
+            s.state.store(Ready, std::memory_order_release);
+        }
+    }
 
-    int  winW = 0, winH = 0;
-    int  texW = 0, texH = 0;
-    bool tearingOk = false;
+    // Забирает кадр слота k для CopyResource; nullptr — слот уже не Filled.
+    ID3D11Texture2D* take(ID3D11DeviceContext* ctx, int k)
+    {
+        int expect = Filled;
+        if (k < 0 || k >= count ||
+            !slots[k].state.compare_exchange_strong(expect, Unmapped, std::memory_order_acq_rel))
+            return nullptr;
+        ctx->Unmap(slots[k].tex, 0);
+        return slots[k].tex;
+    }
 
-    bool init(HWND hwnd, int w, int h)
+    // Только после остановки захвата.
+    void release(ID3D11DeviceContext* ctx)
     {
-        winW = w; winH = h;
+        for (int k = 0; k < count; ++k) {
+            Slot& s = slots[k];
+            if (s.tex && s.state.load() != Unmapped) ctx->Unmap(s.tex, 0);
+            if (s.tex) s.tex->Release();
+            s.tex = nullptr; s.data = nullptr; s.pitch = 0;
+            s.state.store(Unmapped);
+        }
+        count = 0;
+    }
 
-        D3D_FEATURE_LEVEL fl = D3D_FEATURE_LEVEL_11_0;
-        if (FAILED(D3D11CreateDevice(nullptr, D3D_DRIVER_TYPE_HARDWARE, nullptr, 0,
-                                     &fl, 1, D3D11_SDK_VERSION,
-                                     &device, nullptr, &ctx))) {
-            std::cerr << "[DX11] CreateDevice failed\n"; return false;
+    // ── Поток захвата ──
+
+    // Копирует кадр f (base / uv) в свободный слот и переводит f на слот.
+    // false — подходящего слота нет, f остаётся как был (обычный путь).
+    bool store(Frame& f)
+    {
+        if (f.gpuTex || !f.base || f.format != format || f.width != width || f.height != height)
+            return false;
+        int k = 0;
+        for (; k < count; ++k) {
+            int expect = Ready;
+            if (slots[k].state.compare_exchange_strong(expect, Writing, std::memory_order_acq_rel))
+                break;
         }
+        if (k == count) { ++misses; return false; }
+
+        Slot&        s        = slots[k];
+        const size_t rowBytes = static_cast<size_t>(f.width) * (f.format == PixelFormat::NV12 ? 1 : 2);
+        for (int y = 0; y < f.height; ++y)
+            memcpy(s.data + static_cast<size_t>(y) * s.pitch, f.row(y), rowBytes);
+        if (isPlanar(f.format)) {
+            uint8_t* uvDst = s.data + static_cast<size_t>(f.height) * s.pitch;
+            for (int y = 0; y < f.height / 2; ++y)
+                memcpy(uvDst + static_cast<size_t>(y) * s.pitch, f.uvRow(y), rowBytes);
+        }
+        s.state.store(Filled, std::memory_order_release);
+        f.uploadSlot = k;
+        ++stored;
+        return true;
+    }
 
-        IDXGIFactory2* factory = nullptr;
-        {
-            IDXGIDevice*  dxgiDev = nullptr;
+    // Слот кадра, который рендер так и не забрал, снова свободен.
+    void reclaim(Frame& f)
+    {
+        if (f.uploadSlot < 0) return;
+        int expect = Filled;
+        slots[f.uploadSlot].state.compare_exchange_strong(expect, Ready, std::memory_order_acq_rel);
+        f.uploadSlot = -1;
+    }
+};
+
+// ─── Статистика задержки ─────────────────────────────────────────────────────
+//
+// Этапы кадра по меткам QPC:
+//   device → receive   драйвер/устройство (только MF: DeviceReferenceSystemTime)
+//   receive → commit   обёртка сэмпла / read() и обмен в TripleBuffer
+//   commit → upload    ожидание в TripleBuffer и очереди present
+//   upload             CPU → GPU (Map / копия / конвертация)
+//   upload → present   отрисовка до вызова Present
+//   present → display  до vblank по DXGI GetFrameStatistics
+//   total              от самой ранней известной метки до display
+//
+// Окно — 1 с: точные p50/p99/max сортировкой (~60-240 значений). За сессию —
+// гистограмма с шагом 0.05 мс до 200 мс, память не растёт с длиной сессии.
+
+struct LatencyStats {
+    enum Stage { DEVICE, COMMIT, QUEUE, UPLOAD, RENDER, DISPLAY, TOTAL, STAGE_COUNT };
+
+    struct Summary { float p50 = 0, p99 = 0, max = 0; int n = 0; };
+
+    static constexpr float HIST_STEP = 0.05f;
+    static constexpr int   HIST_BINS = 4000;
+
+    std::array<std::vector<float>, STAGE_COUNT> window;
+    std::array<Summary, STAGE_COUNT>            last;     // итог прошлого окна
+    std::array<std::vector<uint32_t>, STAGE_COUNT> hist;
+    std::array<float, STAGE_COUNT>              sessionMax {};
+
+    double   captureFps = 0.0, renderFps = 0.0;
+    uint64_t dropped    = 0;                   // пришли, но не были показаны
+
+    std::ofstream log;
+
+    static const char* stageName(int s)
+    {
+        static const char* names[STAGE_COUNT] = {
+            "device->recv", "recv->commit", "commit->upload", "upload",
+            "upload->present", "present->display", "total" };
+        return names[s];
+    }
+
+    LatencyStats() { for (auto& h : hist) h.assign(HIST_BINS, 0); }
+
+    bool openLog(const std::string& path)
+    {
+        log.open(path, std::ios::trunc);
+        if (!log) return false;
+        log << "time_s,stage,p50_ms,p99_ms,max_ms,samples,capture_fps,render_fps\n";
+        return true;
+    }
+
+    void add(int stage, int64_t from, int64_t to)
+    {
+        if (!from || !to || to < from) return;
+        const float ms = static_cast<float>(qpcToMs(to - from));
+        window[stage].push_back(ms);
+        int bin = static_cast<int>(ms / HIST_STEP);
+        ++hist[stage][(std::min)(bin, HIST_BINS - 1)];
+        sessionMax[stage] = (std::max)(sessionMax[stage], ms);
+    }
+
+    // Кадр ушёл в Present. Метки display приходят позже, по PresentCount.
+    void onPresent(const Frame& f, int64_t uploadStart, int64_t uploadEnd,
+                   int64_t present, UINT presentId)
+    {
+        add(DEVICE, f.tDevice,  f.tReceive);
+        add(COMMIT, f.tReceive, f.tCommit);
+        add(QUEUE,  f.tCommit,  uploadStart);
+        add(UPLOAD, uploadStart, uploadEnd);
+        add(RENDER, uploadEnd,  present);
+
+        if (lastSeq_ && f.seq > lastSeq_ + 1) dropped += f.seq - lastSeq_ - 1;
+        lastSeq_ = f.seq;
+        ++presents_;
+
+        Pending& p = pending_[presentId % pending_.size()];
+        p.id      = presentId;
+        p.present = present;
+        p.origin  = f.tDevice ? f.tDevice : f.tReceive;
+    }
+
+    // SyncQPCTime последнего Present, попавшего на экран. Статистика DXGI
+    // описывает только последний показанный кадр, часть кадров без метки.
+    void onDisplayed(UINT presentId, int64_t syncQpc)
+    {
+        Pending& p = pending_[presentId % pending_.size()];
+        if (p.id != presentId || !p.present) return;
+        add(DISPLAY, p.present, syncQpc);
+        add(TOTAL,   p.origin,  syncQpc);
+        p.present = 0;
+    }
+
+    // Закрывает окно раз в секунду. true — итоги обновились.
+    bool tick(int64_t now)
+    {
+        if (!windowStart_) { windowStart_ = now; windowSeq_ = lastSeq_; return false; }
+        const double dt = qpcToMs(now - windowStart_) / 1000.0;
+        if (dt < 1.0) return false;
+
+        captureFps = (lastSeq_ - windowSeq_) / dt;
+        renderFps  = presents_ / dt;
+        for (int s = 0; s < STAGE_COUNT; ++s) {
+            auto& v = window[s];
+            Summary sum;
+            if (!v.empty()) {
+                std::sort(v.begin(), v.end());
+                sum.n   = static_cast<int>(v.size());
+                sum.p50 = v[(v.size() - 1) / 2];
+                sum.p99 = v[(v.size() - 1) * 99 / 100];
+                sum.max = v.back();
+            }
+            last[s] = sum;
+            v.clear();
+            if (log && sum.n)
+                log << timeS_ + dt << ',' << stageName(s) << ',' << sum.p50 << ','
+                    << sum.p99 << ',' << sum.max << ',' << sum.n << ','
+                    << captureFps << ',' << renderFps << '\n';
+        }
+        if (log) log.flush();
+        timeS_      += dt;
+        windowStart_ = now;
+        windowSeq_   = lastSeq_;
+        presents_    = 0;
+        return true;
+    }
+
+    // Многострочный текст для GPU оверлея.
+    std::string overlayText() const
+    {
+        std::string out;
+        char line[96];
+        for (int s = 0; s < STAGE_COUNT; ++s) {
+            if (!last[s].n) continue;
+            snprintf(line, sizeof(line), "\n%-16s p50 %6.2f  p99 %6.2f  max %6.2f ms",
+                     stageName(s), last[s].p50, last[s].p99, last[s].max);
+            out += line;
+        }
+        return out;
+    }
+
+    // Итог за всю сессию по гистограмме.
+    Summary session(int s) const
+    {
+        Summary sum;
+        uint64_t n = 0;
+        for (uint32_t c : hist[s]) n += c;
+        if (!n) return sum;
+        sum.n   = static_cast<int>((std::min)(n, static_cast<uint64_t>(INT_MAX)));
+        sum.p50 = (std::min)(histPercentile(s, n, 50), sessionMax[s]);
+        sum.p99 = (std::min)(histPercentile(s, n, 99), sessionMax[s]);
+        sum.max = sessionMax[s];
+        return sum;
+    }
+
+    void printSummary() const
+    {
+        std::cout << "\n" << UI_TOP << "\n";
+        uiCenter("Latency (session)");
+        std::cout << UI_SEP << "\n";
+        char line[96];
+        snprintf(line, sizeof(line), "%-16s %7s %7s %7s  ms", "Stage", "p50", "p99", "max");
+        uiLine(line);
+        for (int s = 0; s < STAGE_COUNT; ++s) {
+            const Summary sum = session(s);
+            if (!sum.n) continue;
+            snprintf(line, sizeof(line), "%-16s %7.2f %7.2f %7.2f", stageName(s),
+                     sum.p50, sum.p99, sum.max);
+            uiLine(line);
+        }
+        snprintf(line, sizeof(line), "Dropped frames  :  %llu",
+                 static_cast<unsigned long long>(dropped));
+        std::cout << UI_SEP << "\n";
+        uiLine(line);
+        std::cout << UI_BOT << "\n";
+    }
+
+private:
+    struct Pending { UINT id = 0; int64_t present = 0, origin = 0; };
+
+    // Середина бина — погрешность не больше HIST_STEP / 2.
+    float histPercentile(int s, uint64_t n, int pct) const
+    {
+        const uint64_t rank = (n - 1) * pct / 100;
+        uint64_t acc = 0;
+        for (int b = 0; b < HIST_BINS; ++b) {
+            acc += hist[s][b];
+            if (acc > rank) return (b + 0.5f) * HIST_STEP;
+        }
+        return HIST_BINS * HIST_STEP;
+    }
+
+    std::array<Pending, 16> pending_ {};
+    int64_t  windowStart_ = 0;
+    uint64_t windowSeq_   = 0;
+    uint64_t lastSeq_     = 0;
+    int      presents_    = 0;
+    double   timeS_       = 0.0;
+};
+
+// ─── Калибровка задержки: мигающий маркер ────────────────────────────────────
+//
+// --sender выводит на свой экран чёрный кадр с квадратом в левом верхнем углу,
+// который каждые MARKER_PERIOD_MS меняет цвет (белый / чёрный). Этот экран
+// подаётся на карту захвата. --calibrate на стороне приёма читает яркость того
+// же угла каждого показанного кадра (копия области текстуры в маленький
+// staging, Map без ожидания), по гистерезису ловит кадр, на котором маркер
+// сменился, и берёт время vblank его Present из DXGI статистики:
+//   capture → photon   поток захвата получил кадр → vblank показа
+//   device  → photon   то же от метки устройства (только MF)
+// Если передатчик запущен на той же машине (loopback: второй выход
+// видеокарты → карта захвата), его фронты приходят через общую память с
+// QPC их vblank — те же часы, что у приёма:
+//   sender → capture   фронт на выходе передатчика → кадр в потоке захвата
+//   sender → photon    полная задержка стекло-стекло без учёта панели
+// "Photon" здесь — vblank по SyncQPCTime: обработку в самом мониторе
+// программой не измерить.
+
+static const int      MARKER_PERIOD_MS = 250;
+static const wchar_t* MARKER_MAPPING   = L"Local\\ExternalDisplayBridgeMarker";
+
+// Сторона квадрата маркера: 1/8 меньшей стороны кадра, чётная (NV12 / YUY2).
+static int markerSide(int w, int h) { return ((std::min)(w, h) / 8) & ~1; }
+
+// Фронты передатчика: кольцо в общей памяти, count растёт монотонно.
+struct MarkerShared {
+    struct Edge { int64_t qpc; int32_t level; int32_t pad; };
+    static constexpr int RING = 64;
+
+    std::atomic<uint64_t> count;
+    Edge                  ring[RING];
+};
+
+// Средняя яркость центра области маркера, 0..255. data — строки Y (YUY2 —
+// упакованные пары, P010 — 16 бит, BGR24 путь — BGRA текстура).
+static int markerLuma(const uint8_t* data, UINT pitch, int side, PixelFormat fmt)
+{
+    uint64_t sum = 0, n = 0;
+    for (int y = side / 4; y < side * 3 / 4; y += 2) {
+        const uint8_t* row = data + static_cast<size_t>(y) * pitch;
+        for (int x = side / 4; x < side * 3 / 4; x += 2, ++n) {
+            switch (fmt) {
+            case PixelFormat::YUY2:  sum += row[x * 2];     break;
+            case PixelFormat::NV12:  sum += row[x];         break;
+            case PixelFormat::P010:  sum += row[x * 2 + 1]; break;   // старший байт
+            case PixelFormat::BGR24: {
+                const uint8_t* p = row + x * 4;
+                sum += (p[0] + 2 * p[1] + p[2]) / 4;
+                break;
+            }
+            }
+        }
+    }
+    return n ? static_cast<int>(sum / n) : 0;
+}
+
+// Кадр, область которого ушла на readback.
+struct MarkerTag {
+    UINT    presentId = 0;
+    int64_t tDevice   = 0;
+    int64_t tReceive  = 0;
+};
+
+class Calibration {
+public:
+    enum Metric { CAPTURE_PHOTON, DEVICE_PHOTON, SENDER_CAPTURE, SENDER_PHOTON, METRIC_COUNT };
+
+    static const char* metricName(int m)
+    {
+        static const char* names[METRIC_COUNT] = {
+            "capture->photon", "device->photon", "sender->capture", "sender->photon" };
+        return names[m];
+    }
+
+    ~Calibration()
+    {
+        if (shared_)  UnmapViewOfFile(shared_);
+        if (mapping_) CloseHandle(mapping_);
+    }
+
+    // Яркость области очередного показанного кадра (в порядке Present).
+    // Пороги с гистерезисом: limited range (16..235) и full range проходят оба.
+    void onSample(int luma, const MarkerTag& tag)
+    {
+        const int level = (luma > 170) ? 1 : (luma < 85) ? 0 : level_;
+        if (level < 0 || level == level_) { level_ = level; return; }
+        const bool first = (level_ < 0);
+        level_ = level;
+        if (first) return;                          // начальное состояние — не фронт
+
+        Edge e;
+        e.level    = level;
+        e.tag      = tag;
+        const Shown& s = shown_[tag.presentId % shown_.size()];
+        if (s.id == tag.presentId && tag.presentId) e.photon = s.qpc;
+        edges_.push_back(e);
+    }
+
+    // DXGI статистика: последний показанный Present. Фронт мог быть пойман
+    // readback'ом и раньше, и позже этой метки — храним обе стороны.
+    void onDisplayed(UINT presentId, int64_t syncQpc)
+    {
+        shown_[presentId % shown_.size()] = { presentId, syncQpc };
+        for (size_t k = edges_.size(); k-- > 0 && edges_.size() - k <= 8; )
+            if (edges_[k].tag.presentId == presentId && !edges_[k].photon)
+                edges_[k].photon = syncQpc;
+    }
+
+    // Новые фронты передатчика из общей памяти (если он запущен рядом).
+    void pollSender()
+    {
+        if (!shared_) {
+            const int64_t now = qpcNow();
+            if (now < nextOpen_) return;
+            nextOpen_ = now + qpcFrequency();       // раз в секунду
+            mapping_  = OpenFileMappingW(FILE_MAP_READ, FALSE, MARKER_MAPPING);
+            if (!mapping_) return;
+            shared_ = static_cast<const MarkerShared*>(
+                MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, sizeof(MarkerShared)));
+            if (!shared_) { CloseHandle(mapping_); mapping_ = nullptr; return; }
+            senderRead_ = shared_->count.load(std::memory_order_acquire);
+        }
+        const uint64_t count = shared_->count.load(std::memory_order_acquire);
+        if (count - senderRead_ > MarkerShared::RING)
+            senderRead_ = count - MarkerShared::RING;
+        for (; senderRead_ < count; ++senderRead_)
+            sender_.push_back(shared_->ring[senderRead_ % MarkerShared::RING]);
+    }
+
+    int    edges()     const { return static_cast<int>(edges_.size()); }
+    bool   hasSender() const { return !sender_.empty(); }
+
+    // Последний измеренный capture → photon, мс (0 — ещё нет).
+    double lastPhotonMs() const
+    {
+        for (size_t k = edges_.size(); k-- > 0; )
+            if (edges_[k].photon) return qpcToMs(edges_[k].photon - edges_[k].tag.tReceive);
+        return 0.0;
+    }
+
+    void printReport(const std::vector<std::string>& setup) const
+    {
+        std::array<std::vector<double>, METRIC_COUNT> ms;
+        for (const Edge& e : edges_) {
+            const MarkerShared::Edge* s = senderEdge(e);
+            add(ms[CAPTURE_PHOTON], e.tag.tReceive, e.photon);
+            add(ms[DEVICE_PHOTON],  e.tag.tDevice,  e.photon);
+            add(ms[SENDER_CAPTURE], s ? s->qpc : 0, e.tag.tReceive);
+            add(ms[SENDER_PHOTON],  s ? s->qpc : 0, e.photon);
+        }
+
+        char line[96];
+        std::cout << "\n" << UI_TOP << "\n";
+        uiCenter("Latency calibration");
+        std::cout << UI_SEP << "\n";
+        for (const std::string& l : setup) uiLine(l);
+        snprintf(line, sizeof(line), "Marker edges    :  %d (%d displayed)",
+                 edges(), static_cast<int>(ms[CAPTURE_PHOTON].size()));
+        uiLine(line);
+        std::cout << UI_SEP << "\n";
+        snprintf(line, sizeof(line), "%-16s %7s %7s %7s %5s", "ms", "p50", "p99", "max", "n");
+        uiLine(line);
+        for (int m = 0; m < METRIC_COUNT; ++m) {
+            auto& v = ms[m];
+            if (v.empty()) continue;
+            std::sort(v.begin(), v.end());
+            snprintf(line, sizeof(line), "%-16s %7.2f %7.2f %7.2f %5d", metricName(m),
+                     v[(v.size() - 1) / 2], v[(v.size() - 1) * 99 / 100], v.back(),
+                     static_cast<int>(v.size()));
+            uiLine(line);
+        }
+
+        // Гистограмма самой полной из метрик, бины по 1 мс.
+        const int m = !ms[SENDER_PHOTON].empty() ? SENDER_PHOTON : CAPTURE_PHOTON;
+        const auto& v = ms[m];
+        if (!v.empty()) {
+            const int lo = static_cast<int>(v.front());
+            const int hi = (std::min)(static_cast<int>(v.back()), lo + 23);   // 24 строки
+            std::vector<int> bins(hi - lo + 1, 0);
+            for (double x : v) ++bins[(std::min)(static_cast<int>(x), hi) - lo];
+            const int peak = *std::max_element(bins.begin(), bins.end());
+            std::cout << UI_SEP << "\n";
+            uiLine(std::string(metricName(m)) + ", 1 ms bins:");
+            for (size_t b = 0; b < bins.size(); ++b) {
+                const int bar = (bins[b] * 32 + peak - 1) / peak;
+                snprintf(line, sizeof(line), "%4d%s |%-32s %5d", lo + static_cast<int>(b),
+                         (lo + static_cast<int>(b) == hi && v.back() >= hi + 1) ? "+" : " ",
+                         std::string(bar, '#').c_str(), bins[b]);
+                uiLine(line);
+            }
+        }
+        std::cout << UI_BOT << "\n";
+    }
+
+private:
+    struct Edge {
+        int       level  = 0;
+        MarkerTag tag;
+        int64_t   photon = 0;                       // SyncQPCTime показа, 0 — не попал
+    };
+    struct Shown { UINT id = 0; int64_t qpc = 0; };
+
+    static void add(std::vector<double>& v, int64_t from, int64_t to)
+    {
+        if (from && to && to >= from) v.push_back(qpcToMs(to - from));
+    }
+
+    // Последний фронт передатчика того же уровня не позже приёма и не
+    // старше секунды (за секунду маркер меняется четыре раза).
+    const MarkerShared::Edge* senderEdge(const Edge& e) const
+    {
+        for (size_t k = sender_.size(); k-- > 0; ) {
+            const MarkerShared::Edge& s = sender_[k];
+            if (s.qpc > e.tag.tReceive) continue;
+            if (e.tag.tReceive - s.qpc > qpcFrequency()) return nullptr;
+            if (s.level == e.level) return &s;
+        }
+        return nullptr;
+    }
+
+    int                             level_ = -1;   // -1 — ещё неизвестен
+    std::vector<Edge>               edges_;
+    std::array<Shown, 64>           shown_ {};
+    std::vector<MarkerShared::Edge> sender_;
+    uint64_t                        senderRead_ = 0;
+    HANDLE                          mapping_  = nullptr;
+    const MarkerShared*             shared_   = nullptr;
+    int64_t                         nextOpen_ = 0;
+};
+
+// ─── Источник захвата ────────────────────────────────────────────────────────
+//
+// Общий интерфейс бэкендов: main и рендерер видят только кадры в TripleBuffer
+// и параметры согласованного формата.
+
+class CaptureSource {
+public:
+    virtual ~CaptureSource() = default;
+
+    virtual int         width()  const = 0;
+    virtual int         height() const = 0;
+    virtual PixelFormat format() const = 0;
+    virtual std::string fourcc() const = 0;   // формат на проводе устройства
+    virtual double      fps()    const = 0;
+    virtual const char* backendName() const = 0;
+    virtual void        stop()         = 0;
+
+    // Бэкенд умеет сам писать кадры в слоты рендера (см. UploadSlots).
+    // Вызывается один раз после open, слоты живут дольше источника.
+    virtual bool        setUploadSlots(UploadSlots*) { return false; }
+
+    // Постоянный адрес устройства для профиля сессии (пусто — только индекс).
+    virtual std::wstring deviceLink() const { return {}; }
+
+    // Устройство пропало или сменило режим сигнала: кадров больше не будет,
+    // источник переоткрывает Reconnector.
+    bool lost() const { return lost_.load(std::memory_order_acquire); }
+
+protected:
+    std::atomic<bool> lost_ { false };        // пишет поток захвата
+};
+
+static uint32_t fourccFromString(const std::string& s)
+{
+    uint32_t fcc = 0;
+    for (size_t i = 0; i < 4 && i < s.size(); ++i)
+        fcc |= static_cast<uint32_t>(static_cast<uint8_t>(s[i])) << (8 * i);
+    return fcc;
+}
+
+static std::string fourccToString(uint32_t fcc)
+{
+    std::string s(4, ' ');
+    for (int i = 0; i < 4; ++i) {
+        char c = static_cast<char>((fcc >> (8 * i)) & 0xFF);
+        s[i] = (c >= 0x20 && c < 0x7F) ? c : '?';
+    }
+    return s;
+}
+
+// ─── Видеорежимы и выбор формата ─────────────────────────────────────────────
+//
+// Оба бэкенда перечисляют режимы устройства (DirectShow — IAMStreamConfig,
+// MF — GetNativeMediaType) и выбирают одинаково:
+//   1. режим: ближайшее к запросу разрешение, затем частота кадров;
+//   2. формат — самый дешёвый при этом режиме: байт на пиксель по USB и в
+//      upload, декодирование — отдельная большая надбавка.
+//        NV12 12 bpp < YUY2 16 bpp < P010 24 bpp < MJPG (декодер)
+// P010 (10 бит, HDR) тяжелее YUY2 и берётся, только если дешевле нет
+// или он задан явно (--format p010).
+
+struct ModeRequest {
+    int      width  = 1920;
+    int      height = 1080;
+    double   fps    = 60.0;
+    uint32_t fourcc = 0;            // 0 — любой поддерживаемый
+    bool     exact  = false;        // режим из профиля сессии: не перечислять
+};
+
+struct VideoMode {
+    uint32_t fourcc = 0;            // Data1 подтипа: MEDIASUBTYPE_X == MFVideoFormat_X
+    int      width  = 0;
+    int      height = 0;
+    double   fps    = 0.0;
+};
+
+// Условная цена кадра формата; -1 — формат не поддерживается рендерером.
+static int formatCost(uint32_t fcc)
+{
+    if (fcc == fourccOf("NV12")) return 150;
+    if (fcc == fourccOf("YUY2")) return 200;
+    if (fcc == fourccOf("P010")) return 300;
+    if (fcc == fourccOf("MJPG")) return 1000;
+    return -1;
+}
+
+// Индекс лучшего режима или -1.
+static int pickMode(const std::vector<VideoMode>& modes, const ModeRequest& req)
+{
+    int       best     = -1;
+    long long bestCost = LLONG_MAX;
+    for (size_t i = 0; i < modes.size(); ++i) {
+        const VideoMode& m = modes[i];
+        const int fmtCost = formatCost(m.fourcc);
+        if (fmtCost < 0 || (req.fourcc && m.fourcc != req.fourcc)) continue;
+        long long pixDiff = std::llabs(static_cast<long long>(m.width) * m.height -
+                                       static_cast<long long>(req.width) * req.height);
+        long long fpsDiff = (std::min)(static_cast<long long>(std::fabs(m.fps - req.fps) * 1000.0),
+                                       999999LL);
+        long long cost = (pixDiff * 1000000LL + fpsDiff) * 10000 + fmtCost;
+        if (cost < bestCost) { bestCost = cost; best = static_cast<int>(i); }
+    }
+    return best;
+}
+
+static std::string modeToString(const VideoMode& m)
+{
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%dx%d@%.0f %s", m.width, m.height, m.fps,
+             fourccToString(m.fourcc).c_str());
+    return buf;
+}
+
+// Режимы DirectShow устройства с индексом index (порядок enumerateDevices).
+// Частота — максимальная для режима (MinFrameInterval).
+static std::vector<VideoMode> enumerateDShowModes(int index)
+{
+    std::vector<VideoMode> modes;
+
+    ICreateDevEnum* devEnum = nullptr;
+    CoCreateInstance(CLSID_SystemDeviceEnum, nullptr, CLSCTX_INPROC_SERVER,
+                     IID_ICreateDevEnum, reinterpret_cast<void**>(&devEnum));
+    if (!devEnum) return modes;
+    IEnumMoniker* enumMon = nullptr;
+    devEnum->CreateClassEnumerator(CLSID_VideoInputDeviceCategory, &enumMon, 0);
+    devEnum->Release();
+    if (!enumMon) return modes;
+
+    IMoniker* moniker = nullptr;
+    for (int i = 0; enumMon->Next(1, &moniker, nullptr) == S_OK; ++i) {
+        if (i != index) { moniker->Release(); continue; }
+
+        IBaseFilter* filter = nullptr;
+        moniker->BindToObject(nullptr, nullptr, IID_IBaseFilter,
+                              reinterpret_cast<void**>(&filter));
+        moniker->Release();
+        if (!filter) break;
+
+        IEnumPins* pins = nullptr;
+        filter->EnumPins(&pins);
+        IPin* pin = nullptr;
+        while (pins && modes.empty() && pins->Next(1, &pin, nullptr) == S_OK) {
+            PIN_DIRECTION dir = PINDIR_INPUT;
+            pin->QueryDirection(&dir);
+            IAMStreamConfig* cfg = nullptr;
+            if (dir == PINDIR_OUTPUT &&
+                SUCCEEDED(pin->QueryInterface(IID_IAMStreamConfig,
+                                              reinterpret_cast<void**>(&cfg)))) {
+                int count = 0, size = 0;
+                cfg->GetNumberOfCapabilities(&count, &size);
+                for (int c = 0; c < count && size == sizeof(VIDEO_STREAM_CONFIG_CAPS); ++c) {
+                    VIDEO_STREAM_CONFIG_CAPS caps = {};
+                    AM_MEDIA_TYPE* mt = nullptr;
+                    if (FAILED(cfg->GetStreamCaps(c, &mt, reinterpret_cast<BYTE*>(&caps))) || !mt)
+                        continue;
+                    const BITMAPINFOHEADER* bih = nullptr;
+                    if (mt->formattype == FORMAT_VideoInfo && mt->pbFormat)
+                        bih = &reinterpret_cast<VIDEOINFOHEADER*>(mt->pbFormat)->bmiHeader;
+                    else if (mt->formattype == FORMAT_VideoInfo2 && mt->pbFormat)
+                        bih = &reinterpret_cast<VIDEOINFOHEADER2*>(mt->pbFormat)->bmiHeader;
+                    if (bih && caps.MinFrameInterval > 0)
+                        modes.push_back({ mt->subtype.Data1, bih->biWidth, std::abs(bih->biHeight),
+                                          1e7 / static_cast<double>(caps.MinFrameInterval) });
+                    if (mt->cbFormat) CoTaskMemFree(mt->pbFormat);
+                    if (mt->pUnk)     mt->pUnk->Release();
+                    CoTaskMemFree(mt);
+                }
+                cfg->Release();
+            }
+            pin->Release();
+        }
+        if (pins) pins->Release();
+        filter->Release();
+        break;
+    }
+    enumMon->Release();
+    return modes;
+}
+
+// ─── Проба устройств: режимы и кэш ───────────────────────────────────────────
+//
+// Обход IAMStreamConfig у UVC карт занимает сотни мс на устройство, поэтому
+// пробы идут параллельно, по потоку на устройство, пока пользователь отвечает
+// на вопрос о клавишах. Режимы кэшируются по DevicePath в device_cache.bin:
+// следующий запуск их не пробует. Устарел кэш (прошивка, другая карта в том
+// же порту) — файл удаляется вручную.
+
+static const char*  DEVCACHE_FILE  = "device_cache.bin";
+static const DWORD  DEVCACHE_MAGIC = 0x44435631; // "DCV1"
+
+using ModeCache = std::map<std::wstring, std::vector<VideoMode>>;
+
+// Формат файла: magic, число записей; запись — длина пути, путь (wchar_t),
+// число режимов, VideoMode[].
+static ModeCache loadModeCache()
+{
+    ModeCache cache;
+    std::ifstream f(DEVCACHE_FILE, std::ios::binary);
+    DWORD    magic = 0;
+    uint32_t count = 0;
+    if (!f.read(reinterpret_cast<char*>(&magic), sizeof(magic)) || magic != DEVCACHE_MAGIC ||
+        !f.read(reinterpret_cast<char*>(&count), sizeof(count)))
+        return cache;
+    for (uint32_t e = 0; e < count && e < 64; ++e) {
+        uint32_t pathLen = 0, modeCount = 0;
+        if (!f.read(reinterpret_cast<char*>(&pathLen), sizeof(pathLen)) || pathLen > 1024) break;
+        std::wstring path(pathLen, L'\0');
+        if (!f.read(reinterpret_cast<char*>(&path[0]), pathLen * sizeof(wchar_t)) ||
+            !f.read(reinterpret_cast<char*>(&modeCount), sizeof(modeCount)) || modeCount > 1024)
+            break;
+        std::vector<VideoMode> modes(modeCount);
+        if (modeCount && !f.read(reinterpret_cast<char*>(modes.data()),
+                                 modeCount * sizeof(VideoMode)))
+            break;
+        cache[path] = std::move(modes);
+    }
+    return cache;
+}
+
+static bool saveModeCache(const ModeCache& cache)
+{
+    std::ofstream f(DEVCACHE_FILE, std::ios::binary);
+    if (!f) return false;
+    const uint32_t count = static_cast<uint32_t>(cache.size());
+    f.write(reinterpret_cast<const char*>(&DEVCACHE_MAGIC), sizeof(DEVCACHE_MAGIC));
+    f.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    for (const auto& e : cache) {
+        const uint32_t pathLen   = static_cast<uint32_t>(e.first.size());
+        const uint32_t modeCount = static_cast<uint32_t>(e.second.size());
+        f.write(reinterpret_cast<const char*>(&pathLen), sizeof(pathLen));
+        f.write(reinterpret_cast<const char*>(e.first.data()), pathLen * sizeof(wchar_t));
+        f.write(reinterpret_cast<const char*>(&modeCount), sizeof(modeCount));
+        f.write(reinterpret_cast<const char*>(e.second.data()), modeCount * sizeof(VideoMode));
+    }
+    return f.good();
+}
+
+// Поток по проводу, МБ/с; 0 — сжатый формат (MJPG), оценки нет.
+static double wireMBps(const VideoMode& m)
+{
+    double bpp = 0.0;
+    if      (m.fourcc == fourccOf("NV12")) bpp = 1.5;
+    else if (m.fourcc == fourccOf("YUY2")) bpp = 2.0;
+    else if (m.fourcc == fourccOf("P010")) bpp = 3.0;
+    return bpp * m.width * m.height * m.fps / 1e6;
+}
+
+class DeviceProber {
+public:
+    ~DeviceProber() { join(); }
+
+    // Запускает пробы устройств без записи в кэше и сразу возвращается.
+    void start(std::vector<DeviceInfo> devices)
+    {
+        devices_ = std::move(devices);
+        cache_   = loadModeCache();
+        modes_.assign(devices_.size(), {});
+        for (size_t i = 0; i < devices_.size(); ++i) {
+            auto it = devices_[i].path.empty() ? cache_.end() : cache_.find(devices_[i].path);
+            if (it != cache_.end()) { modes_[i] = it->second; continue; }
+            threads_.emplace_back([this, i] {
+                CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+                pinThread(ThreadRole::Helper);
+                modes_[i] = enumerateDShowModes(devices_[i].index);
+                CoUninitialize();
+            });
+            probed_ = true;
+        }
+    }
+
+    // Ждёт пробы, дописывает кэш и возвращает устройства от лучшего режима
+    // к худшему: лучший режим устройства — pickMode по запросу, между
+    // устройствами раньше идут несжатые форматы и большая частота.
+    std::vector<DeviceInfo> finish(const ModeRequest& req)
+    {
+        join();
+        if (probed_) {
+            for (size_t i = 0; i < devices_.size(); ++i)
+                if (!devices_[i].path.empty() && !modes_[i].empty())
+                    cache_[devices_[i].path] = modes_[i];
+            if (!saveModeCache(cache_))
+                std::cerr << "[WARN] Could not save " << DEVCACHE_FILE << "\n";
+        }
+
+        std::vector<VideoMode> best(devices_.size());
+        for (size_t i = 0; i < devices_.size(); ++i) {
+            const int k = pickMode(modes_[i], req);
+            if (k < 0) continue;
+            best[i] = modes_[i][k];
+            const double mbps = wireMBps(best[i]);
+            devices_[i].caps = modeToString(best[i]) +
+                               (mbps > 0.0 ? ", " + std::to_string((int)(mbps + 0.5)) + " MB/s"
+                                           : std::string(", compressed"));
+        }
+
+        std::vector<size_t> order(devices_.size());
+        for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            const int ca = best[a].width ? formatCost(best[a].fourcc) : INT_MAX;
+            const int cb = best[b].width ? formatCost(best[b].fourcc) : INT_MAX;
+            if ((ca >= 1000) != (cb >= 1000)) return ca < cb;   // MJPG — последним
+            return best[a].fps > best[b].fps;
+        });
+        std::vector<DeviceInfo> ranked;
+        for (size_t i : order) ranked.push_back(devices_[i]);
+        return ranked;
+    }
+
+private:
+    void join()
+    {
+        for (auto& t : threads_) if (t.joinable()) t.join();
+        threads_.clear();
+    }
+
+    std::vector<DeviceInfo>             devices_;
+    std::vector<std::vector<VideoMode>> modes_;
+    std::vector<std::thread>            threads_;
+    ModeCache                           cache_;
+    bool                                probed_ = false;
+};
+
+// ─── Пул кадров OpenCV ───────────────────────────────────────────────────────
+//
+// cap_.read сам (пере)выделяет cv::Mat в обычной куче, а её страницы Windows
+// при нехватке памяти вытесняет из working set: следующая запись кадра —
+// page fault на каждой странице, на 8 GB машинах это хвосты в десятки мс.
+// Поэтому буферы слотов TripleBuffer выделяются один раз одним блоком:
+//   - large pages (нужна SeLockMemoryPrivilege) — не вытесняются вовсе;
+//   - иначе VirtualAlloc + VirtualLock, working set расширяется под блок.
+// Кадры выровнены на страницу (с запасом для 64-байтных SIMD загрузок).
+// cv::Mat слота — заголовок поверх пула: retrieve пишет прямо в него, пока
+// форма кадра совпадает. Кадр другой формы OpenCV кладёт в свой буфер — это
+// пересогласование формата, и только тогда пул выделяется заново. Прежний
+// блок живёт, пока на него смотрит хоть один слот (его кадр ещё может читать
+// рендер), затем reclaim освобождает его и возвращает working set.
+
+// SeLockMemoryPrivilege есть у учётки только по политике "Lock pages in
+// memory"; AdjustTokenPrivileges без неё отвечает ERROR_NOT_ALL_ASSIGNED.
+static bool enableLockMemoryPrivilege()
+{
+    HANDLE token = nullptr;
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+        return false;
+    TOKEN_PRIVILEGES tp = {};
+    tp.PrivilegeCount           = 1;
+    tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+    const bool ok = LookupPrivilegeValueW(nullptr, SE_LOCK_MEMORY_NAME, &tp.Privileges[0].Luid) &&
+                    AdjustTokenPrivileges(token, FALSE, &tp, 0, nullptr, nullptr) &&
+                    GetLastError() == ERROR_SUCCESS;
+    CloseHandle(token);
+    return ok;
+}
+
+class FramePool {
+public:
+    static constexpr int    COUNT = 3;        // по буферу на слот TripleBuffer
+    static constexpr size_t ALIGN = 4096;
+
+    FramePool() = default;
+    ~FramePool() { release(); }
+    FramePool(const FramePool&)            = delete;
+    FramePool& operator=(const FramePool&) = delete;
+
+    bool ready()      const { return block_.p != nullptr; }
+    bool largePages() const { return block_.large; }
+    bool locked()     const { return block_.large || block_.locked; }
+
+    // Mat слота k смотрит в пул текущей формы, а не в буфер OpenCV.
+    bool owns(const cv::Mat& m, int k) const
+    {
+        return ready() && m.data == frame(k) &&
+               m.rows == rows_ && m.cols == cols_ && m.type() == type_;
+    }
+
+    void attach(cv::Mat& m, int k) const { m = cv::Mat(rows_, cols_, type_, frame(k)); }
+
+    // Пул под кадры формы rows x cols x type. Текущий блок уходит в retired_.
+    bool allocate(int rows, int cols, int type)
+    {
+        const size_t bytes = static_cast<size_t>(rows) * cols * CV_ELEM_SIZE(type);
+        if (!bytes) return false;
+        const size_t frameBytes = (bytes + ALIGN - 1) & ~(ALIGN - 1);
+
+        Block b;
+        static const bool canLarge = GetLargePageMinimum() && enableLockMemoryPrivilege();
+        if (canLarge) {
+            const size_t page = GetLargePageMinimum();
+            b.bytes = (frameBytes * COUNT + page - 1) / page * page;
+            b.p     = static_cast<uint8_t*>(VirtualAlloc(nullptr, b.bytes,
+                          MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE));
+            b.large = b.p != nullptr;
+        }
+        if (!b.p) {
+            b.bytes = frameBytes * COUNT;
+            b.p     = static_cast<uint8_t*>(VirtualAlloc(nullptr, b.bytes,
+                          MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+            if (!b.p) return false;
+            b.grown  = growWorkingSet(static_cast<SSIZE_T>(b.bytes));
+            b.locked = VirtualLock(b.p, b.bytes) != FALSE;
+        }
+
+        if (block_.p) retired_.push_back(block_);
+        block_      = b;
+        frameBytes_ = frameBytes;
+        rows_ = rows; cols_ = cols; type_ = type;
+        return true;
+    }
+
+    // Блоки прежних форм, на которые не смотрит ни один слот tb. Только
+    // поток захвата: он один перевешивает Mat слотов.
+    void reclaim(const TripleBuffer& tb)
+    {
+        for (size_t i = 0; i < retired_.size(); ) {
+            const Block& b = retired_[i];
+            bool used = false;
+            for (const Frame& f : tb.bufs)
+                used |= f.data.data >= b.p && f.data.data < b.p + b.bytes;
+            if (used) { ++i; continue; }
+            freeBlock(b);
+            retired_.erase(retired_.begin() + i);
+        }
+    }
+
+    // Только когда ни один кадр пула уже не читается (после остановки захвата).
+    void release()
+    {
+        if (block_.p) retired_.push_back(block_);
+        for (const Block& b : retired_) freeBlock(b);
+        retired_.clear();
+        block_ = {};
+    }
+
+private:
+    struct Block {
+        uint8_t* p      = nullptr;
+        size_t   bytes  = 0;
+        bool     large  = false;
+        bool     locked = false;
+        bool     grown  = false;      // working set расширен на bytes
+    };
+
+    // VirtualLock держит страницы только в пределах минимального working
+    // set: он растёт на блок и сжимается обратно, когда блок освобождён.
+    static bool growWorkingSet(SSIZE_T delta)
+    {
+        SIZE_T minWs = 0, maxWs = 0;
+        DWORD  flags = 0;
+        HANDLE proc  = GetCurrentProcess();
+        if (!GetProcessWorkingSetSizeEx(proc, &minWs, &maxWs, &flags)) return false;
+        if (delta < 0 && minWs < static_cast<SIZE_T>(-delta)) return false;
+        return SetProcessWorkingSetSizeEx(proc, minWs + delta, maxWs + delta, flags) != FALSE;
+    }
+
+    static void freeBlock(const Block& b)
+    {
+        if (b.locked) VirtualUnlock(b.p, b.bytes);
+        VirtualFree(b.p, 0, MEM_RELEASE);
+        if (b.grown) growWorkingSet(-static_cast<SSIZE_T>(b.bytes));
+    }
+
+    uint8_t* frame(int k) const { return block_.p + static_cast<size_t>(k) * frameBytes_; }
+
+    Block              block_;
+    std::vector<Block> retired_;
+    size_t             frameBytes_ = 0;
+    int                rows_ = 0, cols_ = 0, type_ = 0;
+};
+
+// ─── Поток захвата: OpenCV / DirectShow ──────────────────────────────────────
+
+class VideoStream : public CaptureSource {
+public:
+    // known — режимы устройства из пробы или device_cache.bin, nullptr —
+    // перечислить здесь.
+    VideoStream(int deviceId, TripleBuffer& tb, bool raw, const ModeRequest& req,
+                const std::vector<VideoMode>* known = nullptr, size_t source = 0)
+        : tb_(tb), source_(source), running_(true), width_(0), height_(0)
+    {
+        // Режим выбираем сами: OpenCV не перечисляет режимы, а на запрос без
+        // точного совпадения DirectShow молча отдаёт что-нибудь своё.
+        // P010 OpenCV DSHOW не понимает — только через MF.
+        // Режим из профиля устройство уже отдавало, а режимы из кэша уже
+        // известны — обход пинов и IAMStreamConfig (сотни мс на UVC) не нужен.
+        VideoMode want { req.fourcc ? req.fourcc : fourccOf("YUY2"),
+                         req.width, req.height, req.fps };
+        if (!req.exact) {
+            std::vector<VideoMode> modes = known ? *known : enumerateDShowModes(deviceId);
+            modes.erase(std::remove_if(modes.begin(), modes.end(), [](const VideoMode& m) {
+                            return m.fourcc == fourccOf("P010"); }), modes.end());
+            int pick = pickMode(modes, req);
+            if (pick >= 0) want = modes[pick];
+        }
+
+        cap_.open(deviceId, cv::CAP_DSHOW);
+
+        // open уже собрал граф в режиме по умолчанию. FOURCC и размер
+        // DSHOW-бэкенд запоминает и перестраивает граф один раз, на HEIGHT,
+        // а FPS останавливает и заново запускает устройство сразу — поэтому
+        // он последним и только если режим отдал другую частоту.
+        cap_.set(cv::CAP_PROP_FOURCC,     static_cast<double>(want.fourcc));
+        cap_.set(cv::CAP_PROP_BUFFERSIZE, 1);
+        cap_.set(cv::CAP_PROP_FRAME_WIDTH,  want.width);
+        cap_.set(cv::CAP_PROP_FRAME_HEIGHT, want.height);
+        if (want.fps > 0.0 && std::fabs(cap_.get(cv::CAP_PROP_FPS) - want.fps) > 0.5)
+            cap_.set(cv::CAP_PROP_FPS, want.fps);
+
+        width_  = static_cast<int>(cap_.get(cv::CAP_PROP_FRAME_WIDTH));
+        height_ = static_cast<int>(cap_.get(cv::CAP_PROP_FRAME_HEIGHT));
+
+        // Passthrough возможен только если драйвер реально отдаёт YUY2/NV12:
+        // для MJPG сырой буфер — это JPEG, его всё равно декодирует OpenCV.
+        const uint32_t fcc = static_cast<uint32_t>(cap_.get(cv::CAP_PROP_FOURCC));
+        const bool     yuv = (fcc == fourccOf("YUY2") || fcc == fourccOf("NV12")) &&
+                             !(fcc == fourccOf("NV12") && (width_ | height_) & 1);
+        if (raw && yuv && cap_.set(cv::CAP_PROP_CONVERT_RGB, 0))
+            format_ = (fcc == fourccOf("NV12")) ? PixelFormat::NV12 : PixelFormat::YUY2;
+
+        captureThread_ = std::thread(&VideoStream::captureLoop, this);
+    }
+
+    ~VideoStream() override { stop(); }
+
+    int         width()  const override { return width_;  }
+    int         height() const override { return height_; }
+    PixelFormat format() const override { return format_; }
+    double      fps()    const override { return cap_.get(cv::CAP_PROP_FPS); }
+    const char* backendName() const override { return "OpenCV / DirectShow"; }
+    std::string fourcc() const override
+    {
+        return fourccToString(static_cast<uint32_t>(cap_.get(cv::CAP_PROP_FOURCC)));
+    }
+
+    void stop() override
+    {
+        running_ = false;
+        if (captureThread_.joinable()) captureThread_.join();
+        cap_.release();
+        for (auto& f : tb_.bufs) {                          // пул умирает с источником
+            f.data.release();
+            f.base = f.uv = nullptr;
+        }
+        pool_.release();
+    }
+
+private:
+    void captureLoop()
+    {
+        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+        pinThread(ThreadRole::Capture, source_);
+        HANDLE mmh = registerMMCSS(L"Pro Audio");
+
+        // Выдернутый кабель: read сразу возвращает false. Смена режима
+        // сигнала: кадры другой формы не проходят describe. И то и другое
+        // дольше LOST_MS (первый кадр — FIRST_MS) — источник потерян.
+        const int64_t LOST_MS = 1000, FIRST_MS = 5000;
+        int64_t lastGood = qpcNow();
+        bool    any      = false;
+        while (running_) {
+            Frame&    f = tb_.writeSlot();
+            const int k = static_cast<int>(&f - tb_.bufs.data());
+            if (pool_.ready() && !pool_.owns(f.data, k)) {
+                pool_.attach(f.data, k);
+                pool_.reclaim(tb_);
+            }
+            bool ok = cap_.read(f.data);
+            // Часы сэмпла DirectShow OpenCV наружу не отдаёт — только приём.
+            f.tDevice  = 0;
+            f.tReceive = qpcNow();
+            // Первый кадр или новая форма: кадр уже в буфере OpenCV и уходит
+            // как есть, в пул слоты переедут при следующей записи.
+            if (ok && !f.data.empty() && !poolFailed_ && !pool_.owns(f.data, k))
+                adoptShape(f.data);
+            if (ok && describe(f)) {
+                tb_.commitWrite();
+                lastGood = f.tReceive;
+                any      = true;
+                continue;
+            }
+            if (qpcToMs(qpcNow() - lastGood) > (any ? LOST_MS : FIRST_MS)) {
+                std::cerr << "[WARN] OpenCV capture stopped delivering frames\n";
+                lost_ = true;
+                break;
+            }
+            if (!ok) Sleep(5);
+        }
+        if (mmh) AvRevertMmThreadCharacteristics(mmh);
+    }
+
+    void adoptShape(const cv::Mat& m)
+    {
+        const bool first = !pool_.ready();
+        if (!pool_.allocate(m.rows, m.cols, m.type())) {
+            std::cerr << "[WARN] Frame pool allocation failed, using OpenCV buffers\n";
+            poolFailed_ = true;
+            return;
+        }
+        if (!first)
+            std::cout << "[INFO] Frame shape changed, frame pool reallocated\n";
+        else if (pool_.largePages())
+            std::cout << "[INFO] Frame pool on large pages\n";
+        else if (!pool_.locked())
+            std::cerr << "[WARN] Frame pool is not page-locked (VirtualLock failed)\n";
+    }
+
+    // Заполняет метаданные кадра. С CONVERT_RGB = 0 форма cv::Mat зависит от
+    // бэкенда (1xN CV_8UC1 или WxH CV_8UC2), поэтому трактуем его как блоб байт.
+    bool describe(Frame& f) const
+    {
+        if (f.data.empty()) return false;
+        f.format = format_;
+        if (format_ == PixelFormat::NV12) {
+            size_t bytes = f.data.total() * f.data.elemSize();
+            f.base     = f.data.ptr(0);
+            f.width    = width_;
+            f.height   = height_;
+            f.stride   = width_;
+            f.uv       = f.base + static_cast<size_t>(width_) * height_;
+            f.uvStride = width_;
+            return f.data.isContinuous() &&
+                   bytes >= static_cast<size_t>(width_) * height_ * 3 / 2;
+        }
+        if (format_ == PixelFormat::YUY2) {
+            size_t bytes = f.data.total() * f.data.elemSize();
+            f.base   = f.data.ptr(0);
+            f.width  = width_;
+            f.height = height_;
+            f.stride = width_ * 2;
+            return f.data.isContinuous() &&
+                   bytes >= static_cast<size_t>(f.stride) * height_;
+        }
+        f.width  = f.data.cols;
+        f.height = f.data.rows;
+        f.stride = static_cast<int>(f.data.step[0]);
+        f.base   = f.data.ptr(0);
+        return true;
+    }
+
+    cv::VideoCapture  cap_;
+    TripleBuffer&     tb_;
+    size_t            source_;              // ядро захвата: pinThread
+    std::atomic<bool> running_;
+    std::thread       captureThread_;
+    int               width_, height_;
+    PixelFormat       format_ = PixelFormat::BGR24;
+    FramePool         pool_;                // только поток захвата (и stop)
+    bool              poolFailed_ = false;
+};
+
+// ─── Поток захвата: Media Foundation ─────────────────────────────────────────
+//
+// IMFSourceReader в асинхронном режиме: сэмплы приходят в OnReadSample на
+// рабочем потоке MF (MMCSS "Pro Audio" через MF_READWRITE_MMCSS_CLASS) —
+// без своего цикла и без копии в cv::Mat. Сэмпл удерживается в слоте
+// TripleBuffer до переиспользования слота:
+//   - системная память → буфер залочен, рендерер читает прямо из него;
+//   - DXGI поверхность  → рендерер копирует её на GPU, CPU не трогает пиксели.
+// MF_SOURCE_READER_D3D_MANAGER привязан к ID3D11Device рендерера, поэтому
+// декодеры и процессоры MF выдают текстуры того же устройства.
+
+static std::string wideToUtf8(const wchar_t* w)
+{
+    int len = WideCharToMultiByte(CP_UTF8, 0, w, -1, nullptr, 0, nullptr, nullptr);
+    if (len <= 0) return {};
+    std::string s(len, '\0');
+    WideCharToMultiByte(CP_UTF8, 0, w, -1, &s[0], len, nullptr, nullptr);
+    s.pop_back();
+    return s;
+}
+
+// MF и DirectShow перечисляют камеры независимо: сначала проверяем тот же
+// индекс, затем ищем по FriendlyName.
+static IMFActivate* findMFDevice(const DeviceInfo& dev)
+{
+    IMFAttributes* attr = nullptr;
+    if (FAILED(MFCreateAttributes(&attr, 1))) return nullptr;
+    attr->SetGUID(MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE,
+                  MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_GUID);
+
+    IMFActivate** devs = nullptr;
+    UINT32        n    = 0;
+    HRESULT       hr   = MFEnumDeviceSources(attr, &devs, &n);
+    attr->Release();
+    if (FAILED(hr)) return nullptr;
+
+    auto nameOf = [&](UINT32 i) {
+        WCHAR* w = nullptr; UINT32 len = 0;
+        std::string name;
+        if (SUCCEEDED(devs[i]->GetAllocatedString(MF_DEVSOURCE_ATTRIBUTE_FRIENDLY_NAME,
+                                                  &w, &len))) {
+            name = wideToUtf8(w);
+            CoTaskMemFree(w);
+        }
+        return name;
+    };
+
+    IMFActivate* pick = nullptr;
+    if (dev.index >= 0 && static_cast<UINT32>(dev.index) < n && nameOf(dev.index) == dev.name)
+        pick = devs[dev.index];
+    for (UINT32 i = 0; i < n && !pick; ++i)
+        if (nameOf(i) == dev.name) pick = devs[i];
+
+    if (pick) pick->AddRef();
+    for (UINT32 i = 0; i < n; ++i) devs[i]->Release();
+    CoTaskMemFree(devs);
+    return pick;
+}
+
+// Источник по symbolic link из профиля: без MFEnumDeviceSources и
+// сравнения имён. nullptr — устройства с таким адресом сейчас нет.
+static IMFMediaSource* mfSourceFromLink(const std::wstring& link)
+{
+    IMFAttributes* attr = nullptr;
+    if (FAILED(MFCreateAttributes(&attr, 2))) return nullptr;
+    attr->SetGUID(MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE,
+                  MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_GUID);
+    attr->SetString(MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_SYMBOLIC_LINK, link.c_str());
+    IMFMediaSource* source = nullptr;
+    if (FAILED(MFCreateDeviceSource(attr, &source))) source = nullptr;
+    attr->Release();
+    return source;
+}
+
+class MFVideoStream;
+
+class MFReaderCallback : public IMFSourceReaderCallback {
+public:
+    explicit MFReaderCallback(MFVideoStream* owner) : owner_(owner) {}
+
+    STDMETHODIMP QueryInterface(REFIID iid, void** ppv) override
+    {
+        if (!ppv) return E_POINTER;
+        if (iid == __uuidof(IUnknown) || iid == __uuidof(IMFSourceReaderCallback)) {
+            *ppv = static_cast<IMFSourceReaderCallback*>(this);
+            AddRef();
+            return S_OK;
+        }
+        *ppv = nullptr;
+        return E_NOINTERFACE;
+    }
+    STDMETHODIMP_(ULONG) AddRef() override  { return ++refs_; }
+    STDMETHODIMP_(ULONG) Release() override
+    {
+        ULONG r = --refs_;
+        if (r == 0) delete this;
+        return r;
+    }
+
+    STDMETHODIMP OnReadSample(HRESULT hr, DWORD, DWORD flags, LONGLONG, IMFSample* s) override;
+    STDMETHODIMP OnFlush(DWORD) override;
+    STDMETHODIMP OnEvent(DWORD, IMFMediaEvent*) override { return S_OK; }
+
+private:
+    std::atomic<ULONG> refs_ { 1 };
+    MFVideoStream*     owner_;
+};
+
+class MFVideoStream : public CaptureSource {
+public:
+    MFVideoStream(TripleBuffer& tb, const ModeRequest& req)
+        : tb_(tb), req_(req), callback_(new MFReaderCallback(this))
+    {
+        flushed_ = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    }
+
+    ~MFVideoStream() override
+    {
+        stop();
+        callback_->Release();
+        if (flushed_) CloseHandle(flushed_);
+    }
+
+    // Открывает устройство и запускает первый ReadSample.
+    bool open(const DeviceInfo& dev, ID3D11Device* device)
+    {
+        HRESULT         hr     = S_OK;
+        IMFMediaSource* source = dev.link.empty() ? nullptr : mfSourceFromLink(dev.link);
+        if (source) {
+            link_ = dev.link;
+        } else {
+            IMFActivate* act = findMFDevice(dev);
+            if (!act) {
+                std::cerr << "[MF] Device not found: " << dev.name << "\n";
+                return false;
+            }
+            WCHAR* w = nullptr; UINT32 len = 0;
+            if (SUCCEEDED(act->GetAllocatedString(
+                    MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_SYMBOLIC_LINK, &w, &len))) {
+                link_ = w;
+                CoTaskMemFree(w);
+            }
+            hr = act->ActivateObject(IID_PPV_ARGS(&source));
+            act->Release();
+            if (FAILED(hr)) {
+                std::cerr << "[MF] ActivateObject failed: 0x" << std::hex << hr << std::dec << "\n";
+                return false;
+            }
+        }
+
+        UINT token = 0;
+        if (device && SUCCEEDED(MFCreateDXGIDeviceManager(&token, &devMgr_)))
+            devMgr_->ResetDevice(device, token);
+
+        IMFAttributes* attr = nullptr;
+        MFCreateAttributes(&attr, 4);
+        attr->SetUnknown(MF_SOURCE_READER_ASYNC_CALLBACK, callback_);
+        attr->SetUINT32(MF_READWRITE_ENABLE_HARDWARE_TRANSFORMS, TRUE);
+        attr->SetString(MF_READWRITE_MMCSS_CLASS, L"Pro Audio");
+        if (devMgr_) attr->SetUnknown(MF_SOURCE_READER_D3D_MANAGER, devMgr_);
+
+        // Ридер владеет источником и сам вызовет Shutdown при Release.
+        hr = MFCreateSourceReaderFromMediaSource(source, attr, &reader_);
+        attr->Release();
+        source->Release();
+        if (FAILED(hr)) {
+            std::cerr << "[MF] CreateSourceReader failed: 0x" << std::hex << hr << std::dec << "\n";
+            return false;
+        }
+
+        reader_->SetStreamSelection(MF_SOURCE_READER_ALL_STREAMS, FALSE);
+        reader_->SetStreamSelection(MF_SOURCE_READER_FIRST_VIDEO_STREAM, TRUE);
+        if (!negotiate()) return false;
+
+        running_ = true;
+        hr = reader_->ReadSample(MF_SOURCE_READER_FIRST_VIDEO_STREAM, 0,
+                                 nullptr, nullptr, nullptr, nullptr);
+        if (FAILED(hr)) { running_ = false; return false; }
+        return true;
+    }
+
+    int         width()  const override { return width_;  }
+    int         height() const override { return height_; }
+    PixelFormat format() const override { return format_; }
+    std::string fourcc() const override { return fourccToString(nativeFcc_); }
+    double      fps()    const override { return fps_; }
+    const char* backendName() const override { return "Media Foundation"; }
+    std::wstring deviceLink() const override { return link_; }
+
+    bool setUploadSlots(UploadSlots* slots) override
+    {
+        slots_.store(slots, std::memory_order_release);
+        return true;
+    }
+
+    void stop() override
+    {
+        if (!reader_) return;
+        {
+            std::lock_guard<std::mutex> lk(readMtx_);
+            running_ = false;
+        }
+        // Flush отменяет висящий ReadSample; ждём OnFlush и выхода из колбэка,
+        // после этого MF больше не пишет в TripleBuffer.
+        ResetEvent(flushed_);
+        if (SUCCEEDED(reader_->Flush(MF_SOURCE_READER_ALL_STREAMS)))
+            WaitForSingleObject(flushed_, 1000);
+        while (inCallback_.load() > 0) Sleep(1);
+
+        reader_->Release(); reader_ = nullptr;
+        for (auto& f : tb_.bufs) { f.releaseSample(); f.uploadSlot = -1; }
+        if (devMgr_) { devMgr_->Release(); devMgr_ = nullptr; }
+    }
+
+    void onSample(HRESULT hr, DWORD flags, IMFSample* sample)
+    {
+        // Ошибка ридера (устройство удалено), конец потока или новый тип на
+        // выходе (сменился режим сигнала — width_ / format_ устарели): дальше
+        // не читаем, источник переоткроется с новым согласованием. Новый тип
+        // выхода декодер MJPG объявляет и сам, с тем же размером и форматом
+        // (другой stride) — такой перечитываем и читаем дальше.
+        const DWORD LOST_FLAGS = MF_SOURCE_READERF_ERROR | MF_SOURCE_READERF_ENDOFSTREAM |
+                                 MF_SOURCE_READERF_CURRENTMEDIATYPECHANGED |
+                                 MF_SOURCE_READERF_NATIVEMEDIATYPECHANGED;
+        ++inCallback_;
+        if (SUCCEEDED(hr) && (flags & MF_SOURCE_READERF_CURRENTMEDIATYPECHANGED) &&
+            sameOutputType())
+            flags &= ~static_cast<DWORD>(MF_SOURCE_READERF_CURRENTMEDIATYPECHANGED);
+        // Колбэки идут из общего пула рабочих очередей MF (там же MFT декодер,
+        // ридеры других источников, запись): поток не закрепляем, он остаётся
+        // в наборе процесса по умолчанию.
+        if (SUCCEEDED(hr) && sample && !(flags & LOST_FLAGS)) {
+            Frame& f = tb_.writeSlot();
+            f.tReceive = qpcNow();
+            f.releaseSample();
+            UploadSlots* slots = slots_.load(std::memory_order_acquire);
+            if (slots) slots->reclaim(f);
+            UINT64 devTime = 0;
+            f.tDevice = SUCCEEDED(sample->GetUINT64(MFSampleExtension_DeviceReferenceSystemTime,
+                                                    &devTime)) ? hnsToQpc(devTime) : 0;
+            if (wrapSample(f, sample)) {
+                // Системный буфер — сразу в замапленный слот рендера, сэмпл
+                // возвращается в пул MF, не дожидаясь рендера.
+                if (slots && slots->store(f)) f.releaseSample();
+                tb_.commitWrite();
+            }
+        }
+        if (FAILED(hr) || (flags & LOST_FLAGS)) {
+            if (running_ && !lost_.exchange(true))
+                std::cerr << "[MF] Capture stream lost (hr 0x" << std::hex << hr
+                          << ", flags 0x" << flags << std::dec << ")\n";
+        } else {
+            std::lock_guard<std::mutex> lk(readMtx_);
+            if (running_)
+                reader_->ReadSample(MF_SOURCE_READER_FIRST_VIDEO_STREAM, 0,
+                                    nullptr, nullptr, nullptr, nullptr);
+        }
+        --inCallback_;
+    }
+
+    void onFlush() { SetEvent(flushed_); }
+
+private:
+    // Выбор режима — общий с OpenCV-бэкендом (pickMode). YUY2 / NV12 / P010
+    // идут без декодера. Для MJPG (многие карты дают 1080p60 и 4K30 только
+    // в нём — YUY2 не пролезает в USB) просим у ридера NV12: с
+    // ENABLE_HARDWARE_TRANSFORMS и D3D manager это DXVA декодер GPU, кадры
+    // приходят текстурами NV12. Без аппаратного MFT тот же NV12 выдаёт
+    // программный декодер в системную память, последний вариант — YUY2.
+    bool negotiate()
+    {
+        const DWORD stream = MF_SOURCE_READER_FIRST_VIDEO_STREAM;
+        std::vector<IMFMediaType*> types;
+        std::vector<VideoMode>     modes;
+        for (DWORD i = 0; ; ++i) {
+            IMFMediaType* mt = nullptr;
+            if (FAILED(reader_->GetNativeMediaType(stream, i, &mt))) break;
+            GUID   sub = GUID_NULL;
+            UINT32 w = 0, h = 0, num = 0, den = 1;
+            mt->GetGUID(MF_MT_SUBTYPE, &sub);
+            MFGetAttributeSize(mt, MF_MT_FRAME_SIZE, &w, &h);
+            MFGetAttributeRatio(mt, MF_MT_FRAME_RATE, &num, &den);
+            types.push_back(mt);
+            modes.push_back({ sub.Data1, static_cast<int>(w), static_cast<int>(h),
+                              den ? static_cast<double>(num) / den : 0.0 });
+        }
+        const int pick = pickMode(modes, req_);
+        IMFMediaType* best = (pick >= 0) ? types[pick] : nullptr;
+        for (IMFMediaType* mt : types) if (mt != best) mt->Release();
+        if (!best) { std::cerr << "[MF] No supported native media types\n"; return false; }
+
+        GUID sub = GUID_NULL;
+        best->GetGUID(MF_MT_SUBTYPE, &sub);
+        nativeFcc_ = sub.Data1;
+        HRESULT hr = reader_->SetCurrentMediaType(stream, nullptr, best);
+        if (SUCCEEDED(hr) && sub != MFVideoFormat_YUY2 && sub != MFVideoFormat_NV12 &&
+            sub != MFVideoFormat_P010) {
+            hr = E_FAIL;
+            for (const GUID& outSub : { MFVideoFormat_NV12, MFVideoFormat_YUY2 }) {
+                IMFMediaType* out = nullptr;
+                MFCreateMediaType(&out);
+                best->CopyAllItems(out);
+                out->SetGUID(MF_MT_SUBTYPE, outSub);
+                out->DeleteItem(MF_MT_DEFAULT_STRIDE);
+                out->DeleteItem(MF_MT_SAMPLE_SIZE);
+                hr = reader_->SetCurrentMediaType(stream, nullptr, out);
+                out->Release();
+                if (SUCCEEDED(hr)) break;
+            }
+        }
+        best->Release();
+        if (FAILED(hr)) {
+            std::cerr << "[MF] SetCurrentMediaType failed: 0x" << std::hex << hr << std::dec << "\n";
+            return false;
+        }
+
+        IMFMediaType* cur = nullptr;
+        if (FAILED(reader_->GetCurrentMediaType(stream, &cur))) return false;
+        GUID   outSub = GUID_NULL;
+        UINT32 w = 0, h = 0, lines = 0, num = 0, den = 1;
+        cur->GetGUID(MF_MT_SUBTYPE, &outSub);
+        frameSize(cur, w, h, lines);
+        MFGetAttributeRatio(cur, MF_MT_FRAME_RATE, &num, &den);
+        format_     = outputFormat(outSub);
+        width_      = static_cast<int>(w);
+        height_     = static_cast<int>(h);
+        planeLines_ = static_cast<int>(lines);
+        fps_        = den ? static_cast<double>(num) / den : 0.0;
+        stride_     = defaultStride(cur);
+        std::cout << "[MF] Mode: " << modeToString(modes[pick]) << " -> "
+                  << fourccToString(outSub.Data1) << "\n";
+        cur->Release();
+        return width_ > 0 && height_ > 0;
+    }
+
+    static PixelFormat outputFormat(const GUID& sub)
+    {
+        return (sub == MFVideoFormat_NV12) ? PixelFormat::NV12
+             : (sub == MFVideoFormat_P010) ? PixelFormat::P010 : PixelFormat::YUY2;
+    }
+
+    int defaultStride(IMFMediaType* mt) const
+    {
+        UINT32 w = 0, h = 0;
+        MFGetAttributeSize(mt, MF_MT_FRAME_SIZE, &w, &h);
+        return static_cast<int>(MFGetAttributeUINT32(
+            mt, MF_MT_DEFAULT_STRIDE, format_ == PixelFormat::NV12 ? w : w * 2));
+    }
+
+    // Видимый размер и число строк плоскости Y. Декодер может выровнять кадр
+    // (MF_MT_FRAME_SIZE 1920x1088) и отметить видимые 1080 строк апертурой;
+    // её смещение не учитываем — у декодеров оно нулевое.
+    static void frameSize(IMFMediaType* mt, UINT32& w, UINT32& h, UINT32& lines)
+    {
+        MFGetAttributeSize(mt, MF_MT_FRAME_SIZE, &w, &h);
+        lines = h;
+        MFVideoArea area = {};
+        if (SUCCEEDED(mt->GetBlob(MF_MT_MINIMUM_DISPLAY_APERTURE, reinterpret_cast<UINT8*>(&area),
+                                  sizeof(area), nullptr)) &&
+            area.Area.cx > 0 && area.Area.cy > 0 &&
+            static_cast<UINT32>(area.Area.cx) <= w && static_cast<UINT32>(area.Area.cy) <= h) {
+            w = static_cast<UINT32>(area.Area.cx);
+            h = static_cast<UINT32>(area.Area.cy);
+        }
+    }
+
+    // Строк Y до плоскости UV: по длине буфера (Y + UV — полторы плоскости
+    // Y), если она сходится, иначе по типу. Выравнивание высоты у системных
+    // буферов бывает и без отметки в типе.
+    int uvLines(DWORD len, int pitch) const
+    {
+        const size_t row = static_cast<size_t>(std::abs(pitch)) * 3;
+        if (row && len && static_cast<size_t>(len) * 2 % row == 0) {
+            const size_t lines = static_cast<size_t>(len) * 2 / row;
+            if (lines >= static_cast<size_t>(height_) && lines <= static_cast<size_t>(height_) + 64)
+                return static_cast<int>(lines);
+        }
+        return planeLines_;
+    }
+
+    // MF_SOURCE_READERF_CURRENTMEDIATYPECHANGED: тот же размер и формат —
+    // берём новый stride и остаёмся на потоке (колбэк ридера).
+    bool sameOutputType()
+    {
+        IMFMediaType* cur = nullptr;
+        if (FAILED(reader_->GetCurrentMediaType(MF_SOURCE_READER_FIRST_VIDEO_STREAM, &cur)))
+            return false;
+        GUID   sub = GUID_NULL;
+        UINT32 w = 0, h = 0, lines = 0;
+        cur->GetGUID(MF_MT_SUBTYPE, &sub);
+        frameSize(cur, w, h, lines);
+        const bool same = outputFormat(sub) == format_ && static_cast<int>(w) == width_ &&
+                          static_cast<int>(h) == height_;
+        if (same) {
+            stride_     = defaultStride(cur);
+            planeLines_ = static_cast<int>(lines);
+        }
+        cur->Release();
+        return same;
+    }
+
+    // Без копий: сэмпл удерживается в слоте, системный буфер остаётся залоченным.
+    bool wrapSample(Frame& f, IMFSample* s)
+    {
+        DWORD count = 0;
+        s->GetBufferCount(&count);
+        IMFMediaBuffer* buf = nullptr;
+        HRESULT hr = (count == 1) ? s->GetBufferByIndex(0, &buf)
+                                  : s->ConvertToContiguousBuffer(&buf);
+        if (FAILED(hr) || !buf) return false;
+
+        f.format = format_;
+        f.width  = width_;
+        f.height = height_;
+
+        IMFDXGIBuffer* dxgi = nullptr;
+        if (SUCCEEDED(buf->QueryInterface(IID_PPV_ARGS(&dxgi)))) {
+            dxgi->GetResource(IID_PPV_ARGS(&f.gpuTex));
+            dxgi->GetSubresourceIndex(&f.gpuSub);
+            dxgi->Release();
+            buf->Release();
+            if (!f.gpuTex) return false;
+            s->AddRef(); f.sample = s;
+            return true;
+        }
+
+        BYTE*  p     = nullptr;
+        BYTE*  start = nullptr;
+        LONG   pitch = 0;
+        DWORD  len   = 0;
+        // Lock2DSize отдаёт и длину буфера (по ней — строки Y), старый
+        // IMF2DBuffer — только шаг.
+        IMF2DBuffer2* b2 = nullptr;
+        IMF2DBuffer*  b1 = nullptr;
+        if (SUCCEEDED(buf->QueryInterface(IID_PPV_ARGS(&b2)))) {
+            if (SUCCEEDED(b2->Lock2DSize(MF2DBuffer_LockFlags_Read, &p, &pitch, &start, &len)))
+                f.buffer2d = b2;
+            else
+                b2->Release();
+        }
+        if (!f.buffer2d && SUCCEEDED(buf->QueryInterface(IID_PPV_ARGS(&b1)))) {
+            if (SUCCEEDED(b1->Lock2D(&p, &pitch)))
+                f.buffer2d = b1;
+            else
+                b1->Release();
+            len = 0;
+        }
+        if (f.buffer2d) {
+            f.stride = static_cast<int>(pitch);
+        } else {
+            if (FAILED(buf->Lock(&p, nullptr, &len))) { buf->Release(); return false; }
+            const DWORD need = static_cast<DWORD>(std::abs(stride_)) *
+                               (isPlanar(format_) ? planeLines_ * 3 / 2 : height_);
+            if (len < need) {
+                buf->Unlock(); buf->Release(); return false;
+            }
+            // Отрицательный stride — bottom-up: первая строка в конце буфера.
+            if (stride_ < 0) p += static_cast<size_t>(-stride_) * (height_ - 1);
+            f.stride = stride_;
+        }
+        f.base   = p;
+        f.buffer = buf;
+        // NV12 / P010 всегда top-down: UV сразу за плоскостью Y с тем же шагом,
+        // а в ней строк может быть больше видимых (1088 на 1080).
+        if (isPlanar(format_)) {
+            f.uv       = p + static_cast<size_t>(f.stride) * uvLines(len, f.stride);
+            f.uvStride = f.stride;
+        }
+        s->AddRef(); f.sample = s;
+        return true;
+    }
+
+    TripleBuffer&         tb_;
+    ModeRequest           req_;
+    MFReaderCallback*     callback_;
+    IMFSourceReader*      reader_  = nullptr;
+    IMFDXGIDeviceManager* devMgr_  = nullptr;
+    HANDLE                flushed_ = nullptr;
+    std::mutex            readMtx_;
+    std::atomic<bool>     running_ { false };
+    std::atomic<int>      inCallback_ { 0 };
+    std::atomic<UploadSlots*> slots_ { nullptr };
+    int                   width_ = 0, height_ = 0, stride_ = 0;
+    int                   planeLines_ = 0;       // строк плоскости Y (с выравниванием)
+    double                fps_ = 0.0;
+    uint32_t              nativeFcc_ = 0;
+    std::wstring          link_;
+    PixelFormat           format_ = PixelFormat::YUY2;   // формат на выходе ридера
+};
+
+STDMETHODIMP MFReaderCallback::OnReadSample(HRESULT hr, DWORD, DWORD flags,
+                                            LONGLONG, IMFSample* s)
+{
+    owner_->onSample(hr, flags, s);
+    return S_OK;
+}
+
+STDMETHODIMP MFReaderCallback::OnFlush(DWORD)
+{
+    owner_->onFlush();
+    return S_OK;
+}
+
+// ─── Синтетический источник (бенчмарк) ───────────────────────────────────────
+//
+// Заменяет устройство в --bench: тот же TripleBuffer, те же поля Frame, что у
+// реальных бэкендов. Кадры сгенерированы заранее (FRAMES штук, узор сдвигается
+// от кадра к кадру — меняется весь кадр; --bench-static — все одинаковые,
+// проверка --dirty) и отдаются без копий, как залоченные
+// сэмплы MF. tDevice — плановое время кадра, device->recv показывает джиттер
+// таймера. fps = 0 — без ограничения: следующий кадр сразу после того, как
+// рендер забрал предыдущий. mjpg — кадры хранятся JPEG и на каждом кадре
+// распаковываются cv::imdecode в BGR24 cv::Mat слота, как OpenCV делает с
+// MJPG устройства: стоимость декодирования попадает в device->recv и CPU.
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002   // Windows 10 1803+
+#endif
+
+class SyntheticSource : public CaptureSource {
+public:
+    static const int FRAMES = 4;
+
+    SyntheticSource(TripleBuffer& tb, int w, int h, PixelFormat fmt, double fps,
+                    bool still = false, bool mjpg = false)
+        : tb_(tb), width_(w & ~1), height_(isPlanar(fmt) ? h & ~1 : h),
+          format_(mjpg ? PixelFormat::BGR24 : fmt), fps_(fps), mjpg_(mjpg)
+    {
+        stride_ = width_ * (format_ == PixelFormat::NV12  ? 1
+                          : format_ == PixelFormat::BGR24 ? 3 : 2);
+        const size_t planes = static_cast<size_t>(stride_) * height_;
+        for (int k = 0; k < FRAMES; ++k) {
+            frames_[k].resize(isPlanar(format_) ? planes * 3 / 2 : planes);
+            generate(frames_[k].data(), still ? 0 : k * 8);
+            if (!mjpg_) continue;
+            // Узор BGR сжимается один раз, сырой кадр больше не нужен.
+            cv::imencode(".jpg", cv::Mat(height_, width_, CV_8UC3, frames_[k].data(), stride_),
+                         jpeg_[k]);
+            std::vector<uint8_t>().swap(frames_[k]);
+        }
+        thread_ = std::thread(&SyntheticSource::loop, this);
+    }
+
+    ~SyntheticSource() override { stop(); }
+
+    int         width()  const override { return width_;  }
+    int         height() const override { return height_; }
+    PixelFormat format() const override { return format_; }
+    double      fps()    const override { return fps_; }
+    const char* backendName() const override { return "Synthetic"; }
+
+    bool setUploadSlots(UploadSlots* slots) override
+    {
+        slots_.store(slots, std::memory_order_release);
+        return true;
+    }
+    std::string fourcc() const override
+    {
+        if (mjpg_) return "MJPG";
+        return format_ == PixelFormat::YUY2 ? "YUY2"
+             : format_ == PixelFormat::NV12 ? "NV12"
+             : format_ == PixelFormat::P010 ? "P010" : "BGR3";
+    }
+
+    void stop() override
+    {
+        running_ = false;
+        if (thread_.joinable()) thread_.join();
+        for (auto& f : tb_.bufs) {                          // буферы умирают с источником
+            f.base = f.uv = nullptr;
+            f.uploadSlot = -1;
+            f.data.release();
+        }
+    }
+
+private:
+    void generate(uint8_t* dst, int phase) const
+    {
+        for (int y = 0; y < height_; ++y) {
+            uint8_t* p = dst + static_cast<size_t>(y) * stride_;
+            if (format_ == PixelFormat::P010) {
+                // Тот же узор, 8 бит в старшем байте 16-битного отсчёта.
+                uint16_t* l = reinterpret_cast<uint16_t*>(p);
+                uint16_t* c = reinterpret_cast<uint16_t*>(
+                    dst + static_cast<size_t>(stride_) * height_ + static_cast<size_t>(y / 2) * stride_);
+                for (int x = 0; x < width_; ++x)
+                    l[x] = static_cast<uint16_t>((16 + ((x + y + phase) & 0xBF)) << 8);
+                if (y & 1) continue;
+                for (int x = 0; x < width_; x += 2) {
+                    c[x]     = static_cast<uint16_t>((128 + ((x >> 4) & 0x3F) - 32) << 8);
+                    c[x + 1] = static_cast<uint16_t>((128 + ((y >> 4) & 0x3F) - 32) << 8);
+                }
+            } else if (format_ == PixelFormat::NV12) {
+                uint8_t* c = dst + static_cast<size_t>(stride_) * height_
+                               + static_cast<size_t>(y / 2) * stride_;
+                for (int x = 0; x < width_; ++x)
+                    p[x] = static_cast<uint8_t>(16 + ((x + y + phase) & 0xBF));
+                if (y & 1) continue;
+                for (int x = 0; x < width_; x += 2) {
+                    c[x]     = static_cast<uint8_t>(128 + ((x >> 4) & 0x3F) - 32);
+                    c[x + 1] = static_cast<uint8_t>(128 + ((y >> 4) & 0x3F) - 32);
+                }
+            } else if (format_ == PixelFormat::YUY2) {
+                for (int x = 0; x < width_; x += 2, p += 4) {
+                    p[0] = static_cast<uint8_t>(16 + ((x + y + phase) & 0xBF));
+                    p[1] = static_cast<uint8_t>(128 + ((x >> 4) & 0x3F) - 32);
+                    p[2] = static_cast<uint8_t>(16 + ((x + 1 + y + phase) & 0xBF));
+                    p[3] = static_cast<uint8_t>(128 + ((y >> 4) & 0x3F) - 32);
+                }
+            } else {
+                for (int x = 0; x < width_; ++x, p += 3) {
+                    p[0] = static_cast<uint8_t>(x + phase);
+                    p[1] = static_cast<uint8_t>(y + phase);
+                    p[2] = static_cast<uint8_t>((x ^ y) + phase);
+                }
+            }
+        }
+    }
+
+    void loop()
+    {
+        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+        pinThread(ThreadRole::Capture);
+        HANDLE mmh = registerMMCSS(L"Pro Audio");
+
+        // Ждём таймером до ~1 мс до срока, остаток — спином.
+        HANDLE timer = CreateWaitableTimerExW(nullptr, nullptr,
+                                              CREATE_WAITABLE_TIMER_HIGH_RESOLUTION,
+                                              TIMER_ALL_ACCESS);
+        if (!timer) timer = CreateWaitableTimerW(nullptr, TRUE, nullptr);
+
+        const int64_t period = fps_ > 0.0
+                             ? static_cast<int64_t>(qpcFrequency() / fps_) : 0;
+        const int64_t spin   = qpcFrequency() / 1000;
+        int64_t deadline = qpcNow();
+        for (uint64_t n = 0; running_; ++n) {
+            if (period) {
+                deadline += period;
+                int64_t left = deadline - qpcNow();
+                if (left > spin && timer) {
+                    LARGE_INTEGER due;
+                    due.QuadPart = -((left - spin) * 10000000LL / qpcFrequency());
+                    SetWaitableTimer(timer, &due, 0, nullptr, nullptr, FALSE);
+                    WaitForSingleObject(timer, INFINITE);
+                }
+                while (qpcNow() < deadline) YieldProcessor();
+            } else {
+                while (running_ && (tb_.middle.load(std::memory_order_acquire) &
+                                    TripleBuffer::FRESH))
+                    SwitchToThread();
+                deadline = qpcNow();
+            }
+
+            Frame& f   = tb_.writeSlot();
+            UploadSlots* slots = slots_.load(std::memory_order_acquire);
+            if (slots) slots->reclaim(f);
+            f.format   = format_;
+            f.width    = width_;
+            f.height   = height_;
+            f.stride   = stride_;
+            f.base     = frames_[n % FRAMES].data();
+            if (mjpg_) {
+                // Тот же BGR24 cv::Mat слота, что у cap_.read: после первого
+                // кадра imdecode пишет в уже выделенную память.
+                cv::imdecode(jpeg_[n % FRAMES], cv::IMREAD_COLOR, &f.data);
+                f.base   = f.data.data;
+                f.stride = static_cast<int>(f.data.step);
+            }
+            f.uv       = isPlanar(format_)
+                       ? f.base + static_cast<size_t>(stride_) * height_ : nullptr;
+            f.uvStride = stride_;
+            f.tDevice  = deadline;
+            f.tReceive = qpcNow();
+            if (slots) slots->store(f);
+            tb_.commitWrite();
+        }
+        if (timer) CloseHandle(timer);
+        if (mmh) AvRevertMmThreadCharacteristics(mmh);
+    }
+
+    TripleBuffer&        tb_;
+    std::atomic<bool>    running_ { true };
+    std::atomic<UploadSlots*> slots_ { nullptr };
+    std::thread          thread_;
+    int                  width_, height_, stride_ = 0;
+    PixelFormat          format_;
+    double               fps_;
+    bool                 mjpg_;
+    std::vector<uint8_t> frames_[FRAMES];
+    std::vector<uint8_t> jpeg_[FRAMES];                 // mjpg: сжатые кадры
+};
+
+// CPU время (user + kernel), мс.
+static double fileTimeMs(const FILETIME& t)
+{
+    return ((static_cast<uint64_t>(t.dwHighDateTime) << 32) | t.dwLowDateTime) / 10000.0;
+}
+
+static double processCpuMs()
+{
+    FILETIME c, e, k, u;
+    GetProcessTimes(GetCurrentProcess(), &c, &e, &k, &u);
+    return fileTimeMs(k) + fileTimeMs(u);
+}
+
+static double threadCpuMs()
+{
+    FILETIME c, e, k, u;
+    GetThreadTimes(GetCurrentThread(), &c, &e, &k, &u);
+    return fileTimeMs(k) + fileTimeMs(u);
+}
+
+// Итог --bench. Поля плоские и стабильные — отчёты разных машин и сборок
+// сравниваются скриптом.
+struct BenchReport {
+    int         width = 0, height = 0;
+    std::string format;
+    double      targetFps   = 0.0;
+    std::string upload, kernel, scale, pacing;
+    int         stripes     = 1;
+    bool        vsync       = false;
+    double      seconds     = 0.0;
+    uint64_t    captured    = 0, presented = 0;
+    double      processCpuMs = 0.0, renderCpuMs = 0.0;  // суммарно за прогон
+    uint64_t    uploadBytes = 0;
+    int64_t     uploadTicks = 0;
+    double      gpuMsSum    = 0.0, gpuMsMax = 0.0;       // проходы видео на GPU
+    uint64_t    gpuSamples  = 0;
+    bool        dirty       = false;                     // --dirty
+    uint64_t    tilesUploaded = 0, tilesTotal = 0, presentsSkipped = 0;
+    bool        captureSlots = false;                    // кадры пишет поток захвата
+    uint64_t    slotFrames   = 0, slotMisses = 0;
+    double      firstPresentMs = 0.0;                    // от старта процесса
+    uint64_t    pathDirect = 0, pathComposed = 0;        // проверки PresentPath
+};
+
+static void writeBenchReport(std::ostream& os, const BenchReport& r, const LatencyStats& lat)
+{
+    const double frames = r.presented ? static_cast<double>(r.presented) : 1.0;
+    const double upSec  = qpcToMs(r.uploadTicks) / 1000.0;
+    char buf[160];
+    auto num = [](const char* fmt, double v) {
+        char t[32];
+        snprintf(t, sizeof(t), fmt, v);
+        return std::string(t);
+    };
+
+    os << "{\n"
+       << "  \"source\": { \"width\": " << r.width << ", \"height\": " << r.height
+       << ", \"format\": \"" << r.format << "\", \"fps\": " << num("%.3f", r.targetFps) << " },\n"
+       << "  \"renderer\": { \"upload\": \"" << r.upload << "\", \"kernel\": \"" << r.kernel
+       << "\", \"stripes\": " << r.stripes << ", \"scale\": \"" << r.scale
+       << "\", \"vsync\": " << (r.vsync ? "true" : "false")
+       << ", \"pacing\": \"" << r.pacing << "\" },\n"
+       << "  \"seconds\": " << num("%.3f", r.seconds) << ",\n"
+       << "  \"first_present_ms\": " << num("%.1f", r.firstPresentMs) << ",\n"
+       << "  \"frames\": { \"captured\": " << r.captured << ", \"presented\": " << r.presented
+       << ", \"dropped\": " << lat.dropped << " },\n"
+       << "  \"fps\": { \"capture\": " << num("%.2f", r.captured / r.seconds)
+       << ", \"render\": " << num("%.2f", r.presented / r.seconds) << " },\n"
+       << "  \"cpu_ms_per_frame\": { \"process\": " << num("%.4f", r.processCpuMs / frames)
+       << ", \"render_thread\": " << num("%.4f", r.renderCpuMs / frames) << " },\n"
+       << "  \"upload_gbps\": "
+       << num("%.3f", upSec > 0.0 ? r.uploadBytes / upSec / 1e9 : 0.0) << ",\n"
+       << "  \"gpu_ms_per_frame\": { \"avg\": "
+       << num("%.4f", r.gpuSamples ? r.gpuMsSum / r.gpuSamples : 0.0)
+       << ", \"max\": " << num("%.4f", r.gpuMsMax) << ", \"samples\": " << r.gpuSamples << " },\n"
+       << "  \"dirty\": { \"enabled\": " << (r.dirty ? "true" : "false")
+       << ", \"tiles_uploaded\": " << r.tilesUploaded << ", \"tiles_total\": " << r.tilesTotal
+       << ", \"presents_skipped\": " << r.presentsSkipped << " },\n"
+       << "  \"capture_slots\": { \"enabled\": " << (r.captureSlots ? "true" : "false")
+       << ", \"frames\": " << r.slotFrames << ", \"misses\": " << r.slotMisses << " },\n"
+       << "  \"present_path\": { \"direct\": " << r.pathDirect
+       << ", \"composed\": " << r.pathComposed << " },\n"
+       << "  \"latency_ms\": {";
+    bool first = true;
+    for (int s = 0; s < LatencyStats::STAGE_COUNT; ++s) {
+        const LatencyStats::Summary sum = lat.session(s);
+        if (!sum.n) continue;
+        snprintf(buf, sizeof(buf),
+                 "%s\n    \"%s\": { \"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f, \"samples\": %d }",
+                 first ? "" : ",", LatencyStats::stageName(s), sum.p50, sum.p99, sum.max, sum.n);
+        os << buf;
+        first = false;
+    }
+    os << (first ? "" : "\n  ") << "}\n}\n";
+}
+
+// ─── Восстановление захвата ──────────────────────────────────────────────────
+//
+// Источник, потерявший устройство (CaptureSource::lost, или WM_DEVICECHANGE
+// и нет кадров), переоткрывается в фоне: stop старого (DirectShow может
+// повиснуть в read), затем open с тем же ModeRequest — режим и формат
+// согласуются заново, в тот же TripleBuffer. Рендер тем временем не трогает
+// этот TripleBuffer (stop освобождает его кадры), показывает последний кадр
+// и опрашивает клавиши. Попытки — раз в RETRY_MS и сразу по WM_DEVICECHANGE.
+// cancel ждёт поток не дольше CANCEL_MS: застрявший в stop / open драйвера
+// поток бросается вместе со своим состоянием (Shared), источник, открытый
+// им поздно, он же и закрывает — выход и пересоздание рендера не висят.
+class Reconnector {
+public:
+    using OpenFn = std::function<std::unique_ptr<CaptureSource>()>;
+    static constexpr DWORD RETRY_MS  = 500;
+    static constexpr DWORD CANCEL_MS = 2000;
+    static constexpr int   STALL_PERIODS = 5;   // без кадров после WM_DEVICECHANGE
+
+    int64_t lostAt   = 0;       // QPC потери — от него меряется восстановление
+    int     attempts = 0;       // open за последнее восстановление
+
+    Reconnector() = default;
+    ~Reconnector() { cancel(); }
+    Reconnector(const Reconnector&)            = delete;
+    Reconnector& operator=(const Reconnector&) = delete;
+
+    bool busy() const { return thread_.joinable(); }
+
+    void begin(std::unique_ptr<CaptureSource> old, OpenFn open)
+    {
+        lostAt   = qpcNow();
+        attempts = 0;
+        shared_  = std::make_shared<Shared>();
+        thread_  = std::thread(&Reconnector::loop, shared_, std::move(old), std::move(open));
+    }
+
+    void poke() { if (shared_) SetEvent(shared_->wake); }
+
+    // Открытый источник или nullptr, пока попытки идут.
+    std::unique_ptr<CaptureSource> take()
+    {
+        if (!shared_) return nullptr;
+        std::unique_ptr<CaptureSource> c;
+        {
+            std::lock_guard<std::mutex> lock(shared_->mutex);
+            c = std::move(shared_->ready);
+        }
+        if (c) { thread_.join(); attempts = shared_->attempts; }
+        return c;
+    }
+
+    void cancel()
+    {
+        if (!thread_.joinable()) return;
+        shared_->cancel = true;
+        SetEvent(shared_->wake);
+        if (WaitForSingleObject(thread_.native_handle(), CANCEL_MS) == WAIT_OBJECT_0) {
+            thread_.join();
+        } else {
+            std::cerr << "[WARN] Capture reopen is stuck in the driver, abandoning it\n";
+            thread_.detach();
+        }
+        std::lock_guard<std::mutex> lock(shared_->mutex);
+        shared_->ready.reset();
+    }
+
+private:
+    // Всё, что трогает поток: переживает Reconnector, если поток брошен.
+    struct Shared {
+        std::mutex                     mutex;       // ready
+        std::unique_ptr<CaptureSource> ready;
+        std::atomic<bool>              cancel { false };
+        std::atomic<int>               attempts { 0 };
+        HANDLE                         wake = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+        ~Shared() { if (wake) CloseHandle(wake); }
+    };
+
+    static void loop(std::shared_ptr<Shared> s, std::unique_ptr<CaptureSource> old, OpenFn open)
+    {
+        CoInitializeEx(nullptr, COINIT_MULTITHREADED);    // DirectShow и MF
+        pinThread(ThreadRole::Helper);
+        if (old) old->stop();
+        old.reset();
+        while (!s->cancel) {
+            ++s->attempts;
+            std::unique_ptr<CaptureSource> c = open();
+            if (c && c->width() > 0 && !c->lost()) {
+                std::lock_guard<std::mutex> lock(s->mutex);
+                if (!s->cancel) s->ready = std::move(c);
+                break;
+            }
+            c.reset();
+            WaitForSingleObject(s->wake, RETRY_MS);
+        }
+        CoUninitialize();
+    }
+
+    std::thread             thread_;
+    std::shared_ptr<Shared> shared_;
+};
+
+// ─── BGR → BGRA (SIMD) ───────────────────────────────────────────────────────
+//
+// 24 → 32 бит прямо в mapped.pData, по строке за вызов (RowPitch соблюдает
+// вызывающий). Ядро выбирается один раз по CPUID:
+//   AVX2  — 32 пикселя за итерацию: vpermd раскладывает 24 байта по двум
+//           128-битным lane'ам, vpshufb вставляет пустой байт, OR alpha;
+//   SSSE3 — 16 пикселей: 3 загрузки по 16 байт, palignr + pshufb;
+//   scalar — хвост строки и CPU без SSSE3.
+// Загрузки не выходят за 3*n байт исходной строки.
+
+using BgrToBgraFn = void (*)(const uint8_t* src, uint8_t* dst, int n);
+
+static void bgrToBgraScalar(const uint8_t* src, uint8_t* dst, int n)
+{
+    for (int i = 0; i < n; ++i, src += 3, dst += 4) {
+        uint32_t v = 0xFF000000u | (uint32_t(src[2]) << 16) |
+                     (uint32_t(src[1]) << 8) | src[0];
+        memcpy(dst, &v, 4);
+    }
+}
+
+static void bgrToBgraSSSE3(const uint8_t* src, uint8_t* dst, int n)
+{
+    const __m128i mask  = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1,
+                                        6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000u));
+    int i = 0;
+    for (; i + 16 <= n; i += 16, src += 48, dst += 64) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16));
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 32));
+        __m128i p0 = a;
+        __m128i p1 = _mm_alignr_epi8(b, a, 12);
+        __m128i p2 = _mm_alignr_epi8(c, b, 8);
+        __m128i p3 = _mm_srli_si128(c, 4);
+        __m128i* d = reinterpret_cast<__m128i*>(dst);
+        _mm_storeu_si128(d + 0, _mm_or_si128(_mm_shuffle_epi8(p0, mask), alpha));
+        _mm_storeu_si128(d + 1, _mm_or_si128(_mm_shuffle_epi8(p1, mask), alpha));
+        _mm_storeu_si128(d + 2, _mm_or_si128(_mm_shuffle_epi8(p2, mask), alpha));
+        _mm_storeu_si128(d + 3, _mm_or_si128(_mm_shuffle_epi8(p3, mask), alpha));
+    }
+    bgrToBgraScalar(src, dst, n - i);
+}
+
+static void bgrToBgraAVX2(const uint8_t* src, uint8_t* dst, int n)
+{
+    // lane 0 = байты 0..15, lane 1 = байты 12..27 исходной группы из 8 пикселей
+    const __m256i perm  = _mm256_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6);
+    const __m256i mask  = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1,
+                                           6, 7, 8, -1, 9, 10, 11, -1,
+                                           0, 1, 2, -1, 3, 4, 5, -1,
+                                           6, 7, 8, -1, 9, 10, 11, -1);
+    const __m256i alpha = _mm256_set1_epi32(static_cast<int>(0xFF000000u));
+    auto group = [&](const uint8_t* s, uint8_t* d) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s));
+        v = _mm256_permutevar8x32_epi32(v, perm);
+        v = _mm256_or_si256(_mm256_shuffle_epi8(v, mask), alpha);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(d), v);
+    };
+    int i = 0;
+    // Последняя 32-байтная загрузка группы читает 8 байт сверх её 24 байт.
+    for (; i + 35 <= n; i += 32, src += 96, dst += 128) {
+        group(src,      dst);
+        group(src + 24, dst + 32);
+        group(src + 48, dst + 64);
+        group(src + 72, dst + 96);
+    }
+    bgrToBgraSSSE3(src, dst, n - i);
+}
+
+struct BgrToBgraKernel {
+    const char* name;
+    BgrToBgraFn fn;
+};
+
+static int cpuSimdLevel()   // 0 — scalar, 1 — SSSE3, 2 — AVX2
+{
+    int r[4] = {};
+    __cpuid(r, 0);
+    const int maxLeaf = r[0];
+    __cpuid(r, 1);
+    const bool ssse3   = (r[2] & (1 << 9))  != 0;
+    const bool osxsave = (r[2] & (1 << 27)) != 0;
+    const bool avx     = (r[2] & (1 << 28)) != 0;
+    bool avx2 = false;
+    if (maxLeaf >= 7 && osxsave && avx && (_xgetbv(0) & 0x6) == 0x6) {
+        __cpuidex(r, 7, 0);
+        avx2 = (r[1] & (1 << 5)) != 0;
+    }
+    return avx2 ? 2 : (ssse3 ? 1 : 0);
+}
+
+static const BgrToBgraKernel s_bgrKernels[] = {
+    { "scalar", bgrToBgraScalar },
+    { "ssse3",  bgrToBgraSSSE3  },
+    { "avx2",   bgrToBgraAVX2   },
+};
+
+// forced: -1 — авто по CPUID, иначе индекс в s_bgrKernels (не выше поддерживаемого).
+static const BgrToBgraKernel& bgrToBgraKernel(int forced = -1)
+{
+    static const int level = cpuSimdLevel();
+    int idx = (forced < 0) ? level : (std::min)(forced, level);
+    return s_bgrKernels[idx];
+}
+
+// Микробенчмарк (--bench-convert): все доступные ядра на кадре WxH с тем же
+// RowPitch, что даёт драйвер (выравнивание 64), + сверка со scalar.
+static int runConvertBenchmark(int w, int h)
+{
+    const size_t srcStep = static_cast<size_t>(w) * 3;
+    const size_t dstStep = (static_cast<size_t>(w) * 4 + 63) & ~size_t(63);
+    std::vector<uint8_t> src(srcStep * h), ref(dstStep * h), dst(dstStep * h);
+    uint32_t seed = 0x12345678u;
+    for (auto& b : src) { seed = seed * 1664525u + 1013904223u; b = uint8_t(seed >> 24); }
+    for (int y = 0; y < h; ++y)
+        bgrToBgraScalar(&src[y * srcStep], &ref[y * dstStep], w);
+
+    std::cout << "\n" << UI_TOP << "\n";
+    uiCenter("BGR -> BGRA kernel benchmark");
+    std::cout << UI_SEP << "\n";
+    uiLine(std::to_string(w) + "x" + std::to_string(h) + ", GB/s = (read + write) bytes");
+    std::cout << UI_SEP << "\n";
+
+    const int level = cpuSimdLevel();
+    for (int k = 0; k <= level; ++k) {
+        const BgrToBgraKernel& kern = s_bgrKernels[k];
+        auto pass = [&] {
+            for (int y = 0; y < h; ++y)
+                kern.fn(&src[y * srcStep], &dst[y * dstStep], w);
+        };
+        pass();
+        bool ok = true;
+        for (int y = 0; y < h && ok; ++y)
+            ok = memcmp(&dst[y * dstStep], &ref[y * dstStep], static_cast<size_t>(w) * 4) == 0;
+
+        int  frames = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        auto t1 = t0;
+        do { pass(); ++frames; t1 = std::chrono::steady_clock::now(); }
+        while (t1 - t0 < std::chrono::milliseconds(500));
+
+        double sec  = std::chrono::duration<double>(t1 - t0).count();
+        double gbps = (double)(srcStep + static_cast<size_t>(w) * 4) * h * frames / sec / 1e9;
+        char line[96];
+        snprintf(line, sizeof(line), "%-7s %7.2f GB/s  %6.3f ms/frame  %s",
+                 kern.name, gbps, sec * 1000.0 / frames, ok ? "ok" : "MISMATCH");
+        uiLine(line);
+    }
+    uiLine(std::string("Auto-selected: ") + bgrToBgraKernel().name);
+    std::cout << UI_BOT << "\n\n";
+    return 0;
+}
+
+// ─── Полосовая загрузка: пул потоков ─────────────────────────────────────────
+//
+// На 1440p/4K или 120 fps построчная конвертация одним потоком не влезает в
+// бюджет кадра. Mapped subresource делится на горизонтальные полосы, полосы
+// разбирают постоянные воркеры и сам поток рендера. Воркеры спят в
+// WaitOnAddress (без событий и мьютексов), поток рендера после своей полосы
+// коротко крутится, потом тоже засыпает до последней полосы.
+// Воркеры — на свободные P-ядра (ThreadRole::Upload), не на ядра захвата и
+// рендера.
+
+class StripePool {
+public:
+    using Job = void (*)(void* ctx, int y0, int y1);
+
+    ~StripePool() { stop(); }
+
+    void start(int workers)
+    {
+        stop();
+        quit_ = false;
+        // Поколение фиксируем до старта потоков, иначе первый run() мог бы
+        // проскочить мимо воркера, который ещё не дошёл до WaitOnAddress.
+        const uint32_t seen = generation_.load(std::memory_order_acquire);
+        for (int i = 0; i < workers; ++i)
+            threads_.emplace_back([this, seen] {
+                pinThread(ThreadRole::Upload);
+                SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+                workerLoop(seen);
+            });
+    }
+
+    void stop()
+    {
+        if (threads_.empty()) return;
+        quit_ = true;
+        generation_.fetch_add(1, std::memory_order_release);
+        WakeByAddressAll(&generation_);
+        for (auto& t : threads_) t.join();
+        threads_.clear();
+    }
+
+    int workers() const { return static_cast<int>(threads_.size()); }
+
+    // Выполняет job по полосам [y0, y1) строк 0..rows и возвращается, когда
+    // все полосы готовы.
+    void run(int rows, Job job, void* ctx)
+    {
+        const int n = workers() + 1;
+        job_ = job; ctx_ = ctx; rows_ = rows; stripes_ = n;
+        next_.store(0, std::memory_order_relaxed);
+        pending_.store(workers(), std::memory_order_relaxed);
+        generation_.fetch_add(1, std::memory_order_release);
+        WakeByAddressAll(&generation_);
+
+        runStripes();
+
+        int p = pending_.load(std::memory_order_acquire);
+        for (int spin = 0; p != 0 && spin < 4000; ++spin) {
+            _mm_pause();
+            p = pending_.load(std::memory_order_acquire);
+        }
+        while (p != 0) {
+            WaitOnAddress(&pending_, &p, sizeof(p), INFINITE);
+            p = pending_.load(std::memory_order_acquire);
+        }
+    }
+
+private:
+    void runStripes()
+    {
+        for (int s; (s = next_.fetch_add(1, std::memory_order_relaxed)) < stripes_; ) {
+            int y0 = static_cast<int>(static_cast<long long>(rows_) * s / stripes_);
+            int y1 = static_cast<int>(static_cast<long long>(rows_) * (s + 1) / stripes_);
+            job_(ctx_, y0, y1);
+        }
+    }
+
+    void workerLoop(uint32_t seen)
+    {
+        for (;;) {
+            uint32_t g = generation_.load(std::memory_order_acquire);
+            while (g == seen) {
+                WaitOnAddress(&generation_, &seen, sizeof(seen), INFINITE);
+                g = generation_.load(std::memory_order_acquire);
+            }
+            seen = g;
+            if (quit_) return;
+            runStripes();
+            if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                WakeByAddressSingle(&pending_);
+        }
+    }
+
+    std::vector<std::thread> threads_;
+    std::atomic<uint32_t>    generation_ { 0 };
+    std::atomic<int>         pending_    { 0 };
+    std::atomic<int>         next_       { 0 };
+    std::atomic<bool>        quit_       { false };
+    Job                      job_     = nullptr;
+    void*                    ctx_     = nullptr;
+    int                      rows_    = 0;
+    int                      stripes_ = 0;
+};
+
+// ─── Грязные тайлы ───────────────────────────────────────────────────────────
+//
+// Источник — рабочий стол, большую часть времени статичный. С --dirty кадр
+// делится на тайлы 64x64 и по каждому считается 64-битный хеш всех его байт
+// (с плоскостью UV у NV12 / P010). Загружаются только тайлы, хеш которых
+// изменился; кадр без изменений не рисуется и не уходит в Present.
+// Хеш — две независимые цепочки SSE4.2 crc32 (8 байт за инструкцию на каждую),
+// без SSE4.2 — 64-битный FNV по словам.
+
+static const int DIRTY_TILE = 64;
+
+using TileHashFn = uint64_t (*)(const uint8_t* p, size_t n, uint64_t h);
+
+static uint64_t tileHashScalar(const uint8_t* p, size_t n, uint64_t h)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        h = (h ^ w) * 1099511628211ull;
+    }
+    for (; i < n; ++i) h = (h ^ p[i]) * 1099511628211ull;
+    return h;
+}
+
+static uint64_t tileHashCrc(const uint8_t* p, size_t n, uint64_t h)
+{
+    uint64_t a = static_cast<uint32_t>(h), b = h >> 32;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        uint64_t w0, w1;
+        memcpy(&w0, p + i, 8);
+        memcpy(&w1, p + i + 8, 8);
+        a = _mm_crc32_u64(a, w0);
+        b = _mm_crc32_u64(b, w1);
+    }
+    for (; i < n; ++i) a = _mm_crc32_u8(static_cast<uint32_t>(a), p[i]);
+    return (b << 32) | static_cast<uint32_t>(a);
+}
+
+static TileHashFn tileHashKernel()
+{
+    int r[4] = {};
+    __cpuid(r, 1);
+    return (r[2] & (1 << 20)) ? tileHashCrc : tileHashScalar;   // SSE4.2
+}
+
+// Байт на пиксель в строке Y (и в строке UV у NV12 / P010).
+static int bytesPerPixel(PixelFormat f)
+{
+    return f == PixelFormat::BGR24 ? 3 : f == PixelFormat::NV12 ? 1 : 2;
+}
+
+struct DirtyTiles {
+    int                   cols = 0, rows = 0;
+    int                   width = 0, height = 0;
+    PixelFormat           format = PixelFormat::BGR24;
+    std::vector<uint64_t> hash;                 // содержимое текстуры
+    std::vector<uint64_t> next;                 // нового кадра
+    int                   dirtyCount = 0;
+    bool                  valid = false;        // hash соответствует текстуре
+    TileHashFn            fn = tileHashKernel();
+    const Frame*          frame = nullptr;      // на время hashRows
+
+    void reset(int w, int h, PixelFormat f)
+    {
+        width = w; height = h; format = f;
+        cols = (w + DIRTY_TILE - 1) / DIRTY_TILE;
+        rows = (h + DIRTY_TILE - 1) / DIRTY_TILE;
+        hash.assign(static_cast<size_t>(cols) * rows, 0);
+        next.assign(hash.size(), 0);
+        valid = false;
+    }
+
+    bool matches(const Frame& f) const
+    {
+        return f.width == width && f.height == height && f.format == format;
+    }
+
+    bool isDirty(int tx, int ty) const
+    {
+        const size_t i = static_cast<size_t>(ty) * cols + tx;
+        return !valid || next[i] != hash[i];
+    }
+
+    // Строки тайлов [r0, r1) → next. Вызывается из StripePool.
+    static void hashRows(void* p, int r0, int r1)
+    {
+        DirtyTiles&  d   = *static_cast<DirtyTiles*>(p);
+        const Frame& f   = *d.frame;
+        const int    bpp = bytesPerPixel(f.format);
+        for (int ty = r0; ty < r1; ++ty) {
+            const int y0 = ty * DIRTY_TILE, y1 = (std::min)(y0 + DIRTY_TILE, f.height);
+            for (int tx = 0; tx < d.cols; ++tx) {
+                const int    x0 = tx * DIRTY_TILE, x1 = (std::min)(x0 + DIRTY_TILE, f.width);
+                const size_t off = static_cast<size_t>(x0) * bpp;
+                const size_t n   = static_cast<size_t>(x1 - x0) * bpp;
+                uint64_t h = 0x9E3779B97F4A7C15ull;
+                for (int y = y0; y < y1; ++y) h = d.fn(f.row(y) + off, n, h);
+                if (isPlanar(f.format))
+                    for (int y = y0 / 2; y < (y1 + 1) / 2 && y < f.height / 2; ++y)
+                        h = d.fn(f.uvRow(y) + off, n, h);
+                d.next[static_cast<size_t>(ty) * d.cols + tx] = h;
+            }
+        }
+    }
+
+    int countDirty()
+    {
+        dirtyCount = 0;
+        for (int ty = 0; ty < rows; ++ty)
+            for (int tx = 0; tx < cols; ++tx)
+                dirtyCount += isDirty(tx, ty);
+        return dirtyCount;
+    }
+
+    // Тайлы next загружены в текстуру.
+    void commit() { hash.swap(next); valid = true; }
+};
+
+// ─── Шейдеры: варианты и байткод ─────────────────────────────────────────────
+//
+// Исходники — shaders\*.hlsl. Каждый вариант (программа × формат × матрица ×
+// фильтр масштабирования) build_shaders.cmd заранее компилирует fxc в байткод
+// и сводит в таблицу shaders/compiled/all.h, которая вшивается в exe: на
+// старте ни D3DCompile, ни загрузки d3dcompiler_47.dll (она delay-load).
+//
+// Без all.h — режим разработчика: вариант компилируется из shaders\*.hlsl при
+// первом запросе и пишется в shader_cache.bin вместе с хешем исходника и
+// defines; следующий запуск берёт байткод из кеша, пока .hlsl не изменится.
+
+struct EmbeddedShader { const char* name; const BYTE* code; size_t size; };
+
+#if __has_include("shaders/compiled/all.h")
+#include "shaders/compiled/all.h"
+#else
+static const EmbeddedShader s_embeddedShaders[] = { { nullptr, nullptr, 0 } };
+#endif
+
+static const char* SHADER_DIR        = "shaders\\";
+static const char* SHADER_CACHE_FILE = "shader_cache.bin";
+static const DWORD SHADER_CACHE_MAGIC = 0x31434853; // "SHC1"
+
+enum class ShaderProgram { FullscreenVS, VideoPS, ScalePS, OverlayVS, OverlayPS };
+
+struct ShaderKey {
+    ShaderProgram program = ShaderProgram::VideoPS;
+    PixelFormat   format  = PixelFormat::BGR24;   // только VideoPS
+    bool          pq      = false;                // OverlayPS: HDR10 swap chain
+    ScaleMode     scaler  = ScaleMode::Bilinear;  // только ScalePS
+    bool          axisY   = false;                // ScalePS: вертикальный проход
+};
+
+// Имя варианта: символ g_<name> в all.h и ключ записи в shader_cache.bin.
+// Должно совпадать с build_shaders.cmd.
+static std::string shaderName(const ShaderKey& k)
+{
+    switch (k.program) {
+    case ShaderProgram::FullscreenVS: return "fullscreen_vs";
+    case ShaderProgram::OverlayVS:    return "overlay_vs";
+    case ShaderProgram::OverlayPS:    return k.pq ? "overlay_ps_pq" : "overlay_ps";
+    case ShaderProgram::ScalePS:
+        if (k.scaler == ScaleMode::Bilinear) return "scale_ps_bilinear";
+        return std::string("scale_ps_") + scaleModeName(k.scaler) + (k.axisY ? "_y" : "_x");
+    default: break;
+    }
+    static const char* fmt[] = { "bgr", "yuy2", "nv12", "p010" };
+    return std::string("video_ps_") + fmt[static_cast<int>(k.format)];
+}
+
+struct ShaderSource {
+    const char*                   file   = nullptr;
+    const char*                   target = nullptr;
+    std::vector<D3D_SHADER_MACRO> defs;             // завершается { nullptr, nullptr }
+};
+
+static ShaderSource shaderSource(const ShaderKey& k)
+{
+    ShaderSource s;
+    switch (k.program) {
+    case ShaderProgram::FullscreenVS: s.file = "fullscreen_vs.hlsl"; s.target = "vs_5_0"; break;
+    case ShaderProgram::OverlayVS:    s.file = "overlay_vs.hlsl";    s.target = "vs_5_0"; break;
+    case ShaderProgram::OverlayPS:    s.file = "overlay_ps.hlsl";    s.target = "ps_5_0";
+        if (k.pq) s.defs.push_back({ "OUT_PQ", "1" });
+        break;
+    case ShaderProgram::ScalePS:      s.file = "scale_ps.hlsl";      s.target = "ps_5_0";
+        s.defs.push_back({ k.scaler == ScaleMode::Bilinear ? "SCALE_BILINEAR"
+                         : k.scaler == ScaleMode::Bicubic  ? "SCALE_BICUBIC"
+                                                           : "SCALE_LANCZOS", "1" });
+        if (k.axisY && k.scaler != ScaleMode::Bilinear) s.defs.push_back({ "AXIS_Y", "1" });
+        break;
+    case ShaderProgram::VideoPS:      s.file = "video_ps.hlsl";      s.target = "ps_5_0";
+        if (k.format == PixelFormat::YUY2) s.defs.push_back({ "FMT_YUY2", "1" });
+        if (isPlanar(k.format))            s.defs.push_back({ "FMT_NV12", "1" });
+        if (k.format == PixelFormat::P010) s.defs.push_back({ "FMT_P010", "1" });
+        break;
+    }
+    s.defs.push_back({ nullptr, nullptr });
+    return s;
+}
+
+// FNV-1a: исходник, профиль и defines — любое изменение инвалидирует запись.
+static uint64_t hashShaderSource(const std::string& text, const ShaderSource& s)
+{
+    uint64_t h = 1469598103934665603ull;
+    auto mix = [&h](const char* p, size_t n) {
+        for (size_t i = 0; i < n; ++i) { h ^= static_cast<uint8_t>(p[i]); h *= 1099511628211ull; }
+        h ^= 0xFF; h *= 1099511628211ull;               // разделитель полей
+    };
+    mix(text.data(), text.size());
+    mix(s.target, strlen(s.target));
+    for (const auto& d : s.defs)
+        if (d.Name) { mix(d.Name, strlen(d.Name)); mix(d.Definition, strlen(d.Definition)); }
+    return h;
+}
+
+struct ShaderLibrary {
+    struct Bytecode { const void* code = nullptr; size_t size = 0; };
+
+    int embedded = 0, cached = 0, compiled = 0;   // откуда взяты варианты
+
+    Bytecode get(const ShaderKey& k)
+    {
+        const std::string name = shaderName(k);
+        for (const EmbeddedShader* e = s_embeddedShaders; e->name; ++e)
+            if (name == e->name) { ++embedded; return { e->code, e->size }; }
+
+        // Режим разработчика. Исходника может не быть рядом с exe — тогда
+        // кешу верим без проверки хеша.
+        if (!cacheLoaded_) loadCache();
+        const ShaderSource src = shaderSource(k);
+        std::string text;
+        const bool haveSource = readSource(src.file, text);
+        const uint64_t hash = haveSource ? hashShaderSource(text, src) : 0;
+
+        auto it = std::find_if(cache_.begin(), cache_.end(),
+                               [&](const CacheEntry& c) { return c.name == name; });
+        if (it != cache_.end() && (!haveSource || it->hash == hash)) {
+            ++cached;
+            return { it->code.data(), it->code.size() };
+        }
+        if (!haveSource) {
+            std::cerr << "[DX11] Shader " << name << ": no embedded bytecode and no "
+                      << SHADER_DIR << src.file << "\n";
+            return {};
+        }
+
+        std::vector<uint8_t> code;
+        if (!compile(text, src, code)) return {};
+        ++compiled;
+        if (it == cache_.end()) it = cache_.insert(cache_.end(), CacheEntry{ name, 0, {} });
+        it->hash = hash;
+        it->code = std::move(code);
+        saveCache();
+        return { it->code.data(), it->code.size() };
+    }
+
+    bool createVS(ID3D11Device* device, const ShaderKey& k, ID3D11VertexShader** out,
+                  Bytecode* code = nullptr)
+    {
+        const Bytecode b = get(k);
+        if (!b.code) return false;
+        if (code) *code = b;
+        return SUCCEEDED(device->CreateVertexShader(b.code, b.size, nullptr, out));
+    }
+
+    bool createPS(ID3D11Device* device, const ShaderKey& k, ID3D11PixelShader** out)
+    {
+        const Bytecode b = get(k);
+        return b.code && SUCCEEDED(device->CreatePixelShader(b.code, b.size, nullptr, out));
+    }
+
+private:
+    struct CacheEntry {
+        std::string          name;
+        uint64_t             hash = 0;
+        std::vector<uint8_t> code;
+    };
+    // list: Bytecode ссылается на code, адреса не должны плыть при вставке.
+    std::list<CacheEntry> cache_;
+    bool                  cacheLoaded_ = false;
+    bool                  compilerOk_  = false;
+
+    static bool readSource(const char* file, std::string& out)
+    {
+        std::ifstream f(std::string(SHADER_DIR) + file, std::ios::binary);
+        if (!f) return false;
+        out.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+        return true;
+    }
+
+    bool compile(const std::string& text, const ShaderSource& s, std::vector<uint8_t>& out)
+    {
+        // d3dcompiler_47.dll — delay-load: без неё вызов D3DCompile упал бы
+        // исключением загрузчика, проверяем заранее.
+        if (!compilerOk_ && !LoadLibraryW(L"d3dcompiler_47.dll")) {
+            std::cerr << "[DX11] d3dcompiler_47.dll not found: run build_shaders.cmd "
+                         "to embed precompiled shaders\n";
+            return false;
+        }
+        compilerOk_ = true;
+
+        const std::string path = std::string(SHADER_DIR) + s.file;
+        ID3DBlob *blob = nullptr, *err = nullptr;
+        D3DCompile(text.data(), text.size(), path.c_str(), s.defs.data(), nullptr,
+                   "main", s.target, D3DCOMPILE_OPTIMIZATION_LEVEL3, 0, &blob, &err);
+        if (!blob)
+            std::cerr << "[DX11] " << path << " (" << s.target << "): "
+                      << (err ? (char*)err->GetBufferPointer() : "?") << "\n";
+        if (err) err->Release();
+        if (!blob) return false;
+        const uint8_t* p = static_cast<const uint8_t*>(blob->GetBufferPointer());
+        out.assign(p, p + blob->GetBufferSize());
+        blob->Release();
+        return true;
+    }
+
+    // Формат: magic, count, затем count раз { nameLen, name, hash, size, code }.
+    // Битый или чужой файл просто игнорируется — варианты пересоберутся.
+    void loadCache()
+    {
+        cacheLoaded_ = true;
+        std::ifstream f(SHADER_CACHE_FILE, std::ios::binary);
+        if (!f) return;
+        DWORD magic = 0, count = 0;
+        f.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+        f.read(reinterpret_cast<char*>(&count), sizeof(count));
+        if (!f || magic != SHADER_CACHE_MAGIC || count > 256) return;
+        std::list<CacheEntry> entries;
+        for (DWORD i = 0; i < count; ++i) {
+            CacheEntry e;
+            DWORD nameLen = 0, size = 0;
+            f.read(reinterpret_cast<char*>(&nameLen), sizeof(nameLen));
+            if (!f || nameLen > 256) return;
+            e.name.resize(nameLen);
+            f.read(&e.name[0], nameLen);
+            f.read(reinterpret_cast<char*>(&e.hash), sizeof(e.hash));
+            f.read(reinterpret_cast<char*>(&size), sizeof(size));
+            if (!f || size > (1u << 20)) return;
+            e.code.resize(size);
+            f.read(reinterpret_cast<char*>(e.code.data()), size);
+            if (!f) return;
+            entries.push_back(std::move(e));
+        }
+        cache_ = std::move(entries);
+    }
+
+    void saveCache() const
+    {
+        std::ofstream f(SHADER_CACHE_FILE, std::ios::binary | std::ios::trunc);
+        if (!f) return;
+        const DWORD magic = SHADER_CACHE_MAGIC, count = static_cast<DWORD>(cache_.size());
+        f.write(reinterpret_cast<const char*>(&magic), sizeof(magic));
+        f.write(reinterpret_cast<const char*>(&count), sizeof(count));
+        for (const auto& e : cache_) {
+            const DWORD nameLen = static_cast<DWORD>(e.name.size());
+            const DWORD size    = static_cast<DWORD>(e.code.size());
+            f.write(reinterpret_cast<const char*>(&nameLen), sizeof(nameLen));
+            f.write(e.name.data(), nameLen);
+            f.write(reinterpret_cast<const char*>(&e.hash), sizeof(e.hash));
+            f.write(reinterpret_cast<const char*>(&size), sizeof(size));
+            f.write(reinterpret_cast<const char*>(e.code.data()), size);
+        }
+    }
+};
+
+// ─── GPU оверлей ─────────────────────────────────────────────────────────────
+//
+// Текст рисуется отдельным проходом поверх кадра, захваченный буфер не
+// трогается. Atlas ASCII 32..126 (+ сплошная ячейка для подложки)
+// один раз растеризуется GDI при init в R8 текстуру. Каждый кадр — только
+// квады в DYNAMIC vertex buffer и один Draw: цена не зависит от разрешения
+// источника.
+
+struct TextOverlay {
+    static const int COLS      = 16;
+    static const int ROWS      = 6;
+    static const int FIRST     = 32;   // ' '
+    static const int SOLID     = 95;   // ячейка 127 — залита целиком
+    static const int MAX_QUADS = 1024;
+
+    struct Vertex { float x, y, u, v, r, g, b, a; };
+
+    ID3D11Texture2D*          atlas    = nullptr;
+    ID3D11ShaderResourceView* atlasSrv = nullptr;
+    ID3D11Buffer*             vb       = nullptr;
+    ID3D11InputLayout*        layout   = nullptr;
+    ID3D11VertexShader*       vs       = nullptr;
+    ID3D11PixelShader*        ps       = nullptr;
+    ID3D11BlendState*         blend    = nullptr;
+    ID3D11SamplerState*       sampler  = nullptr;
+    ID3D11Buffer*             colorCB  = nullptr;   // HDR10: ColorParams рендера, не свой
+    int cellW = 0, cellH = 0;
+    int quads = 0;
+
+    // colorCB задан — swap chain HDR10, текст кодируется в PQ (overlay_ps_pq).
+    bool init(ID3D11Device* device, ShaderLibrary& shaders, int pixelHeight,
+              ID3D11Buffer* hdrColorCB = nullptr)
+    {
+        if (!buildAtlas(device, pixelHeight)) return false;
+
+        ShaderKey vsKey, psKey;
+        vsKey.program = ShaderProgram::OverlayVS;
+        psKey.program = ShaderProgram::OverlayPS;
+        psKey.pq      = (hdrColorCB != nullptr);
+        colorCB       = hdrColorCB;
+        ShaderLibrary::Bytecode vsb;
+        if (!shaders.createVS(device, vsKey, &vs, &vsb) ||
+            !shaders.createPS(device, psKey, &ps))
+            return false;
+        const D3D11_INPUT_ELEMENT_DESC ied[] = {
+            { "POSITION", 0, DXGI_FORMAT_R32G32_FLOAT,       0, 0,  D3D11_INPUT_PER_VERTEX_DATA, 0 },
+            { "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT,       0, 8,  D3D11_INPUT_PER_VERTEX_DATA, 0 },
+            { "COLOR",    0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, 16, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+        };
+        device->CreateInputLayout(ied, 3, vsb.code, vsb.size, &layout);
+
+        D3D11_BUFFER_DESC bd = {};
+        bd.ByteWidth      = sizeof(Vertex) * 6 * MAX_QUADS;
+        bd.Usage          = D3D11_USAGE_DYNAMIC;
+        bd.BindFlags      = D3D11_BIND_VERTEX_BUFFER;
+        bd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+        device->CreateBuffer(&bd, nullptr, &vb);
+
+        D3D11_BLEND_DESC bl = {};
+        auto& rt = bl.RenderTarget[0];
+        rt.BlendEnable           = TRUE;
+        rt.SrcBlend              = D3D11_BLEND_SRC_ALPHA;
+        rt.DestBlend             = D3D11_BLEND_INV_SRC_ALPHA;
+        rt.BlendOp               = D3D11_BLEND_OP_ADD;
+        rt.SrcBlendAlpha         = D3D11_BLEND_ONE;
+        rt.DestBlendAlpha        = D3D11_BLEND_ZERO;
+        rt.BlendOpAlpha          = D3D11_BLEND_OP_ADD;
+        rt.RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
+        device->CreateBlendState(&bl, &blend);
+
+        D3D11_SAMPLER_DESC sd = {};
+        sd.Filter   = D3D11_FILTER_MIN_MAG_MIP_POINT;
+        sd.AddressU = sd.AddressV = sd.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
+        device->CreateSamplerState(&sd, &sampler);
+
+        return vs && ps && layout && vb && blend && sampler;
+    }
+
+    // Многострочный текст ('\n'), левый верхний угол (x, y) в пикселях окна.
+    void build(ID3D11DeviceContext* ctx, const std::string& text,
+               float x, float y, int winW, int winH)
+    {
+        quads = 0;
+        if (!vb || text.empty()) return;
+
+        D3D11_MAPPED_SUBRESOURCE m = {};
+        if (FAILED(ctx->Map(vb, 0, D3D11_MAP_WRITE_DISCARD, 0, &m))) return;
+        Vertex* v = static_cast<Vertex*>(m.pData);
+
+        int lines = 1, col = 0, maxCols = 0;
+        for (char c : text) {
+            if (c == '\n') { ++lines; col = 0; continue; }
+            maxCols = (std::max)(maxCols, ++col);
+        }
+
+        const float sx = 2.0f / winW, sy = 2.0f / winH;
+        auto quad = [&](float px, float py, float pw, float ph, int cell,
+                        float r, float g, float b, float a) {
+            if (quads >= MAX_QUADS) return;
+            const float x0 = px * sx - 1.0f, x1 = (px + pw) * sx - 1.0f;
+            const float y0 = 1.0f - py * sy, y1 = 1.0f - (py + ph) * sy;
+            const float u0 = float(cell % COLS) / COLS, u1 = u0 + 1.0f / COLS;
+            const float v0 = float(cell / COLS) / ROWS, v1 = v0 + 1.0f / ROWS;
+            Vertex* q = v + quads * 6;
+            q[0] = { x0, y0, u0, v0, r, g, b, a };
+            q[1] = { x1, y0, u1, v0, r, g, b, a };
+            q[2] = { x0, y1, u0, v1, r, g, b, a };
+            q[3] = { x1, y0, u1, v0, r, g, b, a };
+            q[4] = { x1, y1, u1, v1, r, g, b, a };
+            q[5] = { x0, y1, u0, v1, r, g, b, a };
+            ++quads;
+        };
+
+        x = std::floor(x); y = std::floor(y);
+        const float pad = 6.0f;
+        quad(x - pad, y - pad, maxCols * cellW + 2 * pad, lines * cellH + 2 * pad,
+             SOLID, 0.0f, 0.0f, 0.0f, 0.55f);
+
+        float cx = x, cy = y;
+        for (char c : text) {
+            if (c == '\n') { cx = x; cy += cellH; continue; }
+            int cell = static_cast<unsigned char>(c) - FIRST;
+            if (cell < 0 || cell >= SOLID) cell = '?' - FIRST;
+            if (c != ' ')
+                quad(cx, cy, float(cellW), float(cellH), cell,
+                     0.63f, 0.63f, 0.63f, 1.0f);   // тот же серый 160, что был у putText
+            cx += cellW;
+        }
+        ctx->Unmap(vb, 0);
+    }
+
+    void draw(ID3D11DeviceContext* ctx)
+    {
+        if (!quads) return;
+        const UINT stride = sizeof(Vertex), offset = 0;
+        ctx->IASetInputLayout(layout);
+        ctx->IASetVertexBuffers(0, 1, &vb, &stride, &offset);
+        ctx->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+        ctx->VSSetShader(vs, nullptr, 0);
+        ctx->PSSetShader(ps, nullptr, 0);
+        ctx->PSSetShaderResources(0, 1, &atlasSrv);
+        ctx->PSSetSamplers(0, 1, &sampler);
+        if (colorCB) ctx->PSSetConstantBuffers(1, 1, &colorCB);
+        ctx->OMSetBlendState(blend, nullptr, 0xFFFFFFFF);
+        ctx->Draw(quads * 6, 0);
+        ctx->OMSetBlendState(nullptr, nullptr, 0xFFFFFFFF);
+        ctx->IASetInputLayout(nullptr);
+    }
+
+    void release()
+    {
+        if (sampler)  sampler->Release();
+        if (blend)    blend->Release();
+        if (ps)       ps->Release();
+        if (vs)       vs->Release();
+        if (layout)   layout->Release();
+        if (vb)       vb->Release();
+        if (atlasSrv) atlasSrv->Release();
+        if (atlas)    atlas->Release();
+        *this = TextOverlay();
+    }
+
+private:
+    // Consolas с grayscale AA (не ClearType) белым по чёрному в 32-bit DIB;
+    // покрытие — зелёный канал.
+    bool buildAtlas(ID3D11Device* device, int pixelHeight)
+    {
+        HDC dc = CreateCompatibleDC(nullptr);
+        HFONT font = CreateFontW(-pixelHeight, 0, 0, 0, FW_NORMAL, FALSE, FALSE, FALSE,
+                                 DEFAULT_CHARSET, OUT_DEFAULT_PRECIS, CLIP_DEFAULT_PRECIS,
+                                 ANTIALIASED_QUALITY, FIXED_PITCH | FF_MODERN, L"Consolas");
+        HGDIOBJ oldFont = SelectObject(dc, font);
+        TEXTMETRICW tm = {};
+        GetTextMetricsW(dc, &tm);
+        cellW = tm.tmAveCharWidth;
+        cellH = tm.tmHeight;
+        const int aw = COLS * cellW, ah = ROWS * cellH;
+
+        BITMAPINFO bi = {};
+        bi.bmiHeader.biSize        = sizeof(bi.bmiHeader);
+        bi.bmiHeader.biWidth       = aw;
+        bi.bmiHeader.biHeight      = -ah;   // top-down
+        bi.bmiHeader.biPlanes      = 1;
+        bi.bmiHeader.biBitCount    = 32;
+        bi.bmiHeader.biCompression = BI_RGB;
+        void*   bits = nullptr;
+        HBITMAP bmp  = CreateDIBSection(dc, &bi, DIB_RGB_COLORS, &bits, nullptr, 0);
+        HGDIOBJ oldBmp = SelectObject(dc, bmp);
+
+        RECT all = { 0, 0, aw, ah };
+        FillRect(dc, &all, static_cast<HBRUSH>(GetStockObject(BLACK_BRUSH)));
+        SetBkMode(dc, TRANSPARENT);
+        SetTextColor(dc, RGB(255, 255, 255));
+        for (int i = 0; i < SOLID; ++i) {
+            wchar_t ch = static_cast<wchar_t>(FIRST + i);
+            TextOutW(dc, (i % COLS) * cellW, (i / COLS) * cellH, &ch, 1);
+        }
+        RECT solid = { (SOLID % COLS) * cellW, (SOLID / COLS) * cellH,
+                       (SOLID % COLS + 1) * cellW, (SOLID / COLS + 1) * cellH };
+        FillRect(dc, &solid, static_cast<HBRUSH>(GetStockObject(WHITE_BRUSH)));
+        GdiFlush();
+
+        std::vector<uint8_t> cov(static_cast<size_t>(aw) * ah);
+        const uint8_t* px = static_cast<const uint8_t*>(bits);
+        for (size_t i = 0; bits && i < cov.size(); ++i) cov[i] = px[i * 4 + 1];
+
+        SelectObject(dc, oldBmp);
+        SelectObject(dc, oldFont);
+        DeleteObject(bmp);
+        DeleteObject(font);
+        DeleteDC(dc);
+        if (!bits || cellW <= 0 || cellH <= 0) return false;
+
+        D3D11_TEXTURE2D_DESC td = {};
+        td.Width      = aw; td.Height = ah;
+        td.MipLevels  = 1;  td.ArraySize = 1;
+        td.Format     = DXGI_FORMAT_R8_UNORM;
+        td.SampleDesc = { 1, 0 };
+        td.Usage      = D3D11_USAGE_IMMUTABLE;
+        td.BindFlags  = D3D11_BIND_SHADER_RESOURCE;
+        D3D11_SUBRESOURCE_DATA init = { cov.data(), static_cast<UINT>(aw), 0 };
+        if (FAILED(device->CreateTexture2D(&td, &init, &atlas))) return false;
+        device->CreateShaderResourceView(atlas, nullptr, &atlasSrv);
+        return atlasSrv != nullptr;
+    }
+};
+
+// ─── Темп Present: VSync, VRR, по vblank ─────────────────────────────────────
+//
+// Рендер делает ровно один Present на новый кадр захвата; режим решает,
+// когда и с каким интервалом (клавиша VSync перебирает их по кругу):
+//   off        Present(0, ALLOW_TEARING) сразу — минимум задержки, разрывы
+//   vsync      Present(1) сразу — без разрывов, кадр ждёт vblank в очереди
+//              DXGI, а если её держит прошлый кадр — ещё один период
+//   vrr        интервал 0 + tearing, как off (условие VRR в flip модели), но
+//              момент Present выровнен по темпу захвата (FrameCadence): ранний
+//              кадр ждёт до четверти периода, и панель G-Sync / FreeSync идёт
+//              ровно за источником, а не за джиттером USB
+//   scheduled  фиксированная развёртка: VBlankClock ловит vblank через
+//              IDXGIOutput::WaitForVBlank, рендер спит до (ближайший vblank −
+//              запас), берёт самый свежий кадр и делает Present(1) — очередь
+//              пуста, кадр встаёт ровно на этот vblank
+
+// Период по интервалам между метками: медленный фильтр, выбросы дальше ±50%
+// (пропуск, пачка кадров) — мимо. Начало — номинал (fps источника, частота
+// режима), без него — медиана первых отсчётов. RESEED выбросов подряд —
+// период сменился или номинал врал: берём их медиану, иначе ошибка первого
+// отсчёта осталась бы на всю сессию.
+class PeriodEstimate {
+public:
+    static const int FIRST = 5, RESEED = 8;
+
+    void seed(int64_t period) { period_ = period > 0 ? period : 0; misses_ = 0; }
+
+    void add(int64_t d)
+    {
+        if (d <= 0) return;
+        if (period_ && d > period_ / 2 && d < period_ * 3 / 2) {
+            period_ += (d - period_) / 16;
+            misses_  = 0;
+            return;
+        }
+        recent_[misses_++] = d;
+        if (misses_ < (period_ ? RESEED : FIRST)) return;
+        std::nth_element(recent_, recent_ + misses_ / 2, recent_ + misses_);
+        period_ = recent_[misses_ / 2];
+        misses_ = 0;
+    }
+
+    int64_t period() const { return period_; }
+
+private:
+    int64_t period_ = 0;
+    int64_t recent_[RESEED] = {};
+    int     misses_ = 0;
+};
+
+// Период и фаза развёртки выхода, на котором окно. Отдельный поток: вызов
+// WaitForVBlank блокирует до vblank. Период — с частоты режима выхода.
+class VBlankClock {
+public:
+    ~VBlankClock() { stop(); }
+
+    bool running() const { return thread_.joinable(); }
+
+    bool start(IDXGISwapChain1* swapChain)
+    {
+        if (running()) return true;
+        if (failed_) return false;
+        if (FAILED(swapChain->GetContainingOutput(&output_))) {
+            std::cerr << "[WARN] No DXGI output for the window, scheduled pacing disabled\n";
+            failed_ = true;
+            return false;
+        }
+        DXGI_OUTPUT_DESC od = {};
+        DEVMODEW         dm = {};
+        dm.dmSize = sizeof(dm);
+        estimate_.seed(0);
+        if (SUCCEEDED(output_->GetDesc(&od)) &&
+            EnumDisplaySettingsW(od.DeviceName, ENUM_CURRENT_SETTINGS, &dm) &&
+            dm.dmDisplayFrequency > 1)
+            estimate_.seed(qpcFrequency() / dm.dmDisplayFrequency);
+        period_.store(estimate_.period(), std::memory_order_relaxed);
+        running_ = true;
+        thread_  = std::thread(&VBlankClock::loop, this);
+        return true;
+    }
+
+    void stop()
+    {
+        running_ = false;
+        if (thread_.joinable()) thread_.join();
+        if (output_) { output_->Release(); output_ = nullptr; }
+    }
+
+    // Первый vblank не раньше t; 0 — период ещё не измерен.
+    int64_t nextAfter(int64_t t) const
+    {
+        const int64_t last = last_.load(std::memory_order_acquire);
+        const int64_t p    = period_.load(std::memory_order_relaxed);
+        if (!last || !p) return 0;
+        if (t <= last) return last;
+        return last + (t - last + p - 1) / p * p;
+    }
+
+    double hz() const
+    {
+        const int64_t p = period_.load(std::memory_order_relaxed);
+        return p ? static_cast<double>(qpcFrequency()) / p : 0.0;
+    }
+
+private:
+    void loop()
+    {
+        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+        int64_t prev = 0;
+        while (running_) {
+            // Выход выключен или окно уехало на другой — не крутимся вхолостую.
+            if (FAILED(output_->WaitForVBlank())) { Sleep(10); prev = 0; continue; }
+            const int64_t t = qpcNow();
+            if (prev) {                             // пропущенный vblank — только фаза
+                estimate_.add(t - prev);
+                period_.store(estimate_.period(), std::memory_order_relaxed);
+            }
+            prev = t;
+            last_.store(t, std::memory_order_release);
+        }
+    }
+
+    IDXGIOutput*         output_ = nullptr;
+    bool                 failed_ = false;
+    PeriodEstimate       estimate_;              // только поток vblank (и start)
+    std::thread          thread_;
+    std::atomic<bool>    running_ { false };
+    std::atomic<int64_t> last_    { 0 };
+    std::atomic<int64_t> period_  { 0 };
+};
+
+// Темп источника: период по меткам кадров (устройства, если есть, — они
+// ровнее), фаза — сглаженный момент прихода (альфа-фильтр по ошибке
+// предсказания). Поздний кадр показывается сразу, ранний — в момент фазы.
+class FrameCadence {
+public:
+    // Новый источник (старт, переоткрытие): период с его fps, фаза заново.
+    void reset(double fps)
+    {
+        estimate_.seed(fps > 1.0 ? static_cast<int64_t>(qpcFrequency() / fps) : 0);
+        period_ = estimate_.period();
+        phase_  = lastOrigin_ = 0;
+    }
+
+    void update(int64_t receive, int64_t origin)
+    {
+        if (lastOrigin_) {
+            estimate_.add(origin - lastOrigin_);
+            period_ = estimate_.period();
+        }
+        lastOrigin_ = origin;
+
+        const int64_t predicted = phase_ + period_;
+        const int64_t err       = receive - predicted;
+        if (!phase_ || !period_ || err > period_ || err < -period_)
+            phase_ = receive;                       // старт или разрыв потока
+        else
+            phase_ = predicted + err / 8;
+    }
+
+    // Когда показывать кадр, пришедший в receive.
+    int64_t presentAt(int64_t receive) const
+    {
+        if (!period_) return receive;
+        return (std::min)((std::max)(phase_, receive), receive + period_ / 4);
+    }
+
+    double hz() const { return period_ ? static_cast<double>(qpcFrequency()) / period_ : 0.0; }
+
+private:
+    PeriodEstimate estimate_;
+    int64_t        period_     = 0;
+    int64_t        phase_      = 0;
+    int64_t        lastOrigin_ = 0;
+};
+
+class PresentPacer {
+public:
+    VBlankClock  vblank;
+    FrameCadence cadence;
+
+    PresentPacer()
+    {
+        timer_ = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION,
+                                        TIMER_ALL_ACCESS);
+        if (!timer_) timer_ = CreateWaitableTimerW(nullptr, TRUE, nullptr);
+    }
+    ~PresentPacer() { if (timer_) CloseHandle(timer_); }
+    PresentPacer(const PresentPacer&)            = delete;
+    PresentPacer& operator=(const PresentPacer&) = delete;
+
+    // Момент Present для кадра f; 0 — сразу. marginMs — upload + GPU + запас
+    // до vblank в режиме scheduled.
+    int64_t target(const Frame& f, PresentPacing pacing, IDXGISwapChain1* swapChain,
+                   double marginMs)
+    {
+        cadence.update(f.tReceive, f.tDevice ? f.tDevice : f.tReceive);
+        if (pacing == PresentPacing::Vrr) return cadence.presentAt(f.tReceive);
+        if (pacing != PresentPacing::Scheduled || !vblank.start(swapChain)) return 0;
+        const int64_t margin = static_cast<int64_t>(marginMs * qpcFrequency() / 1000.0);
+        const int64_t vb     = vblank.nextAfter(qpcNow() + margin);
+        return vb ? vb - margin : 0;
+    }
+
+    // Таймером до ~0.5 мс до срока, остаток — спином.
+    void waitUntil(int64_t t) const
+    {
+        const int64_t spin = qpcFrequency() / 2000;
+        const int64_t left = t - qpcNow();
+        if (left > spin && timer_) {
+            LARGE_INTEGER due;
+            due.QuadPart = -((left - spin) * 10000000LL / qpcFrequency());
+            SetWaitableTimer(timer_, &due, 0, nullptr, nullptr, FALSE);
+            WaitForSingleObject(timer_, INFINITE);
+        }
+        while (qpcNow() < t) YieldProcessor();
+    }
+
+private:
+    HANDLE timer_ = nullptr;
+};
+
+// ─── Цвет: матрица, диапазон, HDR ────────────────────────────────────────────
+//
+// ColorParams — cbuffer b1 shaders\video_ps.hlsl: декодирование YUV, диапазон,
+// передаточная функция и выход считаются в том же проходе, что и раньше
+// одна матрица. Строки матрицы собираются здесь, в шейдере на канал — один
+// dot. Смена матрицы — UpdateSubresource, без пересоздания шейдеров.
+
+struct ColorParams {
+    float    yuv[3][4];      // строки R, G, B: dot с (Y, Cb, Cr, 1)
+    float    rgbRange[4];    // BGR источник: x * c + y
+    uint32_t transfer;       // TransferFn источника
+    uint32_t output;         // 0 — SDR, 1 — HDR10 (PQ, BT.2020)
+    float    peakNits;       // пик контента: тон-маппинг PQ / HLG
+    float    whiteNits;      // белый SDR в нитах
+    uint32_t wide;           // основные цвета источника — BT.2020
+    float    pad[3];
+};
+static_assert(sizeof(ColorParams) % 16 == 0, "cbuffer size must be a multiple of 16");
+
+// Отсчёты в шкале 8 бит (P010 шейдер приводит к ней же). Limited — Y 16..235,
+// Cb / Cr 16..240 вокруг 128; full — 0..255. Auto: YUV — limited, RGB — full.
+static ColorParams makeColorParams(ColorMatrix m, ColorRange range, TransferFn tf,
+                                   bool hdr10, float peakNits, float whiteNits)
+{
+    // Kr, Kb по ColorMatrix (Auto сюда не доходит — как BT.709).
+    static const float K[4][2] = { { 0.2126f, 0.0722f }, { 0.299f, 0.114f },
+                                   { 0.2126f, 0.0722f }, { 0.2627f, 0.0593f } };
+    const float kr = K[static_cast<int>(m)][0], kb = K[static_cast<int>(m)][1];
+    const float kg = 1.0f - kr - kb;
+    const bool  limited = (range != ColorRange::Full);
+    const float ys = limited ? 255.0f / 219.0f : 1.0f;
+    const float yo = limited ? -16.0f / 219.0f : 0.0f;
+    const float cs = limited ? 255.0f / 224.0f : 1.0f;
+    const float co = limited ? -128.0f / 224.0f : -128.0f / 255.0f;
+
+    // R = Y + 2(1-Kr) Cr, B = Y + 2(1-Kb) Cb, G — из Y = Kr R + Kg G + Kb B.
+    const float crR = 2.0f * (1.0f - kr), cbB = 2.0f * (1.0f - kb);
+    const float rows[3][2] = { { 0.0f, crR }, { -cbB * kb / kg, -crR * kr / kg }, { cbB, 0.0f } };
+
+    ColorParams p = {};
+    for (int i = 0; i < 3; ++i) {
+        p.yuv[i][0] = ys;
+        p.yuv[i][1] = rows[i][0] * cs;
+        p.yuv[i][2] = rows[i][1] * cs;
+        p.yuv[i][3] = yo + (rows[i][0] + rows[i][1]) * co;
+    }
+    const bool rgbLimited = (range == ColorRange::Limited);
+    p.rgbRange[0] = rgbLimited ? 255.0f / 219.0f : 1.0f;
+    p.rgbRange[1] = rgbLimited ? -16.0f / 219.0f : 0.0f;
+    p.transfer  = static_cast<uint32_t>(tf);
+    p.output    = hdr10 ? 1u : 0u;
+    p.peakNits  = peakNits;
+    p.whiteNits = whiteNits;
+    p.wide      = (m == ColorMatrix::BT2020 || tf != TransferFn::SDR) ? 1u : 0u;
+    return p;
+}
+
+// Windows HDR включён на мониторе окна: ColorSpace его выхода — PQ BT.2020.
+static bool outputIsHdr(IDXGIAdapter* adapter, HWND hwnd)
+{
+    const HMONITOR mon = MonitorFromWindow(hwnd, MONITOR_DEFAULTTOPRIMARY);
+    bool hdr = false;
+    IDXGIOutput* out = nullptr;
+    for (UINT i = 0; !hdr && SUCCEEDED(adapter->EnumOutputs(i, &out)); ++i) {
+        IDXGIOutput6* o6 = nullptr;
+        DXGI_OUTPUT_DESC1 d = {};
+        if (SUCCEEDED(out->QueryInterface(__uuidof(IDXGIOutput6), reinterpret_cast<void**>(&o6))) &&
+            SUCCEEDED(o6->GetDesc1(&d)) && d.Monitor == mon)
+            hdr = (d.ColorSpace == DXGI_COLOR_SPACE_RGB_FULL_G2084_NONE_P2020);
+        if (o6) o6->Release();
+        out->Release();
+    }
+    return hdr;
+}
+
+// ─── Мониторы: выходы DXGI и DPI ─────────────────────────────────────────────
+//
+// Окно занимает выбранный монитор целиком в физических пикселях: процесс
+// per-monitor DPI aware (v2), иначе на панели со 150% SM_CXSCREEN отдаёт
+// логический размер, и DWM растягивает такое «полноэкранное» окно —
+// лишний проход композиции и back buffer не в разрешении экрана. Рендер
+// создаётся на адаптере, к которому подключён монитор: на ноутбуке с двумя
+// GPU кадр не копируется между адаптерами.
+
+struct DisplayOutput {
+    int          index   = -1;            // --monitor N
+    std::wstring device;                  // \\.\DISPLAY1
+    RECT         rect    = {};            // рабочий стол, физические пиксели
+    int          hz      = 0;             // частота текущего режима
+    int          modeW   = 0, modeH = 0;  // размер текущего режима
+    bool         primary = false;
+    LUID         adapterLuid = {};
+    std::string  adapterName;
+};
+
+// SetProcessDpiAwarenessContext — с Windows 10 1703: берём из user32 по
+// имени, иначе на старой системе exe не загрузится вовсе.
+static void enableDpiAwareness()
+{
+    using SetContextFn = BOOL (WINAPI*)(DPI_AWARENESS_CONTEXT);
+    const auto setContext = reinterpret_cast<SetContextFn>(reinterpret_cast<void*>(
+        GetProcAddress(GetModuleHandleW(L"user32.dll"), "SetProcessDpiAwarenessContext")));
+    // ACCESS_DENIED — режим уже задан манифестом.
+    if (setContext && (setContext(DPI_AWARENESS_CONTEXT_PER_MONITOR_AWARE_V2) ||
+                       GetLastError() == ERROR_ACCESS_DENIED))
+        return;
+    SetProcessDPIAware();                       // до Windows 10 1703: хотя бы system aware
+}
+
+// Мониторы рабочего стола в порядке адаптер → выход DXGI.
+static std::vector<DisplayOutput> enumerateOutputs()
+{
+    std::vector<DisplayOutput> list;
+    IDXGIFactory1* factory = nullptr;
+    if (FAILED(CreateDXGIFactory1(__uuidof(IDXGIFactory1), reinterpret_cast<void**>(&factory))))
+        return list;
+    IDXGIAdapter1* adapter = nullptr;
+    for (UINT a = 0; factory->EnumAdapters1(a, &adapter) != DXGI_ERROR_NOT_FOUND; ++a) {
+        DXGI_ADAPTER_DESC1 ad = {};
+        adapter->GetDesc1(&ad);
+        IDXGIOutput* out = nullptr;
+        for (UINT o = 0; adapter->EnumOutputs(o, &out) != DXGI_ERROR_NOT_FOUND; ++o) {
+            DXGI_OUTPUT_DESC od = {};
+            out->GetDesc(&od);
+            out->Release();
+            if (!od.AttachedToDesktop) continue;
+            DisplayOutput d;
+            d.index       = static_cast<int>(list.size());
+            d.device      = od.DeviceName;
+            d.rect        = od.DesktopCoordinates;
+            d.adapterLuid = ad.AdapterLuid;
+            d.adapterName = wideToUtf8(ad.Description);
+            MONITORINFO mi = { sizeof(mi) };
+            d.primary = GetMonitorInfoW(od.Monitor, &mi) && (mi.dwFlags & MONITORINFOF_PRIMARY);
+            DEVMODEW dm = {};
+            dm.dmSize = sizeof(dm);
+            if (EnumDisplaySettingsW(od.DeviceName, ENUM_CURRENT_SETTINGS, &dm)) {
+                d.hz    = static_cast<int>(dm.dmDisplayFrequency);
+                d.modeW = static_cast<int>(dm.dmPelsWidth);
+                d.modeH = static_cast<int>(dm.dmPelsHeight);
+            }
+            list.push_back(d);
+        }
+        adapter->Release();
+    }
+    factory->Release();
+    return list;
+}
+
+// index < 0 — основной монитор. Без выходов DXGI (RDP, старый драйвер) —
+// основной монитор по GetSystemMetrics на адаптере по умолчанию.
+static bool pickOutput(int index, DisplayOutput& out)
+{
+    const std::vector<DisplayOutput> list = enumerateOutputs();
+    for (const DisplayOutput& d : list) {
+        if (index < 0 ? !d.primary : d.index != index) continue;
+        out = d;
+        // Логические координаты вместо физических: DPI awareness не
+        // применилась, окно и back buffer меньше режима — DWM растянет.
+        if (d.modeW && (d.rect.right - d.rect.left != d.modeW ||
+                        d.rect.bottom - d.rect.top != d.modeH))
+            std::cerr << "[WARN] Monitor " << d.index << " desktop size differs from its mode "
+                      << d.modeW << "x" << d.modeH << ", DWM will scale the window\n";
+        return true;
+    }
+    if (index >= 0) {
+        std::cerr << "[ERROR] No monitor " << index << ", see --monitor list\n";
+        return false;
+    }
+    out = DisplayOutput();
+    out.rect    = { 0, 0, GetSystemMetrics(SM_CXSCREEN), GetSystemMetrics(SM_CYSCREEN) };
+    out.primary = true;
+    return true;
+}
+
+static std::string outputLabel(const DisplayOutput& d)
+{
+    std::string s = std::to_string(d.rect.right - d.rect.left) + "x" +
+                    std::to_string(d.rect.bottom - d.rect.top);
+    if (d.hz > 1) s += " @ " + std::to_string(d.hz) + " Hz";  // 0 / 1 — частота по умолчанию
+    if (d.index >= 0) s = "#" + std::to_string(d.index) + " " + s;
+    return d.primary ? s + " (primary)" : s;
+}
+
+// --monitor list.
+static void printOutputs()
+{
+    for (const DisplayOutput& d : enumerateOutputs())
+        std::cout << "  " << outputLabel(d) << "  " << wideToUtf8(d.device.c_str())
+                  << " at " << d.rect.left << "," << d.rect.top << "  " << d.adapterName << "\n";
+}
+
+// Адаптер по LUID из DisplayOutput; nullptr — D3D11 выберет адаптер сам.
+static IDXGIAdapter1* findAdapter(LUID luid)
+{
+    if (!luid.LowPart && !luid.HighPart) return nullptr;
+    IDXGIFactory1* factory = nullptr;
+    if (FAILED(CreateDXGIFactory1(__uuidof(IDXGIFactory1), reinterpret_cast<void**>(&factory))))
+        return nullptr;
+    IDXGIAdapter1* found   = nullptr;
+    IDXGIAdapter1* adapter = nullptr;
+    for (UINT a = 0; !found && factory->EnumAdapters1(a, &adapter) != DXGI_ERROR_NOT_FOUND; ++a) {
+        DXGI_ADAPTER_DESC1 ad = {};
+        adapter->GetDesc1(&ad);
+        if (ad.AdapterLuid.LowPart == luid.LowPart && ad.AdapterLuid.HighPart == luid.HighPart)
+            found = adapter;
+        else
+            adapter->Release();
+    }
+    factory->Release();
+    return found;
+}
+
+// ─── DirectX 11 Renderer ─────────────────────────────────────────────────────
+
+// Промежуточная цель проходов масштабирования: текстура + RTV + SRV.
+struct RenderTarget {
+    ID3D11Texture2D*          tex = nullptr;
+    ID3D11RenderTargetView*   rtv = nullptr;
+    ID3D11ShaderResourceView* srv = nullptr;
+    int         w = 0, h = 0;
+    DXGI_FORMAT format = DXGI_FORMAT_UNKNOWN;
+
+    bool ensure(ID3D11Device* device, int width, int height, DXGI_FORMAT fmt)
+    {
+        if (tex && w == width && h == height && format == fmt) return true;
+        release();
+        D3D11_TEXTURE2D_DESC td = {};
+        td.Width      = width;
+        td.Height     = height;
+        td.MipLevels  = 1; td.ArraySize = 1;
+        td.Format     = fmt;
+        td.SampleDesc = { 1, 0 };
+        td.Usage      = D3D11_USAGE_DEFAULT;
+        td.BindFlags  = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
+        if (FAILED(device->CreateTexture2D(&td, nullptr, &tex))) {
+            std::cerr << "[DX11] Scaler target " << width << "x" << height << " failed\n";
+            return false;
+        }
+        device->CreateRenderTargetView(tex, nullptr, &rtv);
+        device->CreateShaderResourceView(tex, nullptr, &srv);
+        w = width; h = height; format = fmt;
+        return rtv && srv;
+    }
+
+    void release()
+    {
+        if (srv) srv->Release();
+        if (rtv) rtv->Release();
+        if (tex) tex->Release();
+        *this = RenderTarget();
+    }
+};
+
+// GPU время проходов видео по timestamp запросам. Результат читается через
+// несколько кадров без ожидания (DONOTFLUSH); если все слоты ещё в работе,
+// кадр просто не измеряется — рендер никогда не ждёт GPU ради статистики.
+struct GpuTimer {
+    static const int DEPTH = 4;
+
+    struct Slot {
+        ID3D11Query* disjoint = nullptr;
+        ID3D11Query* t0       = nullptr;
+        ID3D11Query* t1       = nullptr;
+        bool         pending  = false;
+    };
+
+    Slot     slots[DEPTH];
+    int      next    = 0;
+    bool     active  = false;          // begin() открыл измерение
+    double   avgMs   = 0.0;            // EMA — для оверлея
+    double   sumMs   = 0.0, maxMs = 0.0;
+    uint64_t samples = 0;
+
+    bool init(ID3D11Device* device)
+    {
+        D3D11_QUERY_DESC dj = { D3D11_QUERY_TIMESTAMP_DISJOINT, 0 };
+        D3D11_QUERY_DESC ts = { D3D11_QUERY_TIMESTAMP, 0 };
+        for (Slot& s : slots)
+            if (FAILED(device->CreateQuery(&dj, &s.disjoint)) ||
+                FAILED(device->CreateQuery(&ts, &s.t0)) ||
+                FAILED(device->CreateQuery(&ts, &s.t1)))
+                return false;
+        return true;
+    }
+
+    void begin(ID3D11DeviceContext* ctx)
+    {
+        active = false;
+        if (!slots[0].disjoint) return;
+        for (Slot& s : slots)
+            if (s.pending) collect(ctx, s);
+        Slot& s = slots[next];
+        if (s.pending) return;
+        ctx->Begin(s.disjoint);
+        ctx->End(s.t0);
+        active = true;
+    }
+
+    void end(ID3D11DeviceContext* ctx)
+    {
+        if (!active) return;
+        Slot& s = slots[next];
+        ctx->End(s.t1);
+        ctx->End(s.disjoint);
+        s.pending = true;
+        next = (next + 1) % DEPTH;
+    }
+
+    void release()
+    {
+        for (Slot& s : slots) {
+            if (s.disjoint) s.disjoint->Release();
+            if (s.t0)       s.t0->Release();
+            if (s.t1)       s.t1->Release();
+            s = Slot();
+        }
+    }
+
+private:
+    void collect(ID3D11DeviceContext* ctx, Slot& s)
+    {
+        D3D11_QUERY_DATA_TIMESTAMP_DISJOINT dj = {};
+        UINT64 a = 0, b = 0;
+        const UINT f = D3D11_ASYNC_GETDATA_DONOTFLUSH;
+        if (ctx->GetData(s.disjoint, &dj, sizeof(dj), f) != S_OK ||
+            ctx->GetData(s.t0, &a, sizeof(a), f) != S_OK ||
+            ctx->GetData(s.t1, &b, sizeof(b), f) != S_OK)
+            return;
+        s.pending = false;
+        if (dj.Disjoint || !dj.Frequency || b < a) return;   // смена частоты GPU
+        const double ms = (b - a) * 1000.0 / dj.Frequency;
+        avgMs  = samples ? avgMs + (ms - avgMs) * 0.05 : ms;
+        sumMs += ms;
+        maxMs  = (std::max)(maxMs, ms);
+        ++samples;
+    }
+};
+
+// Область маркера калибровки с текстуры кадра: копия в маленький staging и
+// Map с DO_NOT_WAIT через кадр-другой — рендер не ждёт GPU. Кольцо по
+// порядку Present: poll отдаёт самый старый слот, когда копия готова.
+struct MarkerReadback {
+    static constexpr int DEPTH = 4;
+
+    ID3D11Texture2D* tex[DEPTH] = {};
+    MarkerTag        tags[DEPTH];
+    bool             pending[DEPTH] = {};
+    int              head = 0, tail = 0;       // следующий под копию / самый старый
+    int              side = 0;
+    DXGI_FORMAT      format = DXGI_FORMAT_UNKNOWN;
+    PixelFormat      pixel  = PixelFormat::YUY2;
+    uint64_t         skipped = 0;              // кольцо полно — кадр без замера
+
+    // src — текстура кадра формата fmt (YUY2 с CPU — RGBA половинной ширины).
+    void queue(ID3D11Device* device, ID3D11DeviceContext* ctx, ID3D11Texture2D* src,
+               PixelFormat fmt, const MarkerTag& tag)
+    {
+        D3D11_TEXTURE2D_DESC sd = {};
+        src->GetDesc(&sd);
+        const bool packed = (fmt == PixelFormat::YUY2 && sd.Format != DXGI_FORMAT_YUY2);
+        const int  s      = markerSide(packed ? sd.Width * 2 : sd.Width, sd.Height);
+        if (s < 8) return;
+        if (s != side || sd.Format != format || fmt != pixel) {
+            release();
+            D3D11_TEXTURE2D_DESC td = {};
+            td.Width          = packed ? s / 2 : s;
+            td.Height         = s;
+            td.MipLevels      = 1; td.ArraySize = 1;
+            td.Format         = sd.Format;
+            td.SampleDesc     = { 1, 0 };
+            td.Usage          = D3D11_USAGE_STAGING;
+            td.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+            for (auto*& t : tex)
+                if (FAILED(device->CreateTexture2D(&td, nullptr, &t))) { release(); return; }
+            side = s; format = sd.Format; pixel = fmt;
+        }
+        if (pending[head]) { ++skipped; return; }
+        const D3D11_BOX box = { 0, 0, 0, static_cast<UINT>(packed ? s / 2 : s),
+                                static_cast<UINT>(s), 1 };
+        ctx->CopySubresourceRegion(tex[head], 0, 0, 0, 0, src, 0, &box);
+        tags[head]    = tag;
+        pending[head] = true;
+        head = (head + 1) % DEPTH;
+    }
+
+    bool poll(ID3D11DeviceContext* ctx, int& luma, MarkerTag& tag)
+    {
+        if (!pending[tail]) return false;
+        D3D11_MAPPED_SUBRESOURCE m = {};
+        if (FAILED(ctx->Map(tex[tail], 0, D3D11_MAP_READ, D3D11_MAP_FLAG_DO_NOT_WAIT, &m)))
+            return false;
+        luma = markerLuma(static_cast<const uint8_t*>(m.pData), m.RowPitch, side, pixel);
+        ctx->Unmap(tex[tail], 0);
+        tag           = tags[tail];
+        pending[tail] = false;
+        tail = (tail + 1) % DEPTH;
+        return true;
+    }
+
+    void release()
+    {
+        for (int k = 0; k < DEPTH; ++k) {
+            if (tex[k]) tex[k]->Release();
+            tex[k] = nullptr; pending[k] = false;
+        }
+        head = tail = 0; side = 0; format = DXGI_FORMAT_UNKNOWN;
+    }
+};
+
+enum class TexSource { None, Dynamic, Ring, Slots, GpuCopy };
+
+// Текстуры одного источника. Слой 0 — основной: по нему оверлей, --calibrate,
+// слоты загрузки и статистика --dirty; остальные (--devices) рисуются в свои
+// ячейки раскладки тем же конвейером декодирования и масштабирования.
+struct VideoLayer {
+    ID3D11Texture2D*          dynTex  = nullptr;
+    ID3D11Texture2D*          copyTex = nullptr; // DEFAULT: ring upload и кадры из видеопамяти
+    ID3D11ShaderResourceView* srv     = nullptr;
+    ID3D11ShaderResourceView* srvUV   = nullptr; // NV12 / P010: плоскость UV
+    std::vector<ID3D11Texture2D*> staging;
+    int         stagingNext = 0;
+    int         texW = 0, texH = 0;
+    PixelFormat texFmt = PixelFormat::BGR24;
+    TexSource   texSrc = TexSource::None;        // откуда srv получает пиксели
+    RenderTarget decoded, pass;                  // промежуточные цели масштабирования
+    DirtyTiles  dirty;
+    std::vector<D3D11_BOX> dirtyBoxes;
+};
+
+// Ячейка раскладки в пикселях окна.
+struct LayerCell { float x, y, w, h; };
+
+// Как кадр попадает на экран (DXGI_FRAME_STATISTICS_MEDIA::CompositionMode):
+// Direct — independent flip или плоскость overlay (MPO), без кадра
+// композиции DWM; Composed — DWM копирует кадр в свой back buffer.
+enum class PresentPath { Unknown, Direct, Composed };
+static const int PRESENT_PATH_COUNT = 3;
+
+static const char* presentPathName(PresentPath p)
+{
+    static const char* names[] = { "unknown", "direct scanout", "DWM composed" };
+    return names[static_cast<int>(p)];
+}
+
+struct DX11Renderer {
+    ID3D11Device*             device    = nullptr;
+    ID3D11DeviceContext*      ctx       = nullptr;
+    IDXGISwapChain1*          swapChain = nullptr;
+    ID3D11RenderTargetView*   rtv       = nullptr;
+    ID3D11VertexShader*       vs        = nullptr;
+    ID3D11PixelShader*        ps[4]     = {};      // индекс — PixelFormat
+    ID3D11SamplerState*       sampler   = nullptr;
+    ShaderLibrary             shaders;
+
+    // Масштабирование (shaders\scale_ps.hlsl). Nearest, Integer и 1:1 — один
+    // проход прямо в back buffer. Остальные режимы сначала декодируют кадр
+    // в RGB текстуру источника (VideoLayer::decoded), затем bilinear — один
+    // проход, bicubic / Lanczos — разделимо: по X в pass (dstW x srcH), по Y
+    // в окно.
+    ScaleMode           scaleMode     = ScaleMode::Bilinear;   // main меняет на ходу
+    ID3D11PixelShader*  psScale[SCALE_MODE_COUNT][2] = {};     // [режим][ось Y]
+    ID3D11SamplerState* linearSampler = nullptr;
+    ID3D11Buffer*       scaleCB       = nullptr;               // dstSize
+    float               scaleDstW = 0.0f, scaleDstH = 0.0f;
+
+    // Цвет (ColorParams, b1): задаётся до init(), матрицу main выбирает после
+    // согласования формата. hdr10 — итог --output: R10G10B10A2 swap chain
+    // с PQ BT.2020. Запись (drawSource) всегда получает SDR BT.709.
+    ColorMatrix   matrix     = ColorMatrix::BT709;
+    ColorRange    range      = ColorRange::Auto;
+    TransferFn    transfer   = TransferFn::SDR;
+    OutputMode    output     = OutputMode::Auto;
+    float         peakNits   = 1000.0f, whiteNits = 203.0f;
+    bool          hdr10      = false;
+    ID3D11Buffer* colorCB    = nullptr;                        // экран
+    ID3D11Buffer* colorSdrCB = nullptr;                        // --record
+    GpuTimer            gpuTimer;                              // Clear .. последний проход видео
+
+    // --dirty (только ring upload): загрузка изменившихся тайлов, кадр без
+    // изменений не рисуется. contentChanged — в текстуре новое с прошлого
+    // Present; оверлей и фильтр сверяются с тем, что показано.
+    bool        dirtyTracking   = false;                       // задаётся до upload
+    bool        contentChanged  = true;
+    std::string shownOverlay;
+    ScaleMode   shownScale      = ScaleMode::Bilinear;
+    uint64_t    tilesUploaded   = 0, tilesTotal = 0;           // за сессию
+    uint64_t    presentsSkipped = 0;
+
+    // winW x winH — область рисования: весь back buffer (bufW x bufH) или,
+    // с --scanout, окно SetSourceSize в масштабе источника.
+    int  winW = 0, winH = 0;
+    int  bufW = 0, bufH = 0;
+
+    // --scanout (задаётся до init()): back buffer размером экрана, источник
+    // рисуется 1:1 в окно SetSourceSize, до экрана растягивает плоскость
+    // overlay дисплейного контроллера — без прохода масштабирования на GPU.
+    // Путь кадра проверяется раз в секунду (checkPresentPath).
+    bool                 scanout        = false;
+    bool                 overlayPlanes  = false;   // IDXGIOutput2::SupportsOverlays
+    bool                 overlayScaling = false;   // CheckOverlaySupport: SCALING
+    IDXGISwapChainMedia* media          = nullptr;
+    PresentPath          presentPath    = PresentPath::Unknown;
+    uint64_t             pathChecks[PRESENT_PATH_COUNT] = {};  // за сессию
+    int64_t              pathCheckQpc   = 0;
+    int                  composedRun    = 0;       // подряд Composed со SetSourceSize
+
+    // Источники и их раскладка в окне. Размер задаётся до первого upload.
+    std::vector<VideoLayer> layers = std::vector<VideoLayer>(1);
+    LayoutMode              layout = LayoutMode::Grid;
+
+    // Ring upload: CPU заполняет staging слот k, пока GPU копирует k-1
+    // в copyTex. Без переименования DYNAMIC текстуры в драйвере iGPU и без
+    // ожидания Map, если предыдущий Draw ещё читает текстуру.
+    UploadMode                    uploadMode   = UploadMode::Ring; // задаётся до upload
+    int                           stagingCount = 3;
+    uint64_t                      stagingStalls = 0;  // кадры, пропущенные из-за занятого ring
+    UploadSlots                   uploadSlots;        // MF / synthetic: пишет поток захвата
+    BgrToBgraFn bgrToBgra = bgrToBgraScalar;  // ядро по CPUID, задаётся до upload
+    StripePool* stripePool      = nullptr;     // полосовая загрузка, если задан
+    long long   stripeMinPixels = LLONG_MAX;   // порог: кадры меньше — одним потоком
+    bool tearingOk = false;
+
+    // Статистика рисуется поверх кадра отдельным проходом (см. TextOverlay);
+    // пустой текст — оверлей выключен.
+    TextOverlay overlay;
+    std::string overlayText;
+
+    MarkerReadback marker;                         // --calibrate
+
+    // Очередь present: по умолчанию DXGI держит до 3 кадров — это до ~50 мс
+    // при VSync ON. С waitable объектом рендер ждёт свободного места в очереди
+    // и только потом берёт самый свежий кадр из TripleBuffer.
+    UINT   bufferCount  = 2;        // задаётся до init()
+    UINT   maxLatency   = 1;        // 0 — не трогаем (DXGI default), без waitable
+    HANDLE latencyWait  = nullptr;
+
+    // Метка и номер последнего Present — для сопоставления со статистикой DXGI.
+    int64_t lastPresentQpc = 0;
+    UINT    lastPresentId  = 0;
+    HRESULT presentResult  = S_OK;   // DEVICE_REMOVED / RESET — TDR, см. main
+
+    // Адаптер монитора окна (DisplayOutput::adapterLuid), задаётся до init();
+    // нулевой — адаптер по умолчанию.
+    LUID adapterLuid = {};
+
+    bool init(HWND hwnd, int w, int h) { return createDevice() && createPipeline(hwnd, w, h); }
+
+    // Только устройство и контекст: MF-захвату больше ничего не нужно, и
+    // захват открывается параллельно с createPipeline.
+    bool createDevice()
+    {
+        // VIDEO_SUPPORT нужен MF device manager'у (декодеры/процессоры MF),
+        // на старых драйверах без него создаём обычное устройство.
+        // С явным адаптером тип драйвера — UNKNOWN. После TDR адаптер ищется
+        // заново: старый объект мог пропасть вместе с драйвером.
+        D3D_FEATURE_LEVEL fl = D3D_FEATURE_LEVEL_11_0;
+        const UINT flags = D3D11_CREATE_DEVICE_VIDEO_SUPPORT | D3D11_CREATE_DEVICE_BGRA_SUPPORT;
+        IDXGIAdapter1* adapter = findAdapter(adapterLuid);
+        const D3D_DRIVER_TYPE type = adapter ? D3D_DRIVER_TYPE_UNKNOWN : D3D_DRIVER_TYPE_HARDWARE;
+        const bool ok =
+            SUCCEEDED(D3D11CreateDevice(adapter, type, nullptr, flags, &fl, 1, D3D11_SDK_VERSION,
+                                        &device, nullptr, &ctx)) ||
+            SUCCEEDED(D3D11CreateDevice(adapter, type, nullptr, 0, &fl, 1, D3D11_SDK_VERSION,
+                                        &device, nullptr, &ctx));
+        if (adapter) adapter->Release();
+        if (!ok) { std::cerr << "[DX11] CreateDevice failed\n"; return false; }
+
+        // MF-бэкенд обращается к устройству со своих потоков.
+        ID3D11Multithread* mt = nullptr;
+        if (SUCCEEDED(ctx->QueryInterface(__uuidof(ID3D11Multithread),
+                                          reinterpret_cast<void**>(&mt)))) {
+            mt->SetMultithreadProtected(TRUE);
+            mt->Release();
+        }
+        return true;
+    }
+
+    // Swap chain, шейдеры и всё остальное — после createDevice.
+    bool createPipeline(HWND hwnd, int w, int h)
+    {
+        winW = bufW = w; winH = bufH = h;
+
+        IDXGIFactory2* factory = nullptr;
+        {
+            IDXGIDevice*  dxgiDev = nullptr;
             IDXGIAdapter* adapter = nullptr;
             device->QueryInterface(__uuidof(IDXGIDevice),  reinterpret_cast<void**>(&dxgiDev));
             dxgiDev->GetAdapter(&adapter);
             adapter->GetParent(__uuidof(IDXGIFactory2), reinterpret_cast<void**>(&factory));
+            // Auto: HDR10 даёт выигрыш только PQ / HLG источнику, и только
+            // если Windows HDR на этом мониторе включён.
+            hdr10 = output == OutputMode::HDR10 ||
+                    (output == OutputMode::Auto && transfer != TransferFn::SDR &&
+                     outputIsHdr(adapter, hwnd));
             adapter->Release(); dxgiDev->Release();
         }
 
@@ -705,166 +5497,1152 @@ struct DX11Renderer {
 
         DXGI_SWAP_CHAIN_DESC1 scd = {};
         scd.Width       = w; scd.Height = h;
-        scd.Format      = DXGI_FORMAT_R8G8B8A8_UNORM;
-        scd.BufferCount = 2;
+        // Плоскости overlay чаще всего принимают BGRA, а не RGBA.
+        scd.Format      = hdr10   ? DXGI_FORMAT_R10G10B10A2_UNORM
+                        : scanout ? DXGI_FORMAT_B8G8R8A8_UNORM : DXGI_FORMAT_R8G8B8A8_UNORM;
+        scd.BufferCount = bufferCount;
         scd.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
         scd.SwapEffect  = DXGI_SWAP_EFFECT_FLIP_DISCARD;
         scd.SampleDesc  = { 1, 0 };
         scd.Flags       = tearingOk ? DXGI_SWAP_CHAIN_FLAG_ALLOW_TEARING : 0;
+        if (maxLatency > 0)
+            scd.Flags  |= DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT;
 
         if (FAILED(factory->CreateSwapChainForHwnd(device, hwnd, &scd,
                                                     nullptr, nullptr, &swapChain))) {
             std::cerr << "[DX11] CreateSwapChain failed\n";
             factory->Release(); return false;
         }
+        if (hdr10 && !setHdrColorSpace()) {
+            // 10 бит остаются, цветовое пространство — обычное sRGB.
+            std::cerr << "[WARN] HDR10 color space not supported, using SDR output\n";
+            hdr10 = false;
+        }
+
+        if (maxLatency > 0) {
+            IDXGISwapChain2* sc2 = nullptr;
+            if (SUCCEEDED(swapChain->QueryInterface(__uuidof(IDXGISwapChain2),
+                                                    reinterpret_cast<void**>(&sc2)))) {
+                sc2->SetMaximumFrameLatency(maxLatency);
+                latencyWait = sc2->GetFrameLatencyWaitableObject();
+                sc2->Release();
+            }
+        }
+
+        swapChain->QueryInterface(__uuidof(IDXGISwapChainMedia), reinterpret_cast<void**>(&media));
+        queryOverlaySupport(scd.Format);
+        if (scanout && !overlayScaling) {
+            std::cerr << "[WARN] --scanout: no overlay plane scaling on this display, "
+                         "keeping GPU scaling\n";
+            scanout = false;
+        }
+
+        IDXGIFactory1* f1 = nullptr;
+        swapChain->GetParent(__uuidof(IDXGIFactory1), reinterpret_cast<void**>(&f1));
+        if (f1) { f1->MakeWindowAssociation(hwnd, DXGI_MWA_NO_ALT_ENTER); f1->Release(); }
+        factory->Release();
+
+        if (!rebuildRTV()) return false;
+        if (!createShaders()) return false;
+
+        D3D11_SAMPLER_DESC sd = {};
+        sd.Filter   = D3D11_FILTER_MIN_MAG_MIP_POINT;
+        sd.AddressU = sd.AddressV = sd.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
+        device->CreateSamplerState(&sd, &sampler);
+        sd.Filter   = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
+        device->CreateSamplerState(&sd, &linearSampler);
+
+        D3D11_BUFFER_DESC cbd = {};
+        cbd.ByteWidth = 16;
+        cbd.Usage     = D3D11_USAGE_DEFAULT;
+        cbd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+        device->CreateBuffer(&cbd, nullptr, &scaleCB);
+        cbd.ByteWidth = sizeof(ColorParams);
+        device->CreateBuffer(&cbd, nullptr, &colorCB);
+        device->CreateBuffer(&cbd, nullptr, &colorSdrCB);
+        if (!colorCB || !colorSdrCB) {
+            std::cerr << "[DX11] CreateBuffer (color) failed\n"; return false;
+        }
+        updateColor();
+
+        if (!gpuTimer.init(device))
+            std::cerr << "[WARN] GPU timestamp queries unavailable\n";
+
+        // Без оверлея видео работает как обычно — не фатально.
+        if (!overlay.init(device, shaders, (std::max)(14, winH / 54), hdr10 ? colorCB : nullptr))
+            std::cerr << "[WARN] Overlay init failed, stats overlay disabled\n";
+
+        if (shaders.compiled > 0)
+            std::cerr << "[INFO] " << shaders.compiled << " shader variant(s) compiled at "
+                         "runtime, run build_shaders.cmd to embed them\n";
+
+        return true;
+    }
+
+    void setOverlay(const std::string& text) { overlayText = text; }
+
+    // PQ BT.2020 на swap chain и метаданные HDR10: пик мастеринга и MaxCLL —
+    // --peak-nits, без них дисплей масштабирует по своим догадкам.
+    bool setHdrColorSpace()
+    {
+        IDXGISwapChain3* sc3 = nullptr;
+        if (FAILED(swapChain->QueryInterface(__uuidof(IDXGISwapChain3),
+                                             reinterpret_cast<void**>(&sc3))))
+            return false;
+        const DXGI_COLOR_SPACE_TYPE cs = DXGI_COLOR_SPACE_RGB_FULL_G2084_NONE_P2020;
+        UINT support = 0;
+        const bool ok = SUCCEEDED(sc3->CheckColorSpaceSupport(cs, &support)) &&
+                        (support & DXGI_SWAP_CHAIN_COLOR_SPACE_SUPPORT_FLAG_PRESENT) &&
+                        SUCCEEDED(sc3->SetColorSpace1(cs));
+        IDXGISwapChain4* sc4 = nullptr;
+        if (ok && SUCCEEDED(sc3->QueryInterface(__uuidof(IDXGISwapChain4),
+                                                reinterpret_cast<void**>(&sc4)))) {
+            // Основные цвета BT.2020 и белая точка D65, шаг 0.00002.
+            DXGI_HDR_METADATA_HDR10 md = {};
+            md.RedPrimary[0]   = 35400; md.RedPrimary[1]   = 14600;
+            md.GreenPrimary[0] = 8500;  md.GreenPrimary[1] = 39850;
+            md.BluePrimary[0]  = 6550;  md.BluePrimary[1]  = 2300;
+            md.WhitePoint[0]   = 15635; md.WhitePoint[1]   = 16450;
+            md.MaxMasteringLuminance     = static_cast<UINT>(peakNits);
+            md.MinMasteringLuminance     = 1;                  // 0.0001 нит
+            md.MaxContentLightLevel      = static_cast<UINT16>(peakNits);
+            md.MaxFrameAverageLightLevel = static_cast<UINT16>(whiteNits);
+            sc4->SetHDRMetaData(DXGI_HDR_METADATA_TYPE_HDR10, sizeof(md), &md);
+            sc4->Release();
+        }
+        sc3->Release();
+        return ok;
+    }
+
+    // Плоскости overlay выхода, на котором окно: есть ли они вообще и может
+    // ли плоскость формата back buffer масштабировать.
+    void queryOverlaySupport(DXGI_FORMAT fmt)
+    {
+        IDXGIOutput* out = nullptr;
+        if (FAILED(swapChain->GetContainingOutput(&out))) return;
+        IDXGIOutput2* o2 = nullptr;
+        if (SUCCEEDED(out->QueryInterface(__uuidof(IDXGIOutput2), reinterpret_cast<void**>(&o2)))) {
+            overlayPlanes = o2->SupportsOverlays() == TRUE;
+            o2->Release();
+        }
+        IDXGIOutput3* o3 = nullptr;
+        UINT flags = 0;
+        if (overlayPlanes &&
+            SUCCEEDED(out->QueryInterface(__uuidof(IDXGIOutput3), reinterpret_cast<void**>(&o3)))) {
+            if (SUCCEEDED(o3->CheckOverlaySupport(fmt, device, &flags)))
+                overlayScaling = (flags & DXGI_OVERLAY_SUPPORT_FLAG_SCALING) != 0;
+            o3->Release();
+        }
+        out->Release();
+    }
+
+    // --scanout: окно SetSourceSize с пропорциями экрана, в которое источник
+    // помещается 1:1. Только один слой, bilinear (фильтр плоскости —
+    // билинейный или лучше) и увеличение; иначе — весь back buffer и
+    // масштаб на GPU.
+    void fitSourceSize()
+    {
+        const VideoLayer& L = layers[0];
+        int w = bufW, h = bufH;
+        if (scanout && layers.size() == 1 && scaleMode == ScaleMode::Bilinear && L.texW > 0) {
+            const double k = (std::min)((double)bufW / L.texW, (double)bufH / L.texH);
+            if (k > 1.0) {
+                w = (std::min)(bufW, (int)std::lround(bufW / k));
+                h = (std::min)(bufH, (int)std::lround(bufH / k));
+            }
+        }
+        if (w == winW && h == winH) return;
+        IDXGISwapChain2* sc2 = nullptr;
+        if (FAILED(swapChain->QueryInterface(__uuidof(IDXGISwapChain2),
+                                             reinterpret_cast<void**>(&sc2))))
+            return;
+        const bool ok = SUCCEEDED(sc2->SetSourceSize(w, h));
+        sc2->Release();
+        if (!ok) { scanout = false; return; }   // полный размер принимается всегда
+        winW = w; winH = h;
+        contentChanged = true;
+    }
+
+    // Путь кадра по статистике DXGI, раз в секунду из present(). Если DWM
+    // композирует и окно SetSourceSize, масштабирует тоже DWM: три проверки
+    // подряд — и --scanout выключается, масштаб снова на GPU.
+    void checkPresentPath()
+    {
+        pathCheckQpc = lastPresentQpc;
+        DXGI_FRAME_STATISTICS_MEDIA st = {};
+        if (!media || FAILED(media->GetFrameStatisticsMedia(&st))) return;   // DISJOINT
+        switch (st.CompositionMode) {
+        case DXGI_FRAME_PRESENTATION_MODE_OVERLAY:  presentPath = PresentPath::Direct;   break;
+        case DXGI_FRAME_PRESENTATION_MODE_COMPOSED:
+        case DXGI_FRAME_PRESENTATION_MODE_COMPOSITION_FAILURE:
+                                                    presentPath = PresentPath::Composed; break;
+        default:                                    presentPath = PresentPath::Unknown;  break;
+        }
+        ++pathChecks[static_cast<int>(presentPath)];
+        if (presentPath != PresentPath::Composed || winW == bufW) { composedRun = 0; return; }
+        if (++composedRun < 3) return;
+        std::cerr << "[WARN] --scanout: DWM composes the scaled swap chain, back to GPU scaling\n";
+        scanout = false;
+        fitSourceSize();
+    }
+
+    // Для оверлея и отчётов.
+    std::string presentPathLabel() const
+    {
+        std::string l = presentPathName(presentPath);
+        if (winW != bufW || winH != bufH) l += ", overlay scaling";
+        return l;
+    }
+
+    // Наиболее частый путь за сессию — для отчёта калибровки.
+    PresentPath sessionPath() const
+    {
+        int best = 0;
+        for (int i = 1; i < PRESENT_PATH_COUNT; ++i)
+            if (pathChecks[i] > pathChecks[best]) best = i;
+        return static_cast<PresentPath>(best);
+    }
+
+    // ColorParams экрана и записи. До createPipeline буферов ещё нет —
+    // значения возьмёт updateColor из createPipeline.
+    void updateColor()
+    {
+        if (!colorCB) return;
+        const ColorParams screen = makeColorParams(matrix, range, transfer, hdr10, peakNits, whiteNits);
+        const ColorParams sdr    = makeColorParams(matrix, range, transfer, false, peakNits, whiteNits);
+        ctx->UpdateSubresource(colorCB,    0, nullptr, &screen, 0, 0);
+        ctx->UpdateSubresource(colorSdrCB, 0, nullptr, &sdr,    0, 0);
+    }
+
+    bool createShaders()
+    {
+        ShaderKey vsKey;
+        vsKey.program = ShaderProgram::FullscreenVS;
+        if (!shaders.createVS(device, vsKey, &vs)) return false;
+        for (PixelFormat f : { PixelFormat::BGR24, PixelFormat::YUY2, PixelFormat::NV12,
+                               PixelFormat::P010 }) {
+            ShaderKey k;
+            k.format = f;
+            if (!shaders.createPS(device, k, &ps[static_cast<int>(f)])) return false;
+        }
+
+        ShaderKey k;
+        k.program = ShaderProgram::ScalePS;
+        k.scaler  = ScaleMode::Bilinear;
+        if (!shaders.createPS(device, k, &psScale[static_cast<int>(ScaleMode::Bilinear)][0]))
+            return false;
+        for (ScaleMode m : { ScaleMode::Bicubic, ScaleMode::Lanczos })
+            for (int axis = 0; axis < 2; ++axis) {
+                k.scaler = m;
+                k.axisY  = (axis == 1);
+                if (!shaders.createPS(device, k, &psScale[static_cast<int>(m)][axis]))
+                    return false;
+            }
+        return true;
+    }
+
+    // Матрица известна только после согласования формата с устройством,
+    // а MF-бэкенду устройство нужно раньше — меняем только ColorParams.
+    void setColorMatrix(ColorMatrix m)
+    {
+        if (m == matrix) return;
+        matrix = m;
+        updateColor();
+    }
+
+    bool rebuildRTV()
+    {
+        if (rtv) { rtv->Release(); rtv = nullptr; }
+        ID3D11Texture2D* back = nullptr;
+        swapChain->GetBuffer(0, __uuidof(ID3D11Texture2D),
+                             reinterpret_cast<void**>(&back));
+        if (!back) return false;
+        device->CreateRenderTargetView(back, nullptr, &rtv);
+        back->Release();
+        return rtv != nullptr;
+    }
+
+    void releaseTexture(VideoLayer& L)
+    {
+        if (L.srv)     { L.srv->Release();     L.srv     = nullptr; }
+        if (L.srvUV)   { L.srvUV->Release();   L.srvUV   = nullptr; }
+        if (L.dynTex)  { L.dynTex->Release();  L.dynTex  = nullptr; }
+        if (L.copyTex) { L.copyTex->Release(); L.copyTex = nullptr; }
+        for (auto* t : L.staging) t->Release();
+        L.staging.clear();
+        L.stagingNext = 0;
+        L.texW = L.texH = 0;
+        L.texSrc = TexSource::None;
+        L.dirty.valid = false;
+        contentChanged = true;
+    }
+
+    // View для шейдера. YUY2 (в том числе DXGI_FORMAT_YUY2 из MF) читается как
+    // R8G8B8A8 половинной ширины, у NV12 / P010 формат view выбирает
+    // плоскость: R8 / R16 — Y, R8G8 / R16G16 — UV.
+    bool createViews(VideoLayer& L, ID3D11Texture2D* tex, PixelFormat fmt)
+    {
+        D3D11_SHADER_RESOURCE_VIEW_DESC vd = {};
+        vd.ViewDimension       = D3D11_SRV_DIMENSION_TEXTURE2D;
+        vd.Texture2D.MipLevels = 1;
+        if (isPlanar(fmt)) {
+            const bool wide = (fmt == PixelFormat::P010);
+            vd.Format = wide ? DXGI_FORMAT_R16_UNORM : DXGI_FORMAT_R8_UNORM;
+            device->CreateShaderResourceView(tex, &vd, &L.srv);
+            vd.Format = wide ? DXGI_FORMAT_R16G16_UNORM : DXGI_FORMAT_R8G8_UNORM;
+            device->CreateShaderResourceView(tex, &vd, &L.srvUV);
+            return L.srv && L.srvUV;
+        }
+        vd.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+        device->CreateShaderResourceView(tex, &vd, &L.srv);
+        return L.srv != nullptr;
+    }
+
+    // CPU кадр. YUY2: одна RGBA texel на пару пикселей — текстура половинной
+    // ширины, 4 MB на 1080p кадр вместо 8 MB у BGRA. NV12 / P010 — родные
+    // двухплоскостные текстуры, 3 / 6 MB на 1080p.
+    //   Dynamic — одна DYNAMIC текстура, MAP_WRITE_DISCARD каждый кадр;
+    //   Ring    — N STAGING текстур + DEFAULT текстура для шейдера;
+    //   Slots   — только DEFAULT, staging держит UploadSlots.
+    void ensureTexture(VideoLayer& L, int w, int h, PixelFormat fmt)
+    {
+        ensureTexture(L, w, h, fmt, (uploadMode == UploadMode::Ring) ? TexSource::Ring
+                                                                     : TexSource::Dynamic);
+    }
+
+    void ensureTexture(VideoLayer& L, int w, int h, PixelFormat fmt, TexSource want)
+    {
+        if (L.texW == w && L.texH == h && L.texFmt == fmt && L.texSrc == want) return;
+        releaseTexture(L);
+
+        D3D11_TEXTURE2D_DESC td = {};
+        td.Width          = (fmt == PixelFormat::YUY2) ? w / 2 : w;
+        td.Height         = h;
+        td.MipLevels      = 1; td.ArraySize = 1;
+        td.Format         = (fmt == PixelFormat::NV12) ? DXGI_FORMAT_NV12
+                          : (fmt == PixelFormat::P010) ? DXGI_FORMAT_P010
+                                                       : DXGI_FORMAT_R8G8B8A8_UNORM;
+        td.SampleDesc     = { 1, 0 };
+        td.Usage          = D3D11_USAGE_DYNAMIC;
+        td.BindFlags      = D3D11_BIND_SHADER_RESOURCE;
+        td.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+
+        ID3D11Texture2D** sampled = &L.dynTex;
+        if (want != TexSource::Dynamic) {
+            td.Usage          = D3D11_USAGE_DEFAULT;
+            td.CPUAccessFlags = 0;
+            sampled           = &L.copyTex;
+        }
+        if (FAILED(device->CreateTexture2D(&td, nullptr, sampled))) {
+            std::cerr << "[DX11] CreateTexture2D failed (" << w << "x" << h << ")\n";
+            return;
+        }
+        if (want == TexSource::Ring) {
+            td.Usage          = D3D11_USAGE_STAGING;
+            td.BindFlags      = 0;
+            td.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+            for (int i = 0; i < stagingCount; ++i) {
+                ID3D11Texture2D* t = nullptr;
+                if (FAILED(device->CreateTexture2D(&td, nullptr, &t))) {
+                    std::cerr << "[DX11] CreateTexture2D (staging) failed\n";
+                    releaseTexture(L);
+                    return;
+                }
+                L.staging.push_back(t);
+            }
+        }
+        if (!createViews(L, *sampled, fmt)) {
+            std::cerr << "[DX11] CreateShaderResourceView failed\n";
+            releaseTexture(L);
+            return;
+        }
+        L.texW = w; L.texH = h; L.texFmt = fmt; L.texSrc = want;
+    }
+
+    // Кадр MF в видеопамяти: текстуры пула MF обычно без BIND_SHADER_RESOURCE
+    // (и часто это слайс массива), поэтому копируем на GPU в свою DEFAULT
+    // текстуру того же формата (YUY2, NV12 или P010 — те же шейдеры, что и
+    // для CPU пути).
+    void ensureCopyTexture(VideoLayer& L, int w, int h, DXGI_FORMAT fmt)
+    {
+        const PixelFormat pf = (fmt == DXGI_FORMAT_NV12) ? PixelFormat::NV12
+                             : (fmt == DXGI_FORMAT_P010) ? PixelFormat::P010 : PixelFormat::YUY2;
+        if (L.texW == w && L.texH == h && L.texFmt == pf && L.texSrc == TexSource::GpuCopy) return;
+        releaseTexture(L);
+
+        D3D11_TEXTURE2D_DESC td = {};
+        td.Width      = w; td.Height = h;
+        td.MipLevels  = 1; td.ArraySize = 1;
+        td.Format     = fmt;
+        td.SampleDesc = { 1, 0 };
+        td.Usage      = D3D11_USAGE_DEFAULT;
+        td.BindFlags  = D3D11_BIND_SHADER_RESOURCE;
+
+        if (FAILED(device->CreateTexture2D(&td, nullptr, &L.copyTex))) {
+            std::cerr << "[DX11] CreateTexture2D failed (" << w << "x" << h
+                      << ", DXGI format " << fmt << ")\n";
+            return;
+        }
+        if (!createViews(L, L.copyTex, pf)) {
+            std::cerr << "[DX11] CreateShaderResourceView failed\n";
+            releaseTexture(L);
+            return;
+        }
+        L.texW = w; L.texH = h; L.texFmt = pf; L.texSrc = TexSource::GpuCopy;
+    }
+
+    void uploadGpuFrame(VideoLayer& L, const Frame& frame)
+    {
+        D3D11_TEXTURE2D_DESC sd = {};
+        frame.gpuTex->GetDesc(&sd);
+        if (sd.Format != DXGI_FORMAT_YUY2 && sd.Format != DXGI_FORMAT_NV12 &&
+            sd.Format != DXGI_FORMAT_P010)
+            return;                                 // другие форматы MF не заказываем
+
+        ensureCopyTexture(L, frame.width, frame.height, sd.Format);
+        if (!L.copyTex) return;
+
+        // Пул MF может быть выровнен (1088 строк) — копируем видимую область.
+        // Для NV12 / P010 box задаётся в координатах Y, плоскость UV — сама.
+        D3D11_BOX box = { 0, 0, 0, static_cast<UINT>(frame.width),
+                          static_cast<UINT>(frame.height), 1 };
+        ctx->CopySubresourceRegion(L.copyTex, 0, 0, 0, 0, frame.gpuTex, frame.gpuSub, &box);
+    }
+
+    struct RowJob {
+        const Frame* frame;
+        uint8_t*     dst;
+        UINT         dstPitch;
+        BgrToBgraFn  bgrToBgra;
+        int          x0 = 0, x1 = INT_MAX;   // столбцы пикселей (--dirty: серия тайлов)
+    };
+
+    // Строки [y0, y1) кадра → mapped memory. Вызывается из StripePool.
+    static void convertRows(void* p, int y0, int y1)
+    {
+        const RowJob& j  = *static_cast<const RowJob*>(p);
+        const Frame&  f  = *j.frame;
+        const int     x0 = j.x0, x1 = (std::min)(j.x1, f.width);
+        if (isPlanar(f.format)) {
+            // Плоскость UV в mapped NV12 / P010 идёт сразу за Y: pData +
+            // RowPitch * Height. Строки UV [ceil(y0/2), ceil(y1/2)) — полосы
+            // не пересекаются.
+            const size_t bpp      = (f.format == PixelFormat::P010) ? 2 : 1;
+            const size_t off      = x0 * bpp;
+            const size_t rowBytes = (x1 - x0) * bpp;
+            for (int y = y0; y < y1; ++y)
+                memcpy(j.dst + static_cast<size_t>(y) * j.dstPitch + off, f.row(y) + off, rowBytes);
+            uint8_t* uvDst = j.dst + static_cast<size_t>(f.height) * j.dstPitch;
+            for (int y = (y0 + 1) / 2; y < (y1 + 1) / 2 && y < f.height / 2; ++y)
+                memcpy(uvDst + static_cast<size_t>(y) * j.dstPitch + off, f.uvRow(y) + off, rowBytes);
+        } else if (f.format == PixelFormat::YUY2) {
+            // Сырой 4:2:2 — без конвертации, построчно из-за RowPitch.
+            const size_t off      = static_cast<size_t>(x0 / 2) * 4;
+            const size_t rowBytes = static_cast<size_t>(x1 / 2 - x0 / 2) * 4;
+            for (int y = y0; y < y1; ++y)
+                memcpy(j.dst + static_cast<size_t>(y) * j.dstPitch + off, f.row(y) + off, rowBytes);
+        } else {
+            for (int y = y0; y < y1; ++y)
+                j.bgrToBgra(f.row(y) + static_cast<size_t>(x0) * 3,
+                            j.dst + static_cast<size_t>(y) * j.dstPitch + static_cast<size_t>(x0) * 4,
+                            x1 - x0);
+        }
+    }
+
+    // Ring: берём следующий staging слот без ожидания. Слот, который GPU ещё
+    // копирует, даёт DXGI_ERROR_WAS_STILL_DRAWING — пробуем следующий. Если
+    // заняты все, кадр пропускается: лучше показать предыдущий, чем
+    // заблокировать поток рендера до конца копирования.
+    ID3D11Texture2D* mapStaging(VideoLayer& L, D3D11_MAPPED_SUBRESOURCE& mapped)
+    {
+        for (size_t tries = 0; tries < L.staging.size(); ++tries) {
+            ID3D11Texture2D* t = L.staging[L.stagingNext];
+            L.stagingNext = (L.stagingNext + 1) % static_cast<int>(L.staging.size());
+            HRESULT hr = ctx->Map(t, 0, D3D11_MAP_WRITE, D3D11_MAP_FLAG_DO_NOT_WAIT, &mapped);
+            if (SUCCEEDED(hr)) return t;
+            if (hr != DXGI_ERROR_WAS_STILL_DRAWING) return nullptr;
+        }
+        ++stagingStalls;
+        return nullptr;
+    }
+
+    // --dirty: хеши тайлов (полосами, если кадр большой), и если что-то
+    // изменилось — в staging пишутся только изменившиеся тайлы, а в copyTex
+    // копируются они же, прямоугольником на серию соседних тайлов в строке.
+    // Остальная часть staging слота устарела, но из неё и не копируют.
+    void uploadDirty(VideoLayer& L, const Frame& frame)
+    {
+        if (!L.dirty.matches(frame)) L.dirty.reset(frame.width, frame.height, frame.format);
+        L.dirty.frame = &frame;
+        const long long pixels = static_cast<long long>(frame.width) * frame.height;
+        if (stripePool && stripePool->workers() > 0 && pixels >= stripeMinPixels)
+            stripePool->run(L.dirty.rows, &DirtyTiles::hashRows, &L.dirty);
+        else
+            DirtyTiles::hashRows(&L.dirty, 0, L.dirty.rows);
+        L.dirty.frame = nullptr;
+
+        tilesTotal += L.dirty.hash.size();
+        if (L.dirty.countDirty() == 0) return;
+
+        D3D11_MAPPED_SUBRESOURCE mapped = {};
+        ID3D11Texture2D* target = mapStaging(L, mapped);
+        if (!target) return;                        // хеши не приняты — повторим
+
+        RowJob job { &frame, static_cast<uint8_t*>(mapped.pData), mapped.RowPitch, bgrToBgra };
+        const bool full = !L.dirty.valid;
+        if (full) convertRows(&job, 0, frame.height);
+        std::vector<D3D11_BOX>& boxes = L.dirtyBoxes;
+        boxes.clear();
+        for (int ty = 0; ty < L.dirty.rows && !full; ++ty) {
+            const int y0 = ty * DIRTY_TILE, y1 = (std::min)(y0 + DIRTY_TILE, frame.height);
+            for (int tx = 0; tx < L.dirty.cols; ) {
+                if (!L.dirty.isDirty(tx, ty)) { ++tx; continue; }
+                int end = tx;
+                while (end < L.dirty.cols && L.dirty.isDirty(end, ty)) ++end;
+                job.x0 = tx * DIRTY_TILE;
+                job.x1 = (std::min)(end * DIRTY_TILE, frame.width);
+                convertRows(&job, y0, y1);
+                // Текстура YUY2 — половинной ширины; у NV12 / P010 box в
+                // координатах Y, UV копируется вместе с ним.
+                const UINT div = (frame.format == PixelFormat::YUY2) ? 2 : 1;
+                boxes.push_back({ static_cast<UINT>(job.x0) / div, static_cast<UINT>(y0), 0,
+                                  static_cast<UINT>(job.x1) / div, static_cast<UINT>(y1), 1 });
+                tx = end;
+            }
+        }
+        ctx->Unmap(target, 0);
+
+        if (full) ctx->CopyResource(L.copyTex, target);
+        for (const D3D11_BOX& b : boxes)
+            ctx->CopySubresourceRegion(L.copyTex, 0, b.left, b.top, 0, target, 0, &b);
+
+        tilesUploaded += L.dirty.dirtyCount;
+        L.dirty.commit();
+        contentChanged = true;
+    }
+
+    // layer — индекс в layers (--devices), 0 — основной источник.
+    void uploadFrame(const Frame& frame, size_t layer = 0)
+    {
+        VideoLayer& L = layers[layer];
+        if (frame.gpuTex) { uploadGpuFrame(L, frame); contentChanged = true; return; }
+        if (frame.uploadSlot >= 0) { uploadSlotFrame(L, frame); return; }
+
+        ensureTexture(L, frame.width, frame.height, frame.format);
+        if (!L.srv) return;
+        if (dirtyTracking && L.texSrc == TexSource::Ring) { uploadDirty(L, frame); return; }
+
+        D3D11_MAPPED_SUBRESOURCE mapped = {};
+        ID3D11Texture2D* target = L.dynTex;
+        if (L.texSrc == TexSource::Ring) {
+            target = mapStaging(L, mapped);
+            if (!target) return;
+        } else if (FAILED(ctx->Map(L.dynTex, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped))) {
+            return;
+        }
+
+        RowJob job { &frame, static_cast<uint8_t*>(mapped.pData), mapped.RowPitch, bgrToBgra };
+        const long long pixels = static_cast<long long>(frame.width) * frame.height;
+        if (stripePool && stripePool->workers() > 0 && pixels >= stripeMinPixels)
+            stripePool->run(frame.height, &DX11Renderer::convertRows, &job);
+        else
+            convertRows(&job, 0, frame.height);
+        ctx->Unmap(target, 0);
+
+        // Копия staging → DEFAULT встаёт в очередь GPU перед Draw и идёт
+        // параллельно с заполнением следующего слота на CPU.
+        if (L.texSrc == TexSource::Ring)
+            ctx->CopyResource(L.copyTex, target);
+        contentChanged = true;
+    }
+
+    // Кадр уже записан потоком захвата в staging слот — только копия на GPU.
+    // Слот забирается и при ошибке текстуры: Unmapped слот pump вернёт в оборот.
+    void uploadSlotFrame(VideoLayer& L, const Frame& frame)
+    {
+        ID3D11Texture2D* slot = uploadSlots.take(ctx, frame.uploadSlot);
+        ensureTexture(L, frame.width, frame.height, frame.format, TexSource::Slots);
+        if (!L.srv || !slot) return;
+        ctx->CopyResource(L.copyTex, slot);
+        contentChanged = true;
+    }
+
+    // Слоты под кадры источника w x h. Вызывается до первого кадра, при
+    // ошибке захват пишет в TripleBuffer как обычно.
+    bool createUploadSlots(int w, int h, PixelFormat fmt)
+    {
+        return uploadSlots.create(device, ctx, w, h, fmt, (std::max)(3, stagingCount));
+    }
+
+    // Промежуточные цели под текущий кадр и окно. decoded хранит 10 бит
+    // P010 и PQ сигнал HDR10 во float16 (в 8 битах PQ даёт полосы), pass —
+    // звон отрицательных лепестков между проходами.
+    bool ensureScaleTargets(VideoLayer& L, float dstW, float dstH)
+    {
+        const DXGI_FORMAT decFmt = (L.texFmt == PixelFormat::P010 || hdr10)
+                                 ? DXGI_FORMAT_R16G16B16A16_FLOAT : DXGI_FORMAT_R8G8B8A8_UNORM;
+        if (!L.decoded.ensure(device, L.texW, L.texH, decFmt)) return false;
+        if (scaleMode != ScaleMode::Bilinear &&
+            !L.pass.ensure(device, (std::max)(1, (int)(dstW + 0.5f)), L.texH,
+                           DXGI_FORMAT_R16G16B16A16_FLOAT))
+            return false;
+        if (dstW != scaleDstW || dstH != scaleDstH) {
+            const float cb[4] = { dstW, dstH, 0.0f, 0.0f };
+            ctx->UpdateSubresource(scaleCB, 0, nullptr, cb, 0, 0);
+            scaleDstW = dstW; scaleDstH = dstH;
+        }
+        return true;
+    }
+
+    // color — ColorParams декодирующего прохода, по умолчанию экранные.
+    void drawPass(ID3D11RenderTargetView* target, const D3D11_VIEWPORT& vp,
+                  ID3D11PixelShader* shader, ID3D11ShaderResourceView* t0,
+                  ID3D11ShaderResourceView* t1, ID3D11SamplerState* samp,
+                  ID3D11Buffer* color = nullptr)
+    {
+        // target мог быть входом предыдущего прохода — сначала снимаем SRV.
+        ID3D11ShaderResourceView* none[2] = {};
+        ctx->PSSetShaderResources(0, 2, none);
+        ctx->OMSetRenderTargets(1, &target, nullptr);
+        ctx->RSSetViewports(1, &vp);
+        ctx->PSSetShader(shader, nullptr, 0);
+        ID3D11ShaderResourceView* views[2] = { t0, t1 };
+        ctx->PSSetShaderResources(0, 2, views);
+        ctx->PSSetSamplers(0, 1, &samp);
+        ID3D11Buffer* cbs[2] = { scaleCB, color ? color : colorCB };
+        ctx->PSSetConstantBuffers(0, 2, cbs);
+        ctx->Draw(3, 0);
+    }
+
+    // Ячейка слоя k. Grid — ceil(sqrt(n)) столбцов, слои по строкам;
+    // Pip — слой 0 на всё окно, остальные — врезки в четверть окна по три
+    // в столбик от правого нижнего угла (рисуются после слоя 0, поверх него).
+    LayerCell layerCell(size_t k) const
+    {
+        const size_t n = layers.size();
+        const float  W = (float)winW, H = (float)winH;
+        if (n <= 1 || (layout == LayoutMode::Pip && k == 0)) return { 0.0f, 0.0f, W, H };
+        if (layout == LayoutMode::Pip) {
+            const float margin = std::floor(H / 40.0f);
+            const float w = std::floor(W / 4.0f), h = std::floor(H / 4.0f);
+            const size_t col = (k - 1) / 3, row = (k - 1) % 3;
+            return { W - (col + 1) * (w + margin), H - (row + 1) * (h + margin), w, h };
+        }
+        const size_t cols = static_cast<size_t>(std::ceil(std::sqrt((double)n)));
+        const size_t rows = (n + cols - 1) / cols;
+        const float  w = std::floor(W / cols), h = std::floor(H / rows);
+        return { (k % cols) * w, (k / cols) * h, w, h };
+    }
+
+    // Слой в свою ячейку: декодирование и масштабирование, как для одного
+    // источника. Возвращает viewport видео внутри ячейки.
+    D3D11_VIEWPORT drawLayer(VideoLayer& L, const LayerCell& cell)
+    {
+        // Integer: наибольший целый масштаб, который влезает в ячейку, и целые
+        // координаты viewport — каждый пиксель источника ровно k x k.
+        // Источник больше ячейки так не показать — тогда как Nearest.
+        const bool integer = (scaleMode == ScaleMode::Integer);
+        float scale = (std::min)(cell.w / (float)L.texW, cell.h / (float)L.texH);
+        if (integer && scale >= 1.0f) scale = std::floor(scale);
+        float vpW = L.texW * scale;
+        float vpH = L.texH * scale;
+        float vpX = cell.x + (cell.w - vpW) * 0.5f;
+        float vpY = cell.y + (cell.h - vpH) * 0.5f;
+        if (integer) { vpX = std::floor(vpX); vpY = std::floor(vpY); }
+        const D3D11_VIEWPORT vp = { vpX, vpY, vpW, vpH, 0.0f, 1.0f };
+
+        ID3D11PixelShader* decode = ps[static_cast<int>(L.texFmt)];
+        const bool direct = scaleMode == ScaleMode::Nearest || integer ||
+                            (vpW == (float)L.texW && vpH == (float)L.texH);
+        if (!direct && !ensureScaleTargets(L, vpW, vpH)) {
+            std::cerr << "[WARN] Scaler disabled, falling back to nearest\n";
+            scaleMode = ScaleMode::Nearest;
+        }
+        if (direct || scaleMode == ScaleMode::Nearest) {
+            drawPass(rtv, vp, decode, L.srv, L.srvUV, sampler);
+        } else {
+            const D3D11_VIEWPORT src = { 0.0f, 0.0f, (float)L.texW, (float)L.texH, 0.0f, 1.0f };
+            drawPass(L.decoded.rtv, src, decode, L.srv, L.srvUV, sampler);
+            const int m = static_cast<int>(scaleMode);
+            if (scaleMode == ScaleMode::Bilinear) {
+                drawPass(rtv, vp, psScale[m][0], L.decoded.srv, nullptr, linearSampler);
+            } else {
+                const D3D11_VIEWPORT mid = { 0.0f, 0.0f, (float)L.pass.w, (float)L.texH, 0.0f, 1.0f };
+                drawPass(L.pass.rtv, mid, psScale[m][0], L.decoded.srv, nullptr, sampler);
+                drawPass(rtv, vp, psScale[m][1], L.pass.srv, nullptr, sampler);
+            }
+        }
+        return vp;
+    }
 
-        IDXGIFactory1* f1 = nullptr;
-        swapChain->GetParent(__uuidof(IDXGIFactory1), reinterpret_cast<void**>(&f1));
-        if (f1) { f1->MakeWindowAssociation(hwnd, DXGI_MWA_NO_ALT_ENTER); f1->Release(); }
-        factory->Release();
+    // Возвращает true, если был Present (занято место в очереди DXGI).
+    // Все слои — один проход по back buffer и один Present.
+    bool render()
+    {
+        if (std::none_of(layers.begin(), layers.end(),
+                         [](const VideoLayer& L) { return L.srv != nullptr; }))
+            return false;
+        if (dirtyTracking && !contentChanged && overlayText == shownOverlay &&
+            scaleMode == shownScale) {
+            ++presentsSkipped;
+            return false;
+        }
+        if (scanout || winW != bufW) fitSourceSize();   // новый размер источника, клавиша Scale
+        contentChanged = false;
+        shownOverlay   = overlayText;
+        shownScale     = scaleMode;
 
-        if (!rebuildRTV()) return false;
-        if (!compileShaders()) return false;
+        gpuTimer.begin(ctx);
+        float black[4] = { 0, 0, 0, 1 };
+        ctx->ClearRenderTargetView(rtv, black);
+        ctx->VSSetShader(vs, nullptr, 0);
+        ctx->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+        ctx->IASetInputLayout(nullptr);
 
-        D3D11_SAMPLER_DESC sd = {};
-        sd.Filter   = D3D11_FILTER_MIN_MAG_MIP_POINT;
-        sd.AddressU = sd.AddressV = sd.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
-        device->CreateSamplerState(&sd, &sampler);
+        D3D11_VIEWPORT main = { 0.0f, 0.0f, (float)winW, (float)winH, 0.0f, 1.0f };
+        for (size_t k = 0; k < layers.size(); ++k) {
+            if (!layers[k].srv) continue;
+            const D3D11_VIEWPORT vp = drawLayer(layers[k], layerCell(k));
+            if (k == 0) main = vp;
+        }
+        gpuTimer.end(ctx);
 
+        // Оверлей у левого нижнего угла основного видео.
+        drawOverlay(main.TopLeftX + 20.0f, main.TopLeftY + main.Height - 20.0f);
+        present();
         return true;
     }
 
-    bool compileShaders()
+    // --record: слой 0 в target в разрешении источника, без масштабирования и
+    // оверлея. false — текстуры нет или разрешение сменилось.
+    bool drawSource(ID3D11RenderTargetView* target, int w, int h)
     {
-        ID3DBlob *blob = nullptr, *err = nullptr;
+        const VideoLayer& L = layers[0];
+        if (!L.srv || L.texW != w || L.texH != h) return false;
+        ctx->VSSetShader(vs, nullptr, 0);
+        ctx->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+        ctx->IASetInputLayout(nullptr);
+        const D3D11_VIEWPORT vp = { 0.0f, 0.0f, (float)w, (float)h, 0.0f, 1.0f };
+        drawPass(target, vp, ps[static_cast<int>(L.texFmt)], L.srv, L.srvUV, sampler, colorSdrCB);
+        ctx->OMSetRenderTargets(0, nullptr, nullptr);   // текстуру читает кодер
+        return true;
+    }
 
-        D3DCompile(s_vsCode, strlen(s_vsCode), nullptr, nullptr, nullptr,
-                   "main", "vs_5_0", 0, 0, &blob, &err);
-        if (!blob) {
-            std::cerr << "[DX11] VS: " << (err?(char*)err->GetBufferPointer():"?") << "\n";
-            if (err) err->Release(); return false;
+    // --sender: чёрный кадр с белым или чёрным квадратом маркера в левом
+    // верхнем углу (см. Calibration), оверлей — внизу экрана.
+    void presentMarker(bool white)
+    {
+        const float black[4] = { 0, 0, 0, 1 }, on[4] = { 1, 1, 1, 1 };
+        ctx->ClearRenderTargetView(rtv, black);
+        ID3D11DeviceContext1* ctx1 = nullptr;
+        if (white && SUCCEEDED(ctx->QueryInterface(__uuidof(ID3D11DeviceContext1),
+                                                   reinterpret_cast<void**>(&ctx1)))) {
+            const LONG     s = markerSide(winW, winH);
+            const D3D11_RECT r = { 0, 0, s, s };
+            ctx1->ClearView(rtv, on, &r, 1);
+            ctx1->Release();
         }
-        device->CreateVertexShader(blob->GetBufferPointer(),
-                                   blob->GetBufferSize(), nullptr, &vs);
-        blob->Release();
+        ctx->OMSetRenderTargets(1, &rtv, nullptr);
+        drawOverlay(20.0f, winH - 20.0f);
+        present();
+    }
 
-        D3DCompile(s_psCode, strlen(s_psCode), nullptr, nullptr, nullptr,
-                   "main", "ps_5_0", 0, 0, &blob, &err);
-        if (!blob) {
-            std::cerr << "[DX11] PS: " << (err?(char*)err->GetBufferPointer():"?") << "\n";
-            if (err) err->Release(); return false;
-        }
-        device->CreatePixelShader(blob->GetBufferPointer(),
-                                  blob->GetBufferSize(), nullptr, &ps);
-        blob->Release();
-        return true;
+    // --calibrate: область маркера показанного кадра уходит на readback.
+    void queueMarkerReadback(const MarkerTag& tag)
+    {
+        const VideoLayer& L = layers[0];
+        ID3D11Texture2D* src = L.copyTex ? L.copyTex : L.dynTex;
+        if (src) marker.queue(device, ctx, src, L.texFmt, tag);
     }
 
-    bool rebuildRTV()
+    // Оверлей в пикселях окна, нижняя строка — над bottom.
+    void drawOverlay(float x, float bottom)
     {
-        if (rtv) { rtv->Release(); rtv = nullptr; }
-        ID3D11Texture2D* back = nullptr;
-        swapChain->GetBuffer(0, __uuidof(ID3D11Texture2D),
-                             reinterpret_cast<void**>(&back));
-        if (!back) return false;
-        device->CreateRenderTargetView(back, nullptr, &rtv);
-        back->Release();
-        return rtv != nullptr;
+        if (overlayText.empty()) return;
+        const int lines = 1 + static_cast<int>(
+            std::count(overlayText.begin(), overlayText.end(), '\n'));
+        D3D11_VIEWPORT full = { 0.0f, 0.0f, (float)winW, (float)winH, 0.0f, 1.0f };
+        ctx->RSSetViewports(1, &full);
+        overlay.build(ctx, overlayText, x, bottom - lines * overlay.cellH, winW, winH);
+        overlay.draw(ctx);
     }
 
-    void ensureTexture(int w, int h)
+    void present()
     {
-        if (texW == w && texH == h) return;
+        const PresentPacing p = g_pacing.load();
+        const bool vsync = (p == PresentPacing::VSync || p == PresentPacing::Scheduled);
+        UINT flags = (!vsync && tearingOk) ? DXGI_PRESENT_ALLOW_TEARING : 0;
+        lastPresentQpc = qpcNow();
+        presentResult  = swapChain->Present(vsync ? 1 : 0, flags);
+        swapChain->GetLastPresentCount(&lastPresentId);
+        if (lastPresentQpc - pathCheckQpc >= qpcFrequency()) checkPresentPath();
+    }
 
-        if (srv)    { srv->Release();    srv    = nullptr; }
-        if (dynTex) { dynTex->Release(); dynTex = nullptr; }
+    // TDR или удалённый адаптер: все объекты устройства мертвы, main
+    // пересоздаёт рендер и источники, привязанные к устройству.
+    bool deviceLost() const
+    {
+        return presentResult == DXGI_ERROR_DEVICE_REMOVED ||
+               presentResult == DXGI_ERROR_DEVICE_RESET;
+    }
 
-        D3D11_TEXTURE2D_DESC td = {};
-        td.Width          = w; td.Height = h;
-        td.MipLevels      = 1; td.ArraySize = 1;
-        td.Format         = DXGI_FORMAT_R8G8B8A8_UNORM;
-        td.SampleDesc     = { 1, 0 };
-        td.Usage          = D3D11_USAGE_DYNAMIC;
-        td.BindFlags      = D3D11_BIND_SHADER_RESOURCE;
-        td.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    // Последний Present, попавший на экран, и QPC его vblank. В композиции
+    // DWM бывает DISJOINT — тогда метки display просто нет.
+    bool displayedPresent(UINT& presentId, int64_t& syncQpc)
+    {
+        DXGI_FRAME_STATISTICS st = {};
+        if (FAILED(swapChain->GetFrameStatistics(&st)) || !st.SyncQPCTime.QuadPart)
+            return false;
+        presentId = st.PresentCount;
+        syncQpc   = st.SyncQPCTime.QuadPart;
+        return true;
+    }
 
-        if (FAILED(device->CreateTexture2D(&td, nullptr, &dynTex))) {
-            std::cerr << "[DX11] CreateTexture2D failed (" << w << "x" << h << ")\n";
-            return;
+    void release()
+    {
+        overlay.release();
+        marker.release();
+        gpuTimer.release();
+        for (VideoLayer& L : layers) {
+            L.decoded.release();
+            L.pass.release();
+            releaseTexture(L);
         }
-        device->CreateShaderResourceView(dynTex, nullptr, &srv);
-        texW = w; texH = h;
+        for (auto& axes : psScale)
+            for (auto* p : axes) if (p) p->Release();
+        if (scaleCB)   scaleCB->Release();
+        if (colorCB)   colorCB->Release();
+        if (colorSdrCB) colorSdrCB->Release();
+        if (linearSampler) linearSampler->Release();
+        if (sampler)   sampler->Release();
+        for (auto* p : ps) if (p) p->Release();
+        if (vs)        vs->Release();
+        if (rtv)       rtv->Release();
+        if (latencyWait) CloseHandle(latencyWait);
+        if (media)     media->Release();
+        if (swapChain) swapChain->Release();
+        if (ctx)       ctx->Release();
+        if (device)    device->Release();
+
+        // Настройки (bufferCount, режимы, матрица) остаются — init() заново
+        // после потери устройства.
+        for (auto& axes : psScale) for (auto*& p : axes) p = nullptr;
+        for (auto*& p : ps) p = nullptr;
+        scaleCB = nullptr; linearSampler = nullptr; sampler = nullptr;
+        colorCB = colorSdrCB = nullptr;
+        vs = nullptr; rtv = nullptr; latencyWait = nullptr; media = nullptr;
+        overlayPlanes = overlayScaling = false;
+        composedRun = 0;
+        swapChain = nullptr; ctx = nullptr; device = nullptr;
+        scaleDstW = scaleDstH = 0.0f;
+        contentChanged = true;
+        presentResult  = S_OK;
     }
+};
 
-    void uploadFrame(const cv::Mat& frame)
+// ─── Запись: аппаратный кодер Media Foundation ───────────────────────────────
+//
+// --record FILE: основной источник уходит в H.264 / HEVC через IMFSinkWriter
+// с device manager'ом на устройстве рендера. После Present рендер декодирует
+// слой 0 одним проходом (тот же шейдер, что для экрана, без масштабирования и
+// оверлея) в BGRA текстуру пула; RGB32 → NV12 и кодирование MF делает на GPU
+// (видеопроцессор + аппаратный MFT: QuickSync / NVENC / AMF), пиксели на CPU
+// не читаются. WriteSample зовёт свой поток с низким приоритетом. Очередь
+// ограничена пулом: пока все текстуры у кодера, кадры записи пропускаются —
+// вывод на экран кодер не ждёт никогда.
+
+// IMFTrackedSample зовёт Invoke, когда MF отпустил последнюю ссылку на
+// сэмпл: текстура слота снова свободна.
+class RecorderSlotCallback : public IMFAsyncCallback {
+public:
+    explicit RecorderSlotCallback(std::atomic<bool>* busy) : busy_(busy) {}
+
+    STDMETHODIMP QueryInterface(REFIID iid, void** ppv) override
+    {
+        if (!ppv) return E_POINTER;
+        if (iid == __uuidof(IUnknown) || iid == __uuidof(IMFAsyncCallback)) {
+            *ppv = static_cast<IMFAsyncCallback*>(this);
+            AddRef();
+            return S_OK;
+        }
+        *ppv = nullptr;
+        return E_NOINTERFACE;
+    }
+    STDMETHODIMP_(ULONG) AddRef() override  { return ++refs_; }
+    STDMETHODIMP_(ULONG) Release() override
     {
-        ensureTexture(frame.cols, frame.rows);
-        if (!dynTex) return;
+        ULONG r = --refs_;
+        if (r == 0) delete this;
+        return r;
+    }
 
-        D3D11_MAPPED_SUBRESOURCE mapped = {};
-        if (FAILED(ctx->Map(dynTex, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped))) return;
+    STDMETHODIMP GetParameters(DWORD*, DWORD*) override { return E_NOTIMPL; }
+    STDMETHODIMP Invoke(IMFAsyncResult*) override { busy_->store(false); return S_OK; }
 
-        const uint8_t* src = frame.ptr(0);
-        uint8_t*       dst = static_cast<uint8_t*>(mapped.pData);
-        const int      W   = frame.cols;
-        const int      H   = frame.rows;
-        const int      srcStep = static_cast<int>(frame.step[0]);
-        const UINT     dstPitch = mapped.RowPitch;
+private:
+    std::atomic<ULONG>  refs_ { 1 };
+    std::atomic<bool>*  busy_;
+};
+
+class Recorder {
+public:
+    static constexpr int POOL = 4;       // текстур у кодера одновременно
+
+    uint64_t              dropped = 0;   // пул занят или другое разрешение (рендер)
+    std::atomic<uint64_t> written { 0 }; // ушло в WriteSample (поток кодера)
+    bool                  hardware = false;
+
+    bool active() const { return writer_ != nullptr; }
+    int  width()  const { return w_; }
+    int  height() const { return h_; }
+
+    bool start(const std::string& path, bool hevc, int mbps, ID3D11Device* device,
+               int w, int h, double fps)
+    {
+        if (w <= 0 || h <= 0 || ((w | h) & 1)) {
+            std::cerr << "[MF] Recording needs an even frame size, got " << w << "x" << h << "\n";
+            return false;
+        }
+        mfStarted_ = SUCCEEDED(MFStartup(MF_VERSION, MFSTARTUP_NOSOCKET));
+        UINT token = 0;
+        if (!mfStarted_ || FAILED(MFCreateDXGIDeviceManager(&token, &devMgr_)) ||
+            FAILED(devMgr_->ResetDevice(device, token))) {
+            std::cerr << "[MF] Recording: D3D device manager unavailable\n";
+            stop();
+            return false;
+        }
+
+        D3D11_TEXTURE2D_DESC td = {};
+        td.Width      = w; td.Height = h;
+        td.MipLevels  = 1; td.ArraySize = 1;
+        td.Format     = DXGI_FORMAT_B8G8R8A8_UNORM;
+        td.SampleDesc = { 1, 0 };
+        td.Usage      = D3D11_USAGE_DEFAULT;
+        td.BindFlags  = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
+        for (int k = 0; k < POOL; ++k) {
+            if (FAILED(device->CreateTexture2D(&td, nullptr, &tex_[k])) ||
+                FAILED(device->CreateRenderTargetView(tex_[k], nullptr, &rtv_[k]))) {
+                std::cerr << "[DX11] Recording: CreateTexture2D failed\n";
+                stop();
+                return false;
+            }
+            done_[k] = new RecorderSlotCallback(&busy_[k]);
+        }
+
+        const int     len   = MultiByteToWideChar(CP_ACP, 0, path.c_str(), -1, nullptr, 0);
+        std::wstring  wpath(len > 0 ? len : 1, L'\0');
+        MultiByteToWideChar(CP_ACP, 0, path.c_str(), -1, &wpath[0], len);
+
+        IMFAttributes* attr = nullptr;
+        MFCreateAttributes(&attr, 2);
+        attr->SetUINT32(MF_READWRITE_ENABLE_HARDWARE_TRANSFORMS, TRUE);
+        attr->SetUnknown(MF_SINK_WRITER_D3D_MANAGER, devMgr_);
+        HRESULT hr = MFCreateSinkWriterFromURL(wpath.c_str(), nullptr, attr, &writer_);
+        attr->Release();
+        if (FAILED(hr)) {
+            std::cerr << "[MF] Cannot create " << path << ": 0x" << std::hex << hr << std::dec << "\n";
+            stop();
+            return false;
+        }
 
-        thread_local cv::Mat bgraRow;
-        for (int y = 0; y < H; ++y) {
-            const cv::Mat srcRow(1, W, CV_8UC3, const_cast<uint8_t*>(src + y * srcStep));
-            bgraRow.create(1, W, CV_8UC4);
-            cv::cvtColor(srcRow, bgraRow, cv::COLOR_BGR2BGRA);
-            memcpy(dst + y * dstPitch, bgraRow.ptr(0), W * 4);
+        // OpenCV DSHOW у части устройств отдаёт 0 fps, а MF_MT_FRAME_RATE 0/N
+        // кодер не примет — тогда пишем как 60.
+        const double rate    = fps > 1.0 ? fps : 60.0;
+        const UINT32 rateNum = static_cast<UINT32>(rate * 1000.0 + 0.5), rateDen = 1000;
+        IMFMediaType* out = nullptr;
+        IMFMediaType* in  = nullptr;
+        MFCreateMediaType(&out);
+        out->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
+        out->SetGUID(MF_MT_SUBTYPE, hevc ? MFVideoFormat_HEVC : MFVideoFormat_H264);
+        out->SetUINT32(MF_MT_AVG_BITRATE, static_cast<UINT32>(mbps) * 1000000u);
+        out->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive);
+        MFSetAttributeSize(out, MF_MT_FRAME_SIZE, w, h);
+        MFSetAttributeRatio(out, MF_MT_FRAME_RATE, rateNum, rateDen);
+        MFSetAttributeRatio(out, MF_MT_PIXEL_ASPECT_RATIO, 1, 1);
+        MFCreateMediaType(&in);
+        in->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
+        in->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_RGB32);
+        in->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive);
+        MFSetAttributeSize(in, MF_MT_FRAME_SIZE, w, h);
+        MFSetAttributeRatio(in, MF_MT_FRAME_RATE, rateNum, rateDen);
+        MFSetAttributeRatio(in, MF_MT_PIXEL_ASPECT_RATIO, 1, 1);
+        hr = writer_->AddStream(out, &stream_);
+        if (SUCCEEDED(hr)) hr = writer_->SetInputMediaType(stream_, in, nullptr);
+        if (SUCCEEDED(hr)) hr = writer_->BeginWriting();
+        out->Release();
+        in->Release();
+        if (FAILED(hr)) {
+            std::cerr << "[MF] No " << (hevc ? "HEVC" : "H.264") << " encoder for "
+                      << w << "x" << h << ": 0x" << std::hex << hr << std::dec << "\n";
+            stop();
+            return false;
         }
-        ctx->Unmap(dynTex, 0);
+
+        hardware = usesHardwareEncoder();
+        if (!hardware)
+            std::cerr << "[WARN] No hardware encoder, recording with the software MFT\n";
+        w_ = w; h_ = h;
+        duration_ = static_cast<LONGLONG>(1e7 / rate);
+        t0_       = 0;                      // новый файл — время с нуля
+        lastTime_ = -1;
+        head_     = count_ = 0;
+        writeFailed_ = false;
+        ready_    = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+        running_  = true;
+        thread_   = std::thread(&Recorder::encodeLoop, this);
+        return true;
     }
 
-    void render()
+    // Рендер, после Present. Никогда не ждёт кодер: нет свободной текстуры —
+    // кадр записи пропущен.
+    void push(DX11Renderer& dx, int64_t tReceive)
     {
-        if (!srv) return;
+        if (!writer_) return;
+        int k = 0;
+        while (k < POOL && busy_[k].load()) ++k;
+        if (k == POOL || !dx.drawSource(rtv_[k], w_, h_)) { ++dropped; return; }
 
-        float scaleX = (float)winW / (float)texW;
-        float scaleY = (float)winH / (float)texH;
-        float scale  = (std::min)(scaleX, scaleY);
-        float vpW    = texW * scale;
-        float vpH    = texH * scale;
-        float vpX    = (winW - vpW) * 0.5f;
-        float vpY    = (winH - vpH) * 0.5f;
+        if (!t0_) t0_ = tReceive;
+        LONGLONG time = static_cast<LONGLONG>((tReceive - t0_) * 1e7 / qpcFrequency());
+        if (time <= lastTime_) time = lastTime_ + 1;   // WriteSample требует рост
+        lastTime_ = time;
 
-        D3D11_VIEWPORT vp = { vpX, vpY, vpW, vpH, 0.0f, 1.0f };
-        ctx->RSSetViewports(1, &vp);
-        ctx->OMSetRenderTargets(1, &rtv, nullptr);
+        busy_[k] = true;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            jobs_[(head_ + count_) % POOL] = { k, time };
+            ++count_;
+        }
+        SetEvent(ready_);
+    }
 
-        float black[4] = { 0, 0, 0, 1 };
-        ctx->ClearRenderTargetView(rtv, black);
+    // До dx.release(): Finalize отпускает сэмплы и дописывает файл.
+    void stop()
+    {
+        if (thread_.joinable()) {
+            running_ = false;
+            SetEvent(ready_);
+            thread_.join();
+        }
+        if (writer_) { writer_->Finalize(); writer_->Release(); writer_ = nullptr; }
+        for (int k = 0; k < POOL; ++k) {
+            if (rtv_[k])  { rtv_[k]->Release();  rtv_[k]  = nullptr; }
+            if (tex_[k])  { tex_[k]->Release();  tex_[k]  = nullptr; }
+            if (done_[k]) { done_[k]->Release(); done_[k] = nullptr; }
+        }
+        if (devMgr_) { devMgr_->Release(); devMgr_ = nullptr; }
+        if (ready_)  { CloseHandle(ready_); ready_ = nullptr; }
+        if (mfStarted_) { MFShutdown(); mfStarted_ = false; }
+    }
 
-        ctx->VSSetShader(vs, nullptr, 0);
-        ctx->PSSetShader(ps, nullptr, 0);
-        ctx->PSSetShaderResources(0, 1, &srv);
-        ctx->PSSetSamplers(0, 1, &sampler);
-        ctx->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-        ctx->IASetInputLayout(nullptr);
-        ctx->Draw(3, 0);
+private:
+    struct Job { int slot; LONGLONG time; };
 
-        bool vsync = g_vsync.load();
-        UINT flags = (!vsync && tearingOk) ? DXGI_PRESENT_ALLOW_TEARING : 0;
-        swapChain->Present(vsync ? 1 : 0, flags);
+    // Кодер, выбранный sink writer'ом: у аппаратных MFT есть
+    // MFT_ENUM_HARDWARE_URL_Attribute.
+    bool usesHardwareEncoder()
+    {
+        IMFSinkWriterEx* ex = nullptr;
+        if (FAILED(writer_->QueryInterface(IID_PPV_ARGS(&ex)))) return false;
+        bool hw = false;
+        GUID          category = GUID_NULL;
+        IMFTransform* mft      = nullptr;
+        for (DWORD i = 0; SUCCEEDED(ex->GetTransformForStream(stream_, i, &category, &mft)); ++i) {
+            IMFAttributes* a = nullptr;
+            UINT32 len = 0;
+            if (category == MFT_CATEGORY_VIDEO_ENCODER && SUCCEEDED(mft->GetAttributes(&a))) {
+                hw = SUCCEEDED(a->GetStringLength(MFT_ENUM_HARDWARE_URL_Attribute, &len));
+                a->Release();
+            }
+            mft->Release();
+        }
+        ex->Release();
+        return hw;
     }
 
-    void release()
+    void encodeLoop()
     {
-        if (sampler)   sampler->Release();
-        if (srv)       srv->Release();
-        if (dynTex)    dynTex->Release();
-        if (ps)        ps->Release();
-        if (vs)        vs->Release();
-        if (rtv)       rtv->Release();
-        if (swapChain) swapChain->Release();
-        if (ctx)       ctx->Release();
-        if (device)    device->Release();
+        // Процесс в REALTIME_PRIORITY_CLASS: LOWEST всё ещё выше обычных
+        // программ, но ниже захвата и рендера; ядра — помощников (E-ядра).
+        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+        pinThread(ThreadRole::Helper);
+
+        for (;;) {
+            Job job { -1, 0 };
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (count_ > 0) {
+                    job = jobs_[head_];
+                    head_ = (head_ + 1) % POOL;
+                    --count_;
+                } else if (!running_) {
+                    break;
+                }
+            }
+            if (job.slot < 0) { WaitForSingleObject(ready_, INFINITE); continue; }
+            const HRESULT hr = write(job);
+            if (SUCCEEDED(hr)) { ++written; continue; }
+            busy_[job.slot] = false;
+            if (!writeFailed_) {
+                std::cerr << "[WARN] Recording: WriteSample failed: 0x" << std::hex << hr
+                          << std::dec << "\n";
+                writeFailed_ = true;
+            }
+        }
+    }
+
+    // Сэмпл поверх текстуры слота. Освобождение отслеживает
+    // RecorderSlotCallback — кодер может держать сэмпл и после WriteSample.
+    HRESULT write(const Job& job)
+    {
+        IMFMediaBuffer*   buf     = nullptr;
+        IMFTrackedSample* tracked = nullptr;
+        IMFSample*        sample  = nullptr;
+        HRESULT hr = MFCreateDXGISurfaceBuffer(__uuidof(ID3D11Texture2D), tex_[job.slot], 0,
+                                               FALSE, &buf);
+        if (SUCCEEDED(hr)) {
+            IMF2DBuffer* b2  = nullptr;
+            DWORD        len = 0;
+            if (SUCCEEDED(buf->QueryInterface(IID_PPV_ARGS(&b2)))) {
+                b2->GetContiguousLength(&len);
+                b2->Release();
+            }
+            buf->SetCurrentLength(len);
+            hr = MFCreateTrackedSample(&tracked);
+        }
+        if (SUCCEEDED(hr)) hr = tracked->QueryInterface(IID_PPV_ARGS(&sample));
+        if (SUCCEEDED(hr)) hr = sample->AddBuffer(buf);
+        if (SUCCEEDED(hr)) {
+            sample->SetSampleTime(job.time);
+            sample->SetSampleDuration(duration_);
+            hr = tracked->SetAllocator(done_[job.slot], nullptr);
+        }
+        if (SUCCEEDED(hr)) hr = writer_->WriteSample(stream_, sample);
+        if (sample)  sample->Release();
+        if (tracked) tracked->Release();
+        if (buf)     buf->Release();
+        return hr;
     }
+
+    IMFDXGIDeviceManager*   devMgr_ = nullptr;
+    IMFSinkWriter*          writer_ = nullptr;
+    DWORD                   stream_ = 0;
+    bool                    mfStarted_ = false;
+    ID3D11Texture2D*        tex_[POOL]  = {};
+    ID3D11RenderTargetView* rtv_[POOL]  = {};
+    RecorderSlotCallback*   done_[POOL] = {};
+    std::atomic<bool>       busy_[POOL] = {};
+    int                     w_ = 0, h_ = 0;
+    LONGLONG                duration_ = 0, lastTime_ = -1;
+    int64_t                 t0_ = 0;
+
+    std::mutex              mutex_;              // jobs_, head_, count_
+    Job                     jobs_[POOL] = {};
+    int                     head_ = 0, count_ = 0;
+    HANDLE                  ready_ = nullptr;
+    std::atomic<bool>       running_ { false };
+    std::thread             thread_;
+    bool                    writeFailed_ = false; // только поток кодера
 };
 
 // ─── Win32 окно ──────────────────────────────────────────────────────────────
@@ -878,14 +6656,24 @@ static LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp)
     case WM_DESTROY:
         PostQuitMessage(0);
         return 0;
+    case WM_DEVICECHANGE:
+        // DBT_DEVNODES_CHANGED приходит окну верхнего уровня без регистрации:
+        // карту вставили или выдернули — повод проверить захват сейчас.
+        g_deviceChanged = true;
+        break;
+    case WM_INPUT:
+        // DefWindowProc после обработки обязателен: он освобождает данные.
+        onRawInput(reinterpret_cast<HRAWINPUT>(lp));
+        break;
     }
     return DefWindowProcW(hwnd, msg, wp, lp);
 }
 
-static HWND createFullscreenWindow(int& outW, int& outH)
+// Окно ровно по монитору: размер back buffer совпадает с режимом выхода.
+static HWND createFullscreenWindow(const DisplayOutput& display, int& outW, int& outH)
 {
-    outW = GetSystemMetrics(SM_CXSCREEN);
-    outH = GetSystemMetrics(SM_CYSCREEN);
+    outW = display.rect.right - display.rect.left;
+    outH = display.rect.bottom - display.rect.top;
 
     WNDCLASSEXW wc = {};
     wc.cbSize        = sizeof(wc);
@@ -898,7 +6686,7 @@ static HWND createFullscreenWindow(int& outW, int& outH)
     HWND hwnd = CreateWindowExW(WS_EX_TOPMOST, L"BridgeWnd",
         L"External Display Bridge",
         WS_POPUP | WS_VISIBLE,
-        0, 0, outW, outH,
+        display.rect.left, display.rect.top, outW, outH,
         nullptr, nullptr, GetModuleHandleW(nullptr), nullptr);
 
     SetForegroundWindow(hwnd);
@@ -906,107 +6694,596 @@ static HWND createFullscreenWindow(int& outW, int& outH)
     return hwnd;
 }
 
-// ─── FPS оверлей ─────────────────────────────────────────────────────────────
+// ─── Передатчик маркера (--sender) ───────────────────────────────────────────
+//
+// Полноэкранный маркер калибровки (см. Calibration) с VSync: фронт меняется
+// ровно на vblank. Когда DXGI статистика сообщает SyncQPCTime Present'а с
+// фронтом, тот публикуется в общую память для --calibrate на этой же машине.
 
-static void drawFPS(cv::Mat* frame, double fps, const char* codec)
+static int runSender(const Options& opt, const DisplayOutput& display)
 {
-    if (!frame || frame->empty()) return;
-    char buf[80];
-    const char* vsyncStr = g_vsync.load() ? "VSync ON" : "VSync OFF";
-    snprintf(buf, sizeof(buf), "FPS: %d | %s | %s", (int)fps, codec, vsyncStr);
-    cv::putText(*frame, buf,
-                cv::Point(20, frame->rows - 20),
-                cv::FONT_HERSHEY_SIMPLEX, 0.6,
-                cv::Scalar(160, 160, 160), 1, cv::LINE_AA);
-}
+    HANDLE        mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+                                               0, sizeof(MarkerShared), MARKER_MAPPING);
+    MarkerShared* shared  = mapping ? static_cast<MarkerShared*>(
+        MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, sizeof(MarkerShared))) : nullptr;
+    if (!shared)
+        std::cerr << "[WARN] Shared memory unavailable, edges are not published\n";
 
-// ─── Опрос клавиш и кнопок мыши в главном цикле ─────────────────────────────
-//
-// GetAsyncKeyState работает для всех VK кодов, включая VK_XBUTTON1/2.
-// Вызывается каждый кадр, но это ~1 мкс накладных расходов — нет влияния
-// на задержку видео.
+    int winW = 0, winH = 0;
+    HWND hwnd = createFullscreenWindow(display, winW, winH);
+    hideCursor();
+
+    DX11Renderer dx;
+    dx.adapterLuid = display.adapterLuid;
+    dx.bufferCount = static_cast<UINT>(opt.buffers);
+    dx.maxLatency  = static_cast<UINT>(opt.maxLatency);
+    if (!dx.init(hwnd, winW, winH)) {
+        std::cerr << "[ERROR] DX11 init failed.\n";
+        DestroyWindow(hwnd); showCursor();
+        if (shared)  UnmapViewOfFile(shared);
+        if (mapping) CloseHandle(mapping);
+        return 1;
+    }
+    g_pacing = PresentPacing::VSync;
+
+    std::cout << "[INFO] Latency sender: " << markerSide(winW, winH) << " px marker, edge every "
+              << MARKER_PERIOD_MS << " ms. Press Esc to exit.\n";
+
+    const int64_t period    = qpcFrequency() * MARKER_PERIOD_MS / 1000;
+    const int64_t start     = qpcNow();
+    int           lastLevel = -1;
+    UINT          edgeId    = 0;                // Present с фронтом, ждёт статистику
+    int           edgeLevel = 0;
+    uint64_t      published = 0;
+    char          text[96];
 
-struct KeyState {
-    bool wasDown = false;
+    while (g_running) {
+        if (dx.latencyWait) WaitForSingleObjectEx(dx.latencyWait, 100, TRUE);
+
+        MSG msg;
+        while (PeekMessageW(&msg, nullptr, 0, 0, PM_REMOVE)) {
+            if (msg.message == WM_QUIT) g_running = false;
+            TranslateMessage(&msg);
+            DispatchMessageW(&msg);
+        }
+        for (int vk; g_keyEvents.pop(vk); )
+            if (vk == VK_ESCAPE) g_running = false;
+
+        const int level = static_cast<int>(((qpcNow() - start) / period) & 1);
+        snprintf(text, sizeof(text), "Latency sender | %llu edges | Esc = exit",
+                 static_cast<unsigned long long>(published));
+        dx.setOverlay(text);
+        dx.presentMarker(level == 1);
+        if (level != lastLevel) {
+            if (lastLevel >= 0) { edgeId = dx.lastPresentId; edgeLevel = level; }
+            lastLevel = level;
+        }
 
-    // Возвращает true только на передний фронт нажатия
-    bool poll(int vk) {
-        bool isDown = (GetAsyncKeyState(vk) & 0x8000) != 0;
-        bool edge   = isDown && !wasDown;
-        wasDown     = isDown;
-        return edge;
+        // Статистика описывает последний показанный Present: если фронт
+        // уже пропущен (id больше), его vblank неизвестен — фронт теряется.
+        UINT    shownId = 0;
+        int64_t shownAt = 0;
+        if (edgeId && dx.displayedPresent(shownId, shownAt) && shownId >= edgeId) {
+            if (shownId == edgeId && shared) {
+                const uint64_t n = shared->count.load(std::memory_order_relaxed);
+                shared->ring[n % MarkerShared::RING] = { shownAt, edgeLevel, 0 };
+                shared->count.store(n + 1, std::memory_order_release);
+                ++published;
+            }
+            edgeId = 0;
+        }
     }
-};
+
+    dx.release();
+    DestroyWindow(hwnd);
+    showCursor();
+    if (shared)  UnmapViewOfFile(shared);
+    if (mapping) CloseHandle(mapping);
+    std::cout << "[INFO] Sender stopped, " << published << " edges published.\n";
+    return 0;
+}
 
 // ─── main ─────────────────────────────────────────────────────────────────────
 
-int main()
+int main(int argc, char** argv)
 {
     SetConsoleOutputCP(CP_UTF8);
-    printBanner();
+    const int64_t tStart = qpcNow();            // до первого кадра на экране
+    enableDpiAwareness();                       // до первого окна
+
+    Options opt;
+    if (!parseOptions(argc, argv, opt)) return 1;
+    if (opt.listMonitors) { printOutputs(); return 0; }
+    if (opt.benchConvert) return runConvertBenchmark(opt.benchW, opt.benchH);
+
+    // --bench: без консольных вопросов и без устройства, stdout — только отчёт.
+    const bool bench = opt.benchSeconds > 0;
+
+    // --quick: профиль прошлой сессии — основа, флаги командной строки поверх.
+    SessionProfile profile;
+    bool quick = opt.quick && !bench && !opt.sender;
+    if (quick && !(quick = loadSessionProfile(profile)))
+        std::cerr << "[WARN] No session profile (" << PROFILE_FILE << ") yet, starting normally\n";
+    if (quick) {
+        Options q;
+        applySessionProfile(profile, q);
+        parseOptions(argc, argv, q);
+        opt = q;
+    }
+
+    if (!bench && !quick) printBanner();
     setProcessPriority();
+    initCpuTopology(opt.cpuSets, opt.cpuCapture, opt.cpuRender,
+                    (std::max)(static_cast<size_t>(1), opt.devices.size()));
+    pinThread(ThreadRole::Render);
     SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
     HANDLE mmh = registerMMCSS(L"Games");
     preventSleep();
 
     CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    registerRawInput(false);                    // Esc у --sender, hotkeys
+
+    DisplayOutput display;
+    if (!pickOutput(opt.monitor, display)) { allowSleep(); return 1; }
+
+    if (opt.sender) {
+        const int rc = runSender(opt, display);
+        allowSleep();
+        if (mmh) AvRevertMmThreadCharacteristics(mmh);
+        CoUninitialize();
+        return rc;
+    }
+
+    ModeRequest req;
+    req.width  = opt.modeW;
+    req.height = opt.modeH;
+    req.fps    = opt.modeFps;
+    req.fourcc = opt.formatFcc;
+    // Режим из профиля не перечисляем заново, если флаги его не сменили.
+    req.exact  = quick && opt.modeW == profile.width && opt.modeH == profile.height &&
+                 opt.modeFps == profile.fps && opt.formatFcc == profile.fourcc;
+
+    // Режимы устройств пробуются в фоне, пока идёт настройка клавиш.
+    DeviceProber prober;
+    if (!bench && !quick && opt.devices.empty()) prober.start(enumerateDevices());
 
     // ── Настройка клавиш ─────────────────────────────────────────────────────
-    KeyBindings kb = startupKeySetup();
+    KeyBindings kb = bench ? KeyBindings{} : quick ? loadKeyBindings() : startupKeySetup();
+    registerRawInput(bindsMouse(kb.vkFPS) || bindsMouse(kb.vkVSync) ||
+                     bindsMouse(kb.vkScale) || bindsMouse(kb.vkExit));
 
     // ── Выбор устройства ─────────────────────────────────────────────────────
-    int deviceId = selectDevice();
-    if (deviceId < 0) { allowSleep(); return 1; }
+    DeviceInfo device { -1, {} };
+    std::vector<DeviceInfo> extraDevices;           // --devices: кроме основного
+    if (!bench && !opt.devices.empty()) {
+        extraDevices = devicesByIndex(opt.devices);
+        if (extraDevices.empty()) { allowSleep(); return 1; }
+        device = extraDevices.front();
+        extraDevices.erase(extraDevices.begin());
+    } else if (quick) {
+        device = sessionDevice(profile);
+    } else if (!bench) {
+        device = selectDevice(prober.finish(req));
+        if (device.index < 0) { allowSleep(); return 1; }
+    }
+    // Режимы выбранных устройств — из пробы выше (она дописала кэш) или из
+    // прошлого запуска: при открытии DirectShow их заново не обходим.
+    ModeCache knownModes = loadModeCache();
+
+    // ── Окно + DirectX ───────────────────────────────────────────────────────
+    // Устройство D3D11 создаётся до захвата: MF-бэкенд привязывает к нему
+    // свой device manager. Swap chain и шейдеры — параллельно с открытием
+    // захвата, YUV матрицу выбираем после согласования формата.
+    int winW = 0, winH = 0;
+    HWND hwnd = createFullscreenWindow(display, winW, winH);
+    hideCursor();
+
+    if (opt.dirty && opt.upload == UploadMode::Dynamic) {
+        // WRITE_DISCARD не сохраняет прошлое содержимое — частичной загрузке
+        // нужна постоянная DEFAULT текстура ring пути.
+        std::cerr << "[WARN] --dirty needs the staging ring, using --upload ring\n";
+        opt.upload = UploadMode::Ring;
+    }
+
+    g_pacing = opt.pacing;
+    DX11Renderer dx;
+    dx.adapterLuid = display.adapterLuid;       // устройство — на GPU этого монитора
+    if (opt.matrix != ColorMatrix::Auto) dx.matrix = opt.matrix;
+    dx.range       = opt.range;
+    dx.transfer    = opt.transfer;
+    dx.output      = opt.output;
+    dx.peakNits    = opt.peakNits;
+    dx.whiteNits   = opt.whiteNits;
+    dx.bufferCount = static_cast<UINT>(opt.buffers);
+    dx.maxLatency  = static_cast<UINT>(opt.maxLatency);
+    dx.bgrToBgra   = bgrToBgraKernel(opt.simd).fn;
+    dx.uploadMode   = opt.upload;
+    dx.scaleMode    = opt.scale;
+    dx.dirtyTracking = opt.dirty;
+    dx.stagingCount = opt.staging;
+    dx.scanout      = opt.scanout;
+    if (!dx.createDevice()) {
+        std::cerr << "[ERROR] DX11 init failed.\n";
+        DestroyWindow(hwnd); showCursor(); allowSleep(); return 1;
+    }
 
+    // ── Захват ───────────────────────────────────────────────────────────────
     TripleBuffer tb;
-    VideoStream  vs(deviceId, tb);
+    std::unique_ptr<CaptureSource> cap;
+    // P010 через OpenCV DSHOW не получить — в auto сразу MF.
+    const bool preferMF = opt.backend == CaptureBackend::MediaFoundation ||
+                          (opt.backend == CaptureBackend::Auto && req.fourcc == fourccOf("P010"));
+
+    std::atomic<bool> mfStarted { false };      // open зовёт и Reconnector
+    auto openMF = [&](const DeviceInfo& dev, TripleBuffer& buf,
+                      size_t source) -> std::unique_ptr<CaptureSource> {
+        if (!mfStarted) mfStarted = SUCCEEDED(MFStartup(MF_VERSION, MFSTARTUP_NOSOCKET));
+        auto mf = std::make_unique<MFVideoStream>(buf, req);
+        if (!mfStarted || !mf->open(dev, dx.device)) return nullptr;
+        releaseCaptureCpu(source);
+        return mf;
+    };
+    // source — номер источника (0 — основной): его ядро в CPU sets.
+    auto openDevice = [&](const DeviceInfo& dev, TripleBuffer& buf,
+                          size_t source) -> std::unique_ptr<CaptureSource> {
+        const auto it = dev.path.empty() ? knownModes.end() : knownModes.find(dev.path);
+        const std::vector<VideoMode>* modes = it != knownModes.end() ? &it->second : nullptr;
+        std::unique_ptr<CaptureSource> c;
+        if (preferMF && !(c = openMF(dev, buf, source)))
+            std::cerr << "[WARN] Media Foundation capture failed, falling back to OpenCV.\n";
+        if (c) return c;
+        c = std::make_unique<VideoStream>(dev.index, buf, opt.raw, req, modes, source);
+        // MJPG OpenCV декодирует на CPU внутри read(). В auto переоткрываем
+        // устройство через MF: MFT декодер (DXVA) пишет сразу в NV12 текстуру.
+        if (opt.backend == CaptureBackend::Auto && c->fourcc() == "MJPG") {
+            std::cout << "[INFO] MJPG device, switching to Media Foundation decode.\n";
+            c->stop();
+            c.reset();
+            if (!(c = openMF(dev, buf, source))) {
+                std::cerr << "[WARN] Media Foundation capture failed, using OpenCV MJPG decode.\n";
+                c = std::make_unique<VideoStream>(dev.index, buf, opt.raw, req, modes, source);
+            }
+        }
+        return c;
+    };
+    auto openPrimary = [&]() -> std::unique_ptr<CaptureSource> {
+        if (!bench) return device.index >= 0 ? openDevice(device, tb, 0) : nullptr;
+        const bool        mj = opt.benchFormat == "mjpg";
+        const PixelFormat bf = (opt.benchFormat == "bgr" || mj) ? PixelFormat::BGR24
+                             : (opt.benchFormat == "nv12") ? PixelFormat::NV12
+                             : (opt.benchFormat == "p010") ? PixelFormat::P010
+                                                           : PixelFormat::YUY2;
+        return std::make_unique<SyntheticSource>(tb, opt.benchW, opt.benchH, bf, opt.benchFps,
+                                                 opt.benchStatic, mj);
+    };
 
-    int    srcW      = vs.width();
-    int    srcH      = vs.height();
-    int    fourccInt = static_cast<int>(vs.get(cv::CAP_PROP_FOURCC));
-    double srcFps    = vs.get(cv::CAP_PROP_FPS);
+    // --devices: остальные источники — свой TripleBuffer и поток захвата
+    // (MMCSS) у каждого, кадры рисуются в ячейки того же back buffer.
+    // Задержка, темп Present и калибровка считаются по основному.
+    std::vector<std::unique_ptr<TripleBuffer>>  extraTb;
+    std::vector<std::unique_ptr<CaptureSource>> extraCap;
+    for (size_t k = 0; k < extraDevices.size(); ++k)
+        extraTb.push_back(std::make_unique<TripleBuffer>());
+
+    // Граф DirectShow и активация MF источника — самое долгое на старте,
+    // пока они идут, главный поток создаёт swap chain, шейдеры и оверлей.
+    std::thread opener([&] {
+        CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+        cap = openPrimary();
+        for (size_t k = 0; k < extraDevices.size(); ++k)
+            extraCap.push_back(openDevice(extraDevices[k], *extraTb[k], k + 1));
+        CoUninitialize();
+    });
+    const bool pipelineOk = dx.createPipeline(hwnd, winW, winH);
+    opener.join();
+    if (!pipelineOk) {
+        std::cerr << "[ERROR] DX11 init failed.\n";
+        if (cap) cap->stop();
+        for (auto& c : extraCap) if (c) c->stop();
+        cap.reset(); extraCap.clear();
+        if (mfStarted) MFShutdown();
+        dx.release();
+        DestroyWindow(hwnd); showCursor(); allowSleep(); return 1;
+    }
 
-    char fourccStr[5] = {};
-    for (int i = 0; i < 4; ++i)
-        fourccStr[i] = static_cast<char>((fourccInt >> (8 * i)) & 0xFF);
+    // Профиль устарел: устройство отключено или переехало. Один раз
+    // спрашиваем, как без --quick.
+    if (quick && (!cap || cap->width() <= 0)) {
+        std::cerr << "[WARN] Device from " << PROFILE_FILE << " is not available\n";
+        if (cap) cap->stop();
+        cap.reset();
+        req.exact = false;
+        prober.start(enumerateDevices());
+        device    = selectDevice(prober.finish(req));
+        if (device.index < 0) {
+            if (mfStarted) MFShutdown();
+            dx.release();
+            DestroyWindow(hwnd); showCursor(); allowSleep(); return 1;
+        }
+        knownModes = loadModeCache();
+        cap = openPrimary();
+    }
+    dx.layers.resize(1 + extraCap.size());
+    dx.layout = opt.layout;
+
+    int          srcW      = 0;
+    int          srcH      = 0;
+    double       srcFps    = 0.0;
+    std::string  fourccStr;
+    bool         captureSlots = false;
+    PresentPacer pacer;
+
+    // Параметры основного источника — при старте и после каждого
+    // переоткрытия: режим мог смениться вместе с сигналом.
+    // Ring upload без --dirty: MF и synthetic пишут кадр прямо в замапленные
+    // staging слоты рендера. BGR24 (OpenCV) по-прежнему конвертирует рендер.
+    // Старый источник уже остановлен, его слоты можно пересоздать.
+    auto adoptPrimary = [&]() {
+        srcW      = cap->width();
+        srcH      = cap->height();
+        srcFps    = cap->fps();
+        fourccStr = cap->fourcc();
+        pacer.cadence.reset(srcFps);
+        if (opt.matrix == ColorMatrix::Auto)
+            dx.setColorMatrix(opt.transfer != TransferFn::SDR ? ColorMatrix::BT2020
+                              : (srcH >= 720) ? ColorMatrix::BT709 : ColorMatrix::BT601);
+        dx.uploadSlots.release(dx.ctx);
+        captureSlots = opt.upload == UploadMode::Ring && !opt.dirty &&
+                       cap->format() != PixelFormat::BGR24 &&
+                       dx.createUploadSlots(srcW, srcH, cap->format()) &&
+                       cap->setUploadSlots(&dx.uploadSlots);
+        if (!captureSlots) dx.uploadSlots.release(dx.ctx);
+    };
+    adoptPrimary();
+
+    // Профиль следующего --quick: устройство и режим, который оно отдало.
+    SessionProfile session;
+    if (!bench) {
+        const bool mf   = dynamic_cast<MFVideoStream*>(cap.get()) != nullptr;
+        session         = makeSessionProfile(device, cap->deviceLink(), opt);
+        session.backend = static_cast<int>(mf ? CaptureBackend::MediaFoundation
+                                              : CaptureBackend::OpenCV);
+        session.fourcc  = fourccFromString(fourccStr);
+        session.width   = srcW;
+        session.height  = srcH;
+        session.fps     = srcFps;
+        if (!saveSessionProfile(session))
+            std::cerr << "[WARN] Could not save " << PROFILE_FILE << "\n";
+    }
 
+    // Полосовая загрузка: порог в пикселях/с переводим в пиксели кадра,
+    // так 720p60 и 1080p60 остаются однопоточными, а 1440p60/4K/120 fps — нет.
+    StripePool stripePool;
     {
+        int workers = opt.uploadThreads;
+        if (workers < 0) workers = (std::max)(0, (std::min)(3, logicalCpuCount() - 2));
+        if (workers > 0) {
+            stripePool.start(workers);
+            dx.stripePool      = &stripePool;
+            dx.stripeMinPixels = static_cast<long long>(
+                opt.stripeMpix * 1e6 / (srcFps > 1.0 ? srcFps : 60.0));
+        }
+    }
+
+    // --record: кодер на своём потоке, рендер только рисует в его пул.
+    Recorder recorder;
+    if (!opt.record.empty() &&
+        !recorder.start(opt.record, opt.recordHevc, opt.recordMbps, dx.device, srcW, srcH, srcFps))
+        std::cerr << "[WARN] Recording disabled\n";
+
+    // Основной источник переоткрылся в другом разрешении: размер кадра
+    // sink writer'а не сменить, кадры другой формы drawSource не примет.
+    // Файл закрывается, запись идёт в следующий: name_2.mp4, name_3.mp4...
+    int  recordParts = 1;
+    auto restartRecording = [&]() {
+        recorder.stop();
+        const size_t slash = opt.record.find_last_of("\\/");
+        size_t       dot   = opt.record.find_last_of('.');
+        if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+            dot = opt.record.size();
+        const std::string path = opt.record.substr(0, dot) + "_" + std::to_string(++recordParts) +
+                                 opt.record.substr(dot);
+        std::cerr << "[WARN] Capture size changed to " << srcW << "x" << srcH
+                  << ", recording continues in " << path << "\n";
+        if (!recorder.start(path, opt.recordHevc, opt.recordMbps, dx.device, srcW, srcH, srcFps))
+            std::cerr << "[WARN] Recording disabled\n";
+    };
+
+    const bool striped = stripePool.workers() > 0 &&
+                         static_cast<long long>(srcW) * srcH >= dx.stripeMinPixels;
+    if (bench) {
+        std::cerr << "[INFO] Benchmark: " << srcW << "x" << srcH << " " << fourccStr
+                  << " @ " << srcFps << " fps for " << opt.benchSeconds << " s\n";
+        std::cerr << "[INFO] CPU sets: " << g_cpu.summary << "\n";
+    } else {
         std::string res = std::to_string(srcW) + " x " + std::to_string(srcH);
         std::string fps = std::to_string((int)srcFps);
-        std::string keys = vkToString(kb.vkFPS)   + " = FPS  |  "
-                         + vkToString(kb.vkVSync) + " = VSync  |  "
+        std::string keys = vkToString(kb.vkFPS)   + " = FPS | "
+                         + vkToString(kb.vkVSync) + " = Pacing | "
+                         + vkToString(kb.vkScale) + " = Scale | "
                          + vkToString(kb.vkExit)  + " = Exit";
         std::cout << "\n" << UI_TOP << "\n";
         uiCenter("Capture Device Info");
         std::cout << UI_SEP << "\n";
         uiLine("Resolution  :  " + res);
-        uiLine(std::string("Codec       :  ") + fourccStr);
+        uiLine("Codec       :  " + fourccStr);
         uiLine("Target FPS  :  " + fps);
-        if (std::string(fourccStr) != "YUY2")
-            uiLine("[!] MJPG mode — extra 5-15ms decode delay");
+        uiLine(std::string("Backend     :  ") + cap->backendName());
+        if (!extraCap.empty()) {
+            uiLine("Sources     :  " + std::to_string(1 + extraCap.size()) +
+                   (opt.layout == LayoutMode::Pip ? ", picture-in-picture" : ", grid"));
+            for (size_t k = 0; k < extraCap.size(); ++k) {
+                std::string cpu;                    // ядро захвата, если CPU sets включены
+                if (k + 1 < g_cpu.captureLp.size() && g_cpu.captureLp[k + 1] >= 0)
+                    cpu = ", CPU " + std::to_string(g_cpu.captureLp[k + 1]);
+                else if (!g_cpu.captureLp.empty())
+                    cpu = ", default CPUs";
+                uiLine("Source [" + std::to_string(extraDevices[k].index) + "]  :  " +
+                       std::to_string(extraCap[k]->width()) + " x " +
+                       std::to_string(extraCap[k]->height()) + " " + extraCap[k]->fourcc() + cpu);
+            }
+        }
+        if (cap->format() == PixelFormat::YUY2)
+            uiLine("Pixel path  :  YUY2 passthrough (GPU decode)");
+        else if (isPlanar(cap->format())) {
+            const std::string pf = (cap->format() == PixelFormat::P010) ? "P010" : "NV12";
+            uiLine(fourccStr == pf ? "Pixel path  :  " + pf + " passthrough (GPU decode)"
+                                   : "Pixel path  :  " + fourccStr + " -> " + pf + " (MF decoder)");
+        }
+        else
+            uiLine(std::string("Pixel path  :  BGR24 -> BGRA (") + bgrToBgraKernel(opt.simd).name + ")");
+        std::string up = (opt.upload == UploadMode::Ring)
+                       ? "ring x" + std::to_string(opt.staging) : std::string("dynamic");
+        if (captureSlots)
+            up += ", written by capture thread";
+        else
+            up += striped ? ", " + std::to_string(stripePool.workers() + 1) + " stripes"
+                          : std::string(", single thread");
+        uiLine("Upload      :  " + up);
+        const bool fullRange = opt.range == ColorRange::Full ||
+                               (opt.range == ColorRange::Auto && cap->format() == PixelFormat::BGR24);
+        std::string color = std::string(colorMatrixName(dx.matrix)) +
+                            (fullRange ? " full, " : " limited, ") + transferName(opt.transfer);
+        if (dx.hdr10)                             color += " -> HDR10";
+        else if (opt.transfer != TransferFn::SDR) color += " -> SDR";
+        uiLine("Color       :  " + color);
+        uiLine(std::string("Scaling     :  ") + scaleModeName(opt.scale));
+        uiLine(std::string("Pacing      :  ") + pacingLabel(opt.pacing));
+        uiLine("Display     :  " + outputLabel(display));
+        if (!display.adapterName.empty())
+            uiLine("Adapter     :  " + display.adapterName);
+        uiLine(std::string("Overlays    :  ") +
+               (!dx.overlayPlanes ? "none" : dx.overlayScaling ? "planes with scaling"
+                                                               : "planes, no scaling") +
+               (dx.scanout ? ", --scanout" : ""));
+        uiLine("CPU sets    :  " + g_cpu.summary);
+        if (!g_cpu.helper.empty())
+            uiLine("Helpers     :  " + std::to_string(g_cpu.helper.size()) +
+                   (g_cpu.hybrid ? " E-core CPUs" : " CPUs"));
+        if (opt.dirty)
+            uiLine("Dirty tiles :  64x64, unchanged frames skip Present");
+        if (recorder.active())
+            uiLine(std::string("Recording   :  ") + (opt.recordHevc ? "HEVC " : "H.264 ") +
+                   std::to_string(opt.recordMbps) + " Mbit/s, " +
+                   (recorder.hardware ? "hardware encoder" : "software encoder"));
+        if (fourccStr != "YUY2" && cap->format() == PixelFormat::BGR24)
+            uiLine("[!] MJPG mode — extra 5-15ms CPU decode delay");
         std::cout << UI_SEP << "\n";
         uiLine(keys);
         std::cout << UI_BOT << "\n\n";
     }
 
-    // ── Окно + DirectX ───────────────────────────────────────────────────────
-    int winW = 0, winH = 0;
-    HWND hwnd = createFullscreenWindow(winW, winH);
-    hideCursor();
-
-    DX11Renderer dx;
-    if (!dx.init(hwnd, winW, winH)) {
-        std::cerr << "[ERROR] DX11 init failed.\n";
-        vs.stop(); allowSleep(); return 1;
-    }
-
-    auto prevTime = std::chrono::steady_clock::now();
-
-    // ── Состояния клавиш (защита от дребезга) ────────────────────────────────
-    KeyState ksFPS, ksVSync, ksExit;
+    LatencyStats lat;
+    if (!opt.latencyLog.empty() && !lat.openLog(opt.latencyLog))
+        std::cerr << "[WARN] Cannot open latency log: " << opt.latencyLog << "\n";
+    Calibration  calib;
+    double       uploadMsAvg = 0.0;           // запас до vblank в режиме scheduled
+
+    // Восстановление: источник [0] — основной, дальше --devices. Время —
+    // от потери до первого кадра нового источника (захват) и до готового
+    // рендера (D3D устройство).
+    struct Recovery {
+        int    count = 0;
+        double lastMs = 0.0, maxMs = 0.0;
+        void add(double ms) { ++count; lastMs = ms; maxMs = (std::max)(maxMs, ms); }
+    };
+    Recovery                 captureRecovery, deviceRecovery;
+    std::vector<Reconnector> reconnect(1 + extraCap.size());
+    std::vector<int64_t>     lastFresh(reconnect.size(), qpcNow());
+    std::vector<int64_t>     recoverSince(reconnect.size(), 0);
+
+    // TDR / удалённый адаптер: рендер и всё, что держит его устройство (MF
+    // ридеры, слоты загрузки, кодер записи), создаются заново с теми же
+    // настройками — без настройки клавиш и выбора устройств. Файл записи к
+    // этому моменту уже закрыт Finalize, новая запись его бы затёрла.
+    auto rebuildDevice = [&]() -> bool {
+        const int64_t t0 = qpcNow();
+        std::cerr << "[DX11] Device lost (0x" << std::hex << dx.device->GetDeviceRemovedReason()
+                  << std::dec << "), rebuilding renderer and capture\n";
+        for (auto& r : reconnect) r.cancel();
+        if (cap) cap->stop();
+        cap.reset();
+        for (auto& c : extraCap) { if (c) c->stop(); c.reset(); }
+        if (recorder.active()) {
+            recorder.stop();
+            std::cerr << "[WARN] Recording ended by the device reset\n";
+        }
+        pacer.vblank.stop();
+        dx.uploadSlots.release(dx.ctx);
+        dx.release();
+        bool ok = false;
+        for (int i = 0; i < 10 && !(ok = dx.init(hwnd, winW, winH)); ++i) {
+            dx.release();
+            Sleep(500);
+        }
+        if (!ok) return false;
+        cap = openPrimary();
+        for (size_t k = 0; k < extraCap.size(); ++k)
+            extraCap[k] = openDevice(extraDevices[k], *extraTb[k], k + 1);
+        adoptPrimary();
+        std::fill(lastFresh.begin(), lastFresh.end(), qpcNow());
+        deviceRecovery.add(qpcToMs(qpcNow() - t0));
+        std::cout << "[INFO] Renderer rebuilt in " << (int)deviceRecovery.lastMs << " ms\n";
+        return true;
+    };
 
     // ── Главный цикл ─────────────────────────────────────────────────────────
+    // Поток спит в MsgWaitForMultipleObjectsEx до нового кадра или сообщения
+    // окна; горячие клавиши будят его сами (WM_INPUT). Таймаут — для конца
+    // --bench и слежения за источниками, пока кадров нет.
+    //
+    // С waitable swap chain ожидание двухфазное: сначала место в очереди
+    // present (latencyWait), затем кадр. Так кадр берётся из TripleBuffer
+    // как можно позже и не стоит в очереди DXGI.
+    const DWORD IDLE_MS = 50;
+    bool latencyReady = (dx.latencyWait == nullptr);
+
+    BenchReport br;
+    br.width     = srcW;
+    br.height    = srcH;
+    br.format    = opt.benchFormat;
+    br.targetFps = srcFps;
+    br.upload    = (opt.upload == UploadMode::Ring)
+                 ? "ring" + std::to_string(opt.staging) : std::string("dynamic");
+    br.kernel    = bgrToBgraKernel(opt.simd).name;
+    br.stripes   = striped ? stripePool.workers() + 1 : 1;
+    br.scale     = scaleModeName(opt.scale);
+    br.dirty     = opt.dirty;
+    br.captureSlots = captureSlots;
+
+    const int64_t benchStart = qpcNow();
+    const int64_t benchEnd   = bench ? benchStart + opt.benchSeconds * qpcFrequency() : 0;
+    const double  cpu0       = processCpuMs(), thr0 = threadCpuMs();
+    int64_t       firstPresentQpc = 0;
+
+    // Новый кадр источника k или nullptr. Пока источник переоткрывается,
+    // его TripleBuffer не читаем.
+    auto freshFrame = [&](size_t k, TripleBuffer& buf) -> Frame* {
+        bool   newer = false;
+        Frame* f     = reconnect[k].busy() ? nullptr : buf.tryRead(&newer);
+        if (!f || !newer) return nullptr;
+        lastFresh[k] = qpcNow();
+        if (recoverSince[k]) {
+            captureRecovery.add(qpcToMs(lastFresh[k] - recoverSince[k]));
+            recoverSince[k] = 0;
+        }
+        return f;
+    };
+
+    discardInput();
     while (g_running) {
+        if (benchEnd && qpcNow() >= benchEnd) break;
+
+        // 0. Ждём очередь present / кадр любого источника / сообщение
+        HANDLE waitOn[MAX_SOURCES];
+        DWORD  waitCount = 1;
+        waitOn[0] = latencyReady ? tb.frameEvent : dx.latencyWait;
+        if (latencyReady)
+            for (auto& t : extraTb) waitOn[waitCount++] = t->frameEvent;
+        DWORD  wr     = MsgWaitForMultipleObjectsEx(waitCount, waitOn, IDLE_MS,
+                                                    QS_ALLINPUT, MWMO_INPUTAVAILABLE);
+        if (!latencyReady && wr == WAIT_OBJECT_0) latencyReady = true;
+
         // 1. Системные сообщения
         MSG msg;
         while (PeekMessageW(&msg, nullptr, 0, 0, PM_REMOVE)) {
@@ -1015,38 +7292,264 @@ int main()
             DispatchMessageW(&msg);
         }
 
-        // 2. Опрос настроенных клавиш (передний фронт нажатия)
-        //    GetAsyncKeyState поддерживает все VK, включая XBUTTONs.
-        if (ksFPS.poll(kb.vkFPS))     g_showFPS = !g_showFPS.load();
-        if (ksVSync.poll(kb.vkVSync)) g_vsync   = !g_vsync.load();
-        if (ksExit.poll(kb.vkExit))   g_running = false;
+        // 2. Горячие клавиши: передние фронты нажатий из WM_INPUT
+        for (int vk; g_keyEvents.pop(vk); ) {
+            if (vk == kb.vkFPS)   g_showFPS = !g_showFPS.load();
+            if (vk == kb.vkVSync)
+                g_pacing = static_cast<PresentPacing>(
+                    (static_cast<int>(g_pacing.load()) + 1) % PRESENT_PACING_COUNT);
+            if (vk == kb.vkScale)
+                dx.scaleMode = static_cast<ScaleMode>(
+                    (static_cast<int>(dx.scaleMode) + 1) % SCALE_MODE_COUNT);
+            if (vk == kb.vkExit)  g_running = false;
+        }
+
+        // 2b. Потерянный источник переоткрывается в фоне (см. Reconnector),
+        //     на экране остаётся последний кадр.
+        const bool devChanged = g_deviceChanged.exchange(false);
+        for (size_t k = 0; k < reconnect.size() && !bench; ++k) {
+            std::unique_ptr<CaptureSource>& c = k ? extraCap[k - 1] : cap;
+            Reconnector& r = reconnect[k];
+            if (r.busy()) {
+                if (devChanged) r.poke();
+                if ((c = r.take())) {
+                    std::cout << "[INFO] Capture device reopened after " << r.attempts
+                              << " attempt(s)\n";
+                    lastFresh[k] = qpcNow();
+                    if (k == 0) {
+                        adoptPrimary();
+                        if (recorder.active() &&
+                            (srcW != recorder.width() || srcH != recorder.height()))
+                            restartRecording();
+                    }
+                }
+                continue;
+            }
+            // Без ошибки чтения: карта пропала из системы, а кадров нет
+            // STALL_PERIODS периодов источника (не меньше 250 мс, без fps —
+            // как у 1 fps): медленный источник не переоткрываем зря.
+            if (!c) continue;
+            bool stalled = false;
+            if (devChanged) {
+                const double fps = c->fps() > 1.0 ? c->fps() : 1.0;
+                stalled = qpcToMs(qpcNow() - lastFresh[k]) >
+                          (std::max)(250.0, Reconnector::STALL_PERIODS * 1000.0 / fps);
+            }
+            if (!(c->lost() || stalled)) continue;
+            std::cerr << "[WARN] Capture device lost, reconnecting in the background\n";
+            if (!recoverSince[k]) recoverSince[k] = qpcNow();
+            TripleBuffer&    buf = k ? *extraTb[k - 1] : tb;
+            const DeviceInfo dev = k ? extraDevices[k - 1] : device;
+            r.begin(std::move(c), [&openDevice, &buf, dev, k] { return openDevice(dev, buf, k); });
+        }
 
-        // 3. Захват и вывод кадра
-        cv::Mat* framePtr = tb.tryRead();
-        if (!framePtr || framePtr->empty()) { Sleep(1); continue; }
+        // 3. Захват и вывод кадра — только если пришёл новый.
+        //    Слоты, которые GPU уже скопировал, снова мапятся под захват.
+        dx.uploadSlots.pump(dx.ctx);
+        if (!latencyReady) continue;
+        Frame* framePtr = freshFrame(0, tb);
+        // --devices: свежие кадры остальных источников сразу в их слои.
+        // Present идёт по любому новому кадру.
+        bool extraFresh = false;
+        for (size_t k = 0; k < extraTb.size(); ++k) {
+            Frame* f = freshFrame(k + 1, *extraTb[k]);
+            if (f) { dx.uploadFrame(*f, k + 1); extraFresh = true; }
+        }
+        const bool primary = framePtr != nullptr;
+        if (!primary && !extraFresh) continue;
+
+        // FPS захвата (коммиты) и показа (Present) считаются раздельно.
+        lat.tick(qpcNow());
+        if (g_showFPS) {
+            std::string dirtyText;
+            const DirtyTiles& tiles = dx.layers[0].dirty;
+            if (dx.dirtyTracking && !tiles.hash.empty())
+                dirtyText = " | tiles " + std::to_string(tiles.dirtyCount) + "/" +
+                            std::to_string(tiles.hash.size());
+            char buf[192];
+            snprintf(buf, sizeof(buf), "FPS: %d (capture %d, dropped %llu) | %s | %s\n"
+                     "Scale: %s | GPU %.2f ms%s | %s",
+                     (int)(lat.renderFps + 0.5), (int)(lat.captureFps + 0.5),
+                     static_cast<unsigned long long>(lat.dropped), fourccStr.c_str(),
+                     pacingLabel(g_pacing.load()),
+                     scaleModeName(dx.scaleMode), dx.gpuTimer.avgMs, dirtyText.c_str(),
+                     dx.presentPathLabel().c_str());
+            std::string calibText;
+            if (opt.calibrate) {
+                char c[96];
+                snprintf(c, sizeof(c), "\nCalibration: %d edges | capture->photon %.1f ms%s",
+                         calib.edges(), calib.lastPhotonMs(), calib.hasSender() ? " | sender" : "");
+                calibText = c;
+            }
+            if (captureRecovery.count || deviceRecovery.count) {
+                char r[128];
+                snprintf(r, sizeof(r), "\nRecovered: capture %d (last %.0f ms) | GPU %d (last %.0f ms)",
+                         captureRecovery.count, captureRecovery.lastMs,
+                         deviceRecovery.count, deviceRecovery.lastMs);
+                calibText += r;
+            }
+            if (recorder.active()) {
+                char r[96];
+                snprintf(r, sizeof(r), "\nRecording: %llu frames, %llu dropped",
+                         static_cast<unsigned long long>(recorder.written.load()),
+                         static_cast<unsigned long long>(recorder.dropped));
+                calibText += r;
+            }
+            dx.setOverlay(buf + calibText + lat.overlayText());
+        } else {
+            dx.setOverlay({});
+        }
 
-        auto   now = std::chrono::steady_clock::now();
-        double fps = 1e9 / static_cast<double>(
-            std::chrono::duration_cast<std::chrono::nanoseconds>(
-                now - prevTime).count());
-        prevTime = now;
+        // vrr / scheduled могут отложить Present. Кадр, пришедший за время
+        // ожидания, свежее — показываем его (прежний уйдёт в dropped).
+        const int64_t presentAt = !primary ? 0 :
+            pacer.target(*framePtr, g_pacing.load(), dx.swapChain,
+                         1.0 + uploadMsAvg + dx.gpuTimer.avgMs);
+        if (presentAt > qpcNow()) {
+            pacer.waitUntil(presentAt);
+            bool   newer = false;
+            Frame* next  = tb.tryRead(&newer);
+            if (next && newer) {
+                framePtr = next;
+                pacer.cadence.update(next->tReceive, next->tDevice ? next->tDevice : next->tReceive);
+            }
+        }
 
-        if (g_showFPS)
-            drawFPS(framePtr, fps, fourccStr);
+        const int64_t tUpload = qpcNow();
+        if (primary) dx.uploadFrame(*framePtr);
+        const int64_t tUploaded = qpcNow();
+        if (primary) uploadMsAvg += (qpcToMs(tUploaded - tUpload) - uploadMsAvg) / 16.0;
+        const bool presented = dx.render();
+        if (dx.deviceLost()) {
+            if (!rebuildDevice()) {
+                std::cerr << "[ERROR] DX11 device could not be recreated\n";
+                break;
+            }
+            latencyReady = (dx.latencyWait == nullptr);
+            continue;
+        }
+        if (presented) {
+            latencyReady = (dx.latencyWait == nullptr);
+            ++br.presented;
+            if (primary && !firstPresentQpc) firstPresentQpc = dx.lastPresentQpc;
+            if (primary) {
+                lat.onPresent(*framePtr, tUpload, tUploaded, dx.lastPresentQpc, dx.lastPresentId);
+                if (opt.calibrate)
+                    dx.queueMarkerReadback({ dx.lastPresentId, framePtr->tDevice,
+                                             framePtr->tReceive });
+            }
+        }
+        // Кадр из слота скопировал поток захвата — рендер пикселей не трогал.
+        if (primary && !framePtr->gpuTex && framePtr->uploadSlot < 0) {
+            br.uploadBytes += framePtr->bytes();
+            br.uploadTicks += tUploaded - tUpload;
+        }
+        if (primary) framePtr->uploadSlot = -1;  // слот забран, reclaim его не тронет
+        // После Present: запись не задерживает показ кадра.
+        if (primary) recorder.push(dx, framePtr->tReceive);
+
+        UINT    shownId = 0;
+        int64_t shownAt = 0;
+        if (dx.displayedPresent(shownId, shownAt)) {
+            lat.onDisplayed(shownId, shownAt);
+            calib.onDisplayed(shownId, shownAt);
+        }
+        if (opt.calibrate) {
+            int       luma = 0;
+            MarkerTag tag;
+            while (dx.marker.poll(dx.ctx, luma, tag)) calib.onSample(luma, tag);
+            calib.pollSender();
+        }
+    }
 
-        dx.uploadFrame(*framePtr);
-        dx.render();
+    br.seconds      = qpcToMs(qpcNow() - benchStart) / 1000.0;
+    br.processCpuMs = processCpuMs() - cpu0;
+    br.renderCpuMs  = threadCpuMs() - thr0;
+    br.gpuMsSum     = dx.gpuTimer.sumMs;
+    br.gpuMsMax     = dx.gpuTimer.maxMs;
+    br.gpuSamples   = dx.gpuTimer.samples;
+    br.tilesUploaded   = dx.tilesUploaded;
+    br.tilesTotal      = dx.tilesTotal;
+    br.presentsSkipped = dx.presentsSkipped;
+    br.slotFrames      = dx.uploadSlots.stored;
+    br.slotMisses      = dx.uploadSlots.misses;
+    br.firstPresentMs  = firstPresentQpc ? qpcToMs(firstPresentQpc - tStart) : 0.0;
+    br.pathDirect      = dx.pathChecks[static_cast<int>(PresentPath::Direct)];
+    br.pathComposed    = dx.pathChecks[static_cast<int>(PresentPath::Composed)];
+
+    const std::string   backendName  = cap ? cap->backendName() : "";  // для отчёта калибровки
+    const PresentPacing pacingAtExit = g_pacing.load();
+    // Фильтр и темп переключаются клавишами — в профиль идут последние.
+    if (!bench) {
+        session.scale  = static_cast<int>(dx.scaleMode);
+        session.pacing = static_cast<int>(pacingAtExit);
+        saveSessionProfile(session);
     }
 
     // ── Очистка ───────────────────────────────────────────────────────────────
+    // Сначала захват: MF держит ссылки на устройство и текстуры рендерера.
+    for (auto& r : reconnect) r.cancel();
+    if (cap) cap->stop();
+    br.captured = tb.nextSeq - 1;
+    cap.reset();
+    for (auto& c : extraCap) if (c) c->stop();
+    extraCap.clear();
+    stripePool.stop();
+    if (mfStarted) MFShutdown();
+    pacer.vblank.stop();
+    recorder.stop();
+    dx.uploadSlots.release(dx.ctx);
     dx.release();
-    vs.stop();
     DestroyWindow(hwnd);
     showCursor();
     allowSleep();
     if (mmh) AvRevertMmThreadCharacteristics(mmh);
 
     CoUninitialize();
+
+    if (bench) {
+        br.pacing = pacingName(pacingAtExit);
+        br.vsync  = pacingAtExit == PresentPacing::VSync || pacingAtExit == PresentPacing::Scheduled;
+        if (opt.benchOut.empty()) {
+            writeBenchReport(std::cout, br, lat);
+        } else {
+            std::ofstream out(opt.benchOut, std::ios::trunc);
+            writeBenchReport(out, br, lat);
+            if (!out) { std::cerr << "[ERROR] Cannot write " << opt.benchOut << "\n"; return 1; }
+        }
+        return 0;
+    }
+
+    lat.printSummary();
+    if (br.pathDirect + br.pathComposed)
+        std::cout << "[INFO] Present path: direct scanout "
+                  << (int)(100 * br.pathDirect / (br.pathDirect + br.pathComposed))
+                  << "% of " << (br.pathDirect + br.pathComposed) << " checks, DWM composed the rest\n";
+    if (firstPresentQpc)
+        std::cout << "[INFO] First frame on screen " << (int)br.firstPresentMs
+                  << " ms after start" << (quick ? " (--quick)" : "") << "\n";
+    if (captureRecovery.count)
+        std::cout << "[INFO] Capture recovered " << captureRecovery.count << " time(s), last "
+                  << (int)captureRecovery.lastMs << " ms, max " << (int)captureRecovery.maxMs << " ms\n";
+    if (deviceRecovery.count)
+        std::cout << "[INFO] Renderer rebuilt " << deviceRecovery.count << " time(s), last "
+                  << (int)deviceRecovery.lastMs << " ms, max " << (int)deviceRecovery.maxMs << " ms\n";
+    if (!opt.record.empty() && recorder.written > 0)
+        std::cout << "[INFO] Recorded " << recorder.written.load() << " frames to " << opt.record
+                  << (recordParts > 1 ? " and " + std::to_string(recordParts - 1) + " more file(s)"
+                                      : std::string())
+                  << " (" << recorder.dropped << " dropped for the encoder)\n";
+    if (opt.calibrate) {
+        const std::string up = (opt.upload == UploadMode::Ring)
+                             ? "ring x" + std::to_string(opt.staging) : std::string("dynamic");
+        calib.printReport({
+            "Source   :  " + fourccStr + " " + std::to_string(srcW) + "x" +
+                std::to_string(srcH) + " @ " + std::to_string((int)(srcFps + 0.5)),
+            "Backend  :  " + backendName,
+            std::string("Present  :  ") + presentPathName(dx.sessionPath()) + ", " +
+                pacingLabel(pacingAtExit),
+            "Upload   :  " + up });
+    }
     std::cout << "[INFO] Session ended.\n";
     return 0;
 }
@@ -0,0 +1,10 @@
+// Полноэкранный треугольник без vertex buffer: SV_VertexID 0..2.
+
+struct VS_OUT { float4 pos : SV_POSITION; float2 uv : TEXCOORD; };
+VS_OUT main(uint id : SV_VertexID) {
+    float2 uv  = float2((id & 1) ? 2.0f : 0.0f, (id & 2) ? 2.0f : 0.0f);
+    VS_OUT o;
+    o.pos = float4(uv.x * 2.0f - 1.0f, 1.0f - uv.y * 2.0f, 0.0f, 1.0f);
+    o.uv  = uv;
+    return o;
+}
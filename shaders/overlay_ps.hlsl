@@ -0,0 +1,33 @@
+// Оверлей: atlas — R8 покрытие глифа, цвет и альфа из вершины.
+//   OUT_PQ — HDR10 swap chain: цвет вершины (sRGB) в PQ BT.2020 с белым
+//            SDR из ColorParams, иначе текст на HDR экране слепит.
+
+Texture2D    atlas : register(t0);
+SamplerState sam   : register(s0);
+struct VS_OUT { float4 pos : SV_POSITION; float2 uv : TEXCOORD; float4 col : COLOR; };
+
+#if defined(OUT_PQ)
+cbuffer ColorParams : register(b1) {
+    float4 yuvR, yuvG, yuvB, rgbRange;
+    uint   transfer, output;
+    float  peakNits, whiteNits;
+};
+
+float3 toPq(float3 c) {
+    const float3x3 BT709_TO_2020 = {
+        0.6274f, 0.3293f, 0.0433f,
+        0.0691f, 0.9195f, 0.0114f,
+        0.0164f, 0.0880f, 0.8956f };
+    const float3 y = pow(saturate(mul(BT709_TO_2020, pow(c, 2.2f)) * whiteNits / 10000.0f),
+                         0.1593017578125f);
+    return pow((0.8359375f + 18.8515625f * y) / (1.0f + 18.6875f * y), 78.84375f);
+}
+#endif
+
+float4 main(VS_OUT i) : SV_TARGET {
+#if defined(OUT_PQ)
+    return float4(toPq(i.col.rgb), i.col.a * atlas.Sample(sam, i.uv).r);
+#else
+    return float4(i.col.rgb, i.col.a * atlas.Sample(sam, i.uv).r);
+#endif
+}
@@ -0,0 +1,11 @@
+// Оверлей: квады в NDC, готовые с CPU.
+
+struct VS_IN  { float2 pos : POSITION; float2 uv : TEXCOORD; float4 col : COLOR; };
+struct VS_OUT { float4 pos : SV_POSITION; float2 uv : TEXCOORD; float4 col : COLOR; };
+VS_OUT main(VS_IN i) {
+    VS_OUT o;
+    o.pos = float4(i.pos, 0.0f, 1.0f);
+    o.uv  = i.uv;
+    o.col = i.col;
+    return o;
+}
@@ -0,0 +1,75 @@
+// Масштабирование уже декодированного RGB кадра (промежуточная текстура
+// в разрешении источника). Варианты через defines:
+//   SCALE_BILINEAR — один проход, аппаратная билинейная выборка
+//   SCALE_BICUBIC  — Catmull-Rom (B = 0, C = 0.5), радиус 2
+//   SCALE_LANCZOS  — Lanczos3, радиус 3
+//   AXIS_Y         — вертикальный проход разделимого фильтра, без него —
+//                    горизонтальный (источник W x H -> выход dstW x H)
+// При уменьшении ядро растягивается в src/dst раз, иначе — алиасинг.
+
+Texture2D    src : register(t0);
+SamplerState sam : register(s0);
+cbuffer ScaleParams : register(b0) { float2 dstSize; float2 pad; };
+struct VS_OUT { float4 pos : SV_POSITION; float2 uv : TEXCOORD; };
+
+#if defined(SCALE_BILINEAR)
+float4 main(VS_OUT i) : SV_TARGET {
+    return float4(src.Sample(sam, i.uv).rgb, 1.0f);
+}
+#else
+
+#if defined(SCALE_LANCZOS)
+#define RADIUS 3.0f
+float weight(float x) {
+    x = abs(x);
+    if (x < 1e-5f) return 1.0f;
+    if (x >= RADIUS) return 0.0f;
+    const float px = 3.14159265f * x;
+    return RADIUS * sin(px) * sin(px / RADIUS) / (px * px);
+}
+#else
+#define RADIUS 2.0f
+float weight(float x) {
+    x = abs(x);
+    if (x < 1.0f) return (1.5f * x - 2.5f) * x * x + 1.0f;
+    if (x < 2.0f) return ((-0.5f * x + 2.5f) * x - 4.0f) * x + 2.0f;
+    return 0.0f;
+}
+#endif
+
+float4 main(VS_OUT i) : SV_TARGET {
+    uint w, h;
+    src.GetDimensions(w, h);
+    const int2 size = int2(w, h);
+#if defined(AXIS_Y)
+    const int2  axis = int2(0, 1);
+    const float len  = h, coord = i.uv.y, dst = dstSize.y;
+#else
+    const int2  axis = int2(1, 0);
+    const float len  = w, coord = i.uv.x, dst = dstSize.x;
+#endif
+    // Поперёк оси выход совпадает с источником texel в texel.
+    const int2  base   = int2(min(i.uv * float2(size), float2(size - 1))) * (1 - axis);
+    const float ratio  = clamp(len / dst, 1.0f, 4.0f);
+    const float center = coord * len - 0.5f;
+    const int   first  = int(floor(center - RADIUS * ratio)) + 1;
+    const int   last   = int(floor(center + RADIUS * ratio));
+
+    float3 acc  = 0.0f;
+    float  wsum = 0.0f;
+    [loop]
+    for (int t = first; t <= last; ++t) {
+        const float wt = weight((t - center) / ratio);
+        const int2  p  = base + axis * clamp(t, 0, int(len) - 1);
+        acc  += wt * src.Load(int3(p, 0)).rgb;
+        wsum += wt;
+    }
+    // Отрицательные лепестки дают звон выше 1 и ниже 0 — промежуточная
+    // текстура float16 хранит его до второго прохода, на выходе saturate.
+#if defined(AXIS_Y)
+    return float4(saturate(acc / wsum), 1.0f);
+#else
+    return float4(acc / wsum, 1.0f);
+#endif
+}
+#endif
@@ -0,0 +1,125 @@
+// Вывод кадра. Варианты через defines (build_shaders.cmd / D3D_SHADER_MACRO):
+//   FMT_YUY2     — текстура R8G8B8A8 половинной ширины, texel = (Y0, U, Y1, V)
+//   FMT_NV12     — две view одной NV12 текстуры: R8 (Y) и R8G8 (UV, 1/2 x 1/2)
+//   FMT_P010     — вместе с FMT_NV12: view R16 / R16G16 текстуры P010
+// Без FMT_* — старый BGRX путь: перестановка B и R.
+//
+// Цвет — в том же проходе из ColorParams (DX11Renderer::updateColor): матрица
+// и диапазон YUV, диапазон RGB, передаточная функция источника и выход.
+// SDR источник на SDR выходе — только матрица, как раньше. PQ / HLG на SDR
+// выходе — тон-маппинг в BT.709 с гаммой 2.2, на HDR10 выходе — PQ BT.2020.
+
+Texture2D    tex    : register(t0);
+Texture2D    chroma : register(t1);
+SamplerState sam    : register(s0);
+struct VS_OUT { float4 pos : SV_POSITION; float2 uv : TEXCOORD; };
+
+cbuffer ColorParams : register(b1) {
+    float4 yuvR, yuvG, yuvB;   // RGB = dot(строка, (Y, Cb, Cr, 1)), диапазон учтён
+    float4 rgbRange;           // BGR источник: x * c + y
+    uint   transfer;           // 0 — SDR (гамма), 1 — PQ, 2 — HLG
+    uint   output;             // 0 — SDR, 1 — HDR10 (PQ, BT.2020)
+    float  peakNits;           // пик контента: тон-маппинг и OOTF HLG
+    float  whiteNits;          // белый SDR в нитах
+    uint   wide;               // основные цвета источника — BT.2020
+    float3 pad;
+};
+
+static const float3x3 BT709_TO_2020 = {
+    0.6274f, 0.3293f, 0.0433f,
+    0.0691f, 0.9195f, 0.0114f,
+    0.0164f, 0.0880f, 0.8956f };
+static const float3x3 BT2020_TO_709 = {
+     1.6605f, -0.5876f, -0.0728f,
+    -0.1246f,  1.1329f, -0.0083f,
+    -0.0182f, -0.1006f,  1.1187f };
+
+// SMPTE ST 2084.
+static const float PQ_M1 = 0.1593017578125f, PQ_M2 = 78.84375f;
+static const float PQ_C1 = 0.8359375f, PQ_C2 = 18.8515625f, PQ_C3 = 18.6875f;
+
+float3 pqToNits(float3 e) {
+    const float3 p = pow(saturate(e), 1.0f / PQ_M2);
+    return 10000.0f * pow(max(p - PQ_C1, 0.0f) / (PQ_C2 - PQ_C3 * p), 1.0f / PQ_M1);
+}
+
+float3 nitsToPq(float3 n) {
+    const float3 y = pow(saturate(n / 10000.0f), PQ_M1);
+    return pow((PQ_C1 + PQ_C2 * y) / (1.0f + PQ_C3 * y), PQ_M2);
+}
+
+// ARIB STD-B67: обратная OETF и OOTF с гаммой по пику дисплея (BT.2100).
+float3 hlgToNits(float3 e) {
+    const float a = 0.17883277f, b = 0.28466892f, c = 0.55991073f;
+    e = saturate(e);
+    const float3 lin   = (e <= 0.5f) ? e * e / 3.0f : (exp((e - c) / a) + b) / 12.0f;
+    const float  ys    = dot(lin, float3(0.2627f, 0.6780f, 0.0593f));
+    const float  gamma = 1.2f + 0.42f * log10(peakNits / 1000.0f);
+    return peakNits * lin * pow(max(ys, 1e-6f), gamma - 1.0f);
+}
+
+// Расширенный Reinhard по максимуму канала, x в единицах белого SDR: пик
+// контента -> 1.0 ровно, сам белый -> (1 + 1/peak^2) / 2, около 0.5 (запас
+// под блики); оттенок не уходит (все каналы в одном масштабе).
+float3 toneMap(float3 nits) {
+    const float3 x    = nits / whiteNits;
+    const float  peak = peakNits / whiteNits;
+    const float  m    = max(max(x.r, x.g), x.b);
+    const float  t    = m * (1.0f + m / (peak * peak)) / (1.0f + m);
+    return (m > 0.0f) ? x * (t / m) : 0.0f;
+}
+
+// Сигнал источника (нелинейный, его основные цвета) -> сигнал выхода.
+float3 finish(float3 rgb) {
+    if (transfer == 0 && output == 0 && wide == 0) return saturate(rgb);
+    float3 nits;
+    if      (transfer == 1) nits = pqToNits(rgb);
+    else if (transfer == 2) nits = hlgToNits(rgb);
+    else                    nits = pow(saturate(rgb), 2.2f) * whiteNits;
+    if (output == 1)
+        return nitsToPq(wide ? nits : mul(BT709_TO_2020, nits));
+    float3 lin = (transfer == 0) ? nits / whiteNits : toneMap(nits);
+    if (wide) lin = mul(BT2020_TO_709, lin);
+    return pow(saturate(lin), 1.0f / 2.2f);
+}
+
+#if defined(FMT_YUY2) || defined(FMT_NV12)
+float3 yuvToRgb(float y, float u, float v) {
+    const float4 s = float4(y, u, v, 1.0f);
+    return float3(dot(yuvR, s), dot(yuvG, s), dot(yuvB, s));
+}
+#endif
+
+#if defined(FMT_NV12)
+float4 main(VS_OUT i) : SV_TARGET {
+    uint pw, ph;
+    tex.GetDimensions(pw, ph);
+    // Цветность без интерполяции: ближайший UV texel (co-sited слева сверху).
+    int2   p  = int2(min(i.uv * float2(pw, ph), float2(pw - 1, ph - 1)));
+    float  y  = tex.Load(int3(p, 0)).r;
+    float2 c  = chroma.Load(int3(p >> 1, 0)).rg;
+#if defined(FMT_P010)
+    // 10 бит в старших битах: UNORM даёт v * 64 / 65535. Приводим к шкале
+    // 8 бит (v / 4 / 255) — те же ColorParams, что у NV12 и YUY2.
+    y *= 65535.0f / 65280.0f;
+    c *= 65535.0f / 65280.0f;
+#endif
+    return float4(finish(yuvToRgb(y, c.x, c.y)), 1.0f);
+}
+#elif defined(FMT_YUY2)
+float4 main(VS_OUT i) : SV_TARGET {
+    uint pw, ph;
+    tex.GetDimensions(pw, ph);
+    // Билинейная выборка по упакованным парам смешала бы Y и U/V —
+    // читаем texel через Load по целочисленным координатам исходного пикселя.
+    int2   p = int2(min(i.uv * float2(pw * 2, ph), float2(pw * 2 - 1, ph - 1)));
+    float4 t = tex.Load(int3(p.x >> 1, p.y, 0));
+    float  y = (p.x & 1) ? t.b : t.r;
+    return float4(finish(yuvToRgb(y, t.g, t.a)), 1.0f);
+}
+#else
+float4 main(VS_OUT i) : SV_TARGET {
+    float3 c = tex.Sample(sam, i.uv).bgr;
+    return float4(finish(c * rgbRange.x + rgbRange.y), 1.0f);
+}
+#endif